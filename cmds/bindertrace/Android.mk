@@ -0,0 +1,8 @@
+LOCAL_PATH:= $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := bindertrace.cpp
+LOCAL_SHARED_LIBRARIES := libbinder libutils liblog
+LOCAL_MODULE := bindertrace
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Prints a trace written by BinderTrace, oldest record first.
+
+#include <binder/BinderTrace.h>
+#include <binder/TextOutput.h>
+#include <utils/Vector.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace android;
+
+static int compareRecords(const BinderTrace::Record* const* lhs,
+        const BinderTrace::Record* const* rhs)
+{
+    if ((*lhs)->when != (*rhs)->when) {
+        return (*lhs)->when < (*rhs)->when ? -1 : 1;
+    }
+    return (*lhs)->seq - (*rhs)->seq;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-x] TRACE_FILE\n"
+            "  -x  also dump the start of the data of each transaction\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    bool dumpPayload = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "x")) != -1) {
+        if (opt == 'x') {
+            dumpPayload = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    const size_t size = st.st_size;
+    void* base = size >= sizeof(BinderTrace::FileHeader)
+            ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "%s: not a binder trace\n", path);
+        return 1;
+    }
+
+    const BinderTrace::FileHeader* header =
+            static_cast<const BinderTrace::FileHeader*>(base);
+    if (header->magic != BinderTrace::MAGIC || header->version != BinderTrace::VERSION
+            || header->recordSize != sizeof(BinderTrace::Record)) {
+        fprintf(stderr, "%s: not a binder trace, or from another version\n", path);
+        return 1;
+    }
+    if (header->pointerSize != sizeof(void*)) {
+        // The command arguments are laid out for the recording process.
+        fprintf(stderr, "%s: recorded by a %d-bit process, use the %d-bit tool\n",
+                path, header->pointerSize * 8, header->pointerSize * 8);
+        return 1;
+    }
+    const size_t ringSize = sizeof(BinderTrace::RingHeader)
+            + size_t(header->recordsPerRing) * sizeof(BinderTrace::Record);
+    if (header->recordsPerRing == 0
+            || (size - sizeof(*header)) / ringSize < header->numRings) {
+        fprintf(stderr, "%s: truncated binder trace\n", path);
+        return 1;
+    }
+
+    const uint32_t ringsUsed = uint32_t(header->ringsUsed) < header->numRings
+            ? header->ringsUsed : header->numRings;
+    Vector<const BinderTrace::Record*> records;
+    for (uint32_t i = 0; i < ringsUsed; i++) {
+        const uint8_t* ring = reinterpret_cast<const uint8_t*>(header + 1) + i * ringSize;
+        const BinderTrace::Record* slots = reinterpret_cast<const BinderTrace::Record*>(
+                ring + sizeof(BinderTrace::RingHeader));
+        for (uint32_t j = 0; j < header->recordsPerRing; j++) {
+            const BinderTrace::Record* r = &slots[j];
+            // Skip empty slots and records caught in the middle of a write.
+            if (r->seq != 0 && uint32_t(r->seq - 1) % header->recordsPerRing == j) {
+                records.add(r);
+            }
+        }
+    }
+    records.sort(compareRecords);
+
+    aout << "Binder trace of pid " << header->pid << ": " << records.size()
+            << " records from " << ringsUsed << " threads";
+    if (header->threadsDropped) {
+        aout << " (" << header->threadsDropped << " more threads not recorded)";
+    }
+    aout << endl;
+
+    char prefix[64];
+    for (size_t i = 0; i < records.size(); i++) {
+        const BinderTrace::Record& r = *records[i];
+        const int64_t us = (r.when - header->startTime) / 1000;
+        snprintf(prefix, sizeof(prefix), "%lld.%06lld %5d %s ",
+                (long long)(us / 1000000), (long long)(us % 1000000), r.tid,
+                r.kind == BinderTrace::KIND_RETURN ? "<" : ">");
+        aout << prefix;
+        BinderTrace::printRecord(aout, r);
+        if (dumpPayload && r.payloadSize) {
+            aout << indent << "payload: " << HexDump(r.payload, r.payloadSize) << dedent << endl;
+        }
+    }
+
+    munmap(base, size);
+    return 0;
+}
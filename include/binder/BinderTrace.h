@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BINDER_TRACE_H
+#define ANDROID_BINDER_TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+
+// ---------------------------------------------------------------------------
+namespace android {
+
+class TextOutput;
+
+/*
+ * Flight recorder for the commands a process exchanges with the binder
+ * driver.
+ *
+ * Once started, every BC_ command sent and BR_ command received is stored
+ * as a fixed size binary record in a ring of the calling thread. The rings
+ * live in a file mapped MAP_SHARED, so the trace survives the process and
+ * can be read at any time with the bindertrace tool, which prints the
+ * records the way IPCThreadState logs commands.
+ *
+ * File layout: a FileHeader, then numRings rings, each a RingHeader
+ * followed by recordsPerRing Records. A thread takes the next free ring
+ * the first time it records; threads that find none are counted in
+ * FileHeader::threadsDropped and not recorded.
+ */
+class BinderTrace
+{
+public:
+    enum {
+        MAGIC           = 0x43525442,   // "BTRC"
+        VERSION         = 1,
+
+        RECORD_SIZE     = 192,
+        ARGS_SIZE       = 64,
+        PAYLOAD_SIZE    = 84,
+
+        KIND_COMMAND    = 0,            // BC_ command sent to the driver
+        KIND_RETURN     = 1             // BR_ command read from the driver
+    };
+
+    struct FileHeader {
+        uint32_t            magic;
+        uint16_t            version;
+        uint16_t            pointerSize;    // sizeof(void*) in the process
+        uint32_t            recordSize;
+        uint32_t            recordsPerRing;
+        uint32_t            numRings;
+        volatile int32_t    ringsUsed;
+        volatile int32_t    threadsDropped;
+        int32_t             pid;
+        int64_t             startTime;      // CLOCK_MONOTONIC, in ns
+        uint8_t             reserved[24];
+    };
+
+    struct RingHeader {
+        int32_t             tid;
+        // Number of records ever written to the ring; the next one goes
+        // to slot (next % recordsPerRing).
+        volatile int32_t    next;
+        uint8_t             reserved[56];
+    };
+
+    struct Record {
+        // 0 while the record is being written, otherwise the value of
+        // RingHeader::next it was written at, plus one.
+        volatile int32_t    seq;
+        int32_t             tid;
+        int64_t             when;           // CLOCK_MONOTONIC, in ns
+        uint32_t            cmd;
+        uint16_t            kind;
+        uint16_t            argsSize;       // bytes of 'args' in use
+        // Transactions and replies only: the target handle, the
+        // transaction code, and the sizes of the data and offsets.
+        uint32_t            handle;
+        uint32_t            code;
+        uint32_t            dataSize;
+        uint32_t            offsetsSize;
+        uint32_t            payloadSize;    // bytes of 'payload' in use
+        // The arguments of the command as passed to or from the driver.
+        uint8_t             args[ARGS_SIZE];
+        // The start of the transaction data.
+        uint8_t             payload[PAYLOAD_SIZE];
+    };
+
+    // Start recording into a new file at 'path', with room for numThreads
+    // threads of recordsPerThread records each. Anything already at 'path'
+    // is replaced, and the new file is readable by its owner only.
+    // Recording can be started only once per process. ProcessState starts
+    // it when debug.binder.trace_dir is set on a debuggable build.
+    static  status_t        start(const char* path, uint32_t numThreads = 16,
+                                  uint32_t recordsPerThread = 1024);
+
+    // Stop recording. The file stays mapped, and can be read as it is.
+    static  void            stop();
+
+    static inline bool      isEnabled() { return sEnabled != 0; }
+
+    // Record the commands in a buffer written to or read from the driver.
+    static  void            recordCommands(const void* data, size_t size);
+    static  void            recordReturns(const void* data, size_t size);
+
+    // Print one command in the text format of IPCThreadState's log, and
+    // return a pointer to the command that follows it.
+    static  const void*     printCommand(TextOutput& out, const void* cmd);
+    static  const void*     printReturnCommand(TextOutput& out, const void* cmd);
+
+    // Print a record as printCommand() or printReturnCommand() prints the
+    // command it holds.
+    static  void            printRecord(TextOutput& out, const Record& record);
+
+    static  const char*     returnString(uint32_t cmd);
+
+private:
+    static  void            record(uint16_t kind, const void* data, size_t size);
+
+    static volatile int32_t sEnabled;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_BINDER_TRACE_H
@@ -19,6 +19,7 @@
 
 #include <binder/TextOutput.h>
 #include <utils/threads.h>
+#include <utils/Vector.h>
 #include <sys/uio.h>
 
 // ---------------------------------------------------------------------------
@@ -29,7 +30,14 @@ class BufferedTextOutput : public TextOutput
 public:
     //** Flags for constructor */
     enum {
-        MULTITHREADED = 0x0001
+        MULTITHREADED = 0x0001,
+        // Complete lines are queued in a per-thread ring and written by
+        // a background thread, so print() does not wait for writeLines().
+        // Lines are dropped, and counted, when a thread's ring is full,
+        // and lines still queued when the process dies are lost, so this
+        // is for high volume tracing rather than diagnostics. Only takes
+        // effect with MULTITHREADED.
+        ASYNC = 0x0002
     };
     
                         BufferedTextOutput(uint32_t flags = 0);
@@ -42,23 +50,53 @@ public:
     virtual void        popBundle();
     
 protected:
+    // Calls are serialized, but in ASYNC mode they come from the writer
+    // thread rather than the thread that printed.
     virtual status_t    writeLines(const struct iovec& vec, size_t N) = 0;
 
+    // Writes out the lines queued in ASYNC mode and stops the writer
+    // thread. Subclasses using ASYNC must call this from their destructor,
+    // since writeLines() can't be called once they are destroyed; it is a
+    // fatal error for the writer to still be running when the
+    // BufferedTextOutput is destroyed. Lines printed afterwards are written
+    // synchronously.
+            void        stopAsync();
+
 private:
     struct BufferState;
     struct ThreadState;
+    struct AsyncRing;
+    class AsyncWriter;
     
     static  ThreadState*getThreadState();
     static  void        threadDestructor(void *st);
     
-            BufferState*getBuffer() const;
+            BufferState*getBuffer();
+            void        emitLines(BufferState* b, const char* txt, size_t len);
+            sp<AsyncRing> attachRing();
+            bool        hasQueuedRecords_l();
+            bool        drainRings_l();
+            void        stopWriter();
+
+    static  void        registerAtFork();
+    static  void        prepareFork();
+    static  void        parentAfterFork();
+    static  void        childAfterFork();
             
     uint32_t            mFlags;
-    const int32_t       mSeq;
+    int32_t             mSeq;       // renewed in a forked child
     const int32_t       mIndex;
     
     Mutex               mLock;
     BufferState*        mGlobalState;
+
+    // ASYNC mode: the rings of all threads and the thread that drains them.
+    Mutex               mAsyncLock;
+    Vector<sp<AsyncRing> > mRings;
+    sp<AsyncWriter>     mAsyncWriter;
+    volatile int32_t    mAsyncIdle;     // the writer is waiting to be woken
+    volatile int32_t    mAsyncStopped;  // stopAsync() has been called
+    BufferedTextOutput* mNextAsync;     // next in the list of ASYNC outputs
 };
 
 // ---------------------------------------------------------------------------
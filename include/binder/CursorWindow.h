@@ -40,12 +40,18 @@ namespace android {
 
 /**
  * This class stores a set of rows from a database in a buffer. The begining of the
- * window has first chunk of RowSlots, which are offsets to the row directory, followed by
- * an offset to the next chunk in a linked-list of additional chunk of RowSlots in case
- * the pre-allocated chunk isn't big enough to refer to all rows. Each row directory has a
- * FieldSlot per column, which has the size, offset, and type of the data for that field.
+ * window has a chunk directory, an array of offsets to fixed size chunks of RowSlots,
+ * followed by the first chunk. A RowSlot is the offset of a row directory, so any row
+ * is found with two lookups. The chunk directory is reallocated at twice the size when
+ * it fills up. Each row directory has a FieldSlot per column, which has the size,
+ * offset, and type of the data for that field.
  * Note that the data types come from sqlite3.h.
  *
+ * A window whose columns only hold integers, floats and nulls can instead be made
+ * columnar before the first row is added. It then keeps the FieldSlots of each column
+ * next to each other in a region reserved for a fixed number of rows, and reading a
+ * column is a strided walk through memory.
+ *
  * Strings are stored in UTF-8.
  */
 class CursorWindow {
@@ -95,6 +101,15 @@ public:
     status_t clear();
     status_t setNumColumns(uint32_t numColumns);
 
+    /**
+     * Switches the window to the columnar layout, reserving FieldSlots for maxRows
+     * rows. Must be called after setNumColumns() and before the first row is added.
+     * Strings and blobs can still be stored while space remains, but the layout is
+     * meant for windows that hold none.
+     */
+    status_t setColumnar(uint32_t maxRows);
+    inline bool isColumnar() { return mHeader->columnarOffset != 0; }
+
     /**
      * Allocate a row slot and its directory.
      * The row is initialized will null entries for each field.
@@ -108,12 +123,69 @@ public:
     status_t putDouble(uint32_t row, uint32_t column, double value);
     status_t putNull(uint32_t row, uint32_t column);
 
+    /**
+     * Returns the exact number of bytes that appending numRows rows with beginRow()
+     * will take from freeSpace(), where payloadSizes[i] is the total size of the
+     * strings and blobs of row i. Every beginRow() call for those rows succeeds if
+     * the result is no larger than freeSpace(). Returns SIZE_MAX if the rows do not
+     * fit in a columnar window.
+     */
+    size_t getSpaceNeeded(const size_t* payloadSizes, uint32_t numRows);
+
+    /**
+     * Appends a row whose fields are then written in column order with the putNext
+     * methods, without looking up a field slot for each of them. payloadSize is the
+     * total size of the strings and blobs the row will hold, which are placed with
+     * its field directory. Fields that are not written are null.
+     * Returns NO_MEMORY, without logging, if the row does not fit.
+     */
+    status_t beginRow(size_t payloadSize);
+
+    inline status_t putNextLong(int64_t value) {
+        FieldSlot* fieldSlot = nextFieldSlot();
+        if (!fieldSlot) {
+            return INVALID_OPERATION;
+        }
+        fieldSlot->type = FIELD_TYPE_INTEGER;
+        fieldSlot->data.l = value;
+        return OK;
+    }
+
+    inline status_t putNextDouble(double value) {
+        FieldSlot* fieldSlot = nextFieldSlot();
+        if (!fieldSlot) {
+            return INVALID_OPERATION;
+        }
+        fieldSlot->type = FIELD_TYPE_FLOAT;
+        fieldSlot->data.d = value;
+        return OK;
+    }
+
+    inline status_t putNextNull() {
+        // beginRow() cleared the field already.
+        return nextFieldSlot() ? OK : INVALID_OPERATION;
+    }
+
+    status_t putNextBlob(const void* value, size_t size);
+    status_t putNextString(const char* value, size_t sizeIncludingNull);
+
     /**
      * Gets the field slot at the specified row and column.
      * Returns null if the requested row or column is not in the window.
      */
     FieldSlot* getFieldSlot(uint32_t row, uint32_t column);
 
+    /**
+     * Copies the values of numRows fields of a column, starting at startRow.
+     * Integers and floats are converted to the requested type and nulls read as 0.
+     * Returns BAD_VALUE if the range is not in the window, or BAD_TYPE if it
+     * contains a string or a blob.
+     */
+    status_t getColumnLongs(uint32_t column, uint32_t startRow, uint32_t numRows,
+            int64_t* outValues);
+    status_t getColumnDoubles(uint32_t column, uint32_t startRow, uint32_t numRows,
+            double* outValues);
+
     inline int32_t getFieldSlotType(FieldSlot* fieldSlot) {
         return fieldSlot->type;
     }
@@ -138,17 +210,26 @@ public:
     }
 
 private:
-    static const size_t ROW_SLOT_CHUNK_NUM_ROWS = 100;
+    static const size_t ROW_SLOT_CHUNK_NUM_ROWS = 128;
+    static const size_t INITIAL_CHUNK_DIR_CAPACITY = 16;
 
     struct Header {
         // Offset of the lowest unused byte in the window.
         uint32_t freeOffset;
 
-        // Offset of the first row slot chunk.
-        uint32_t firstChunkOffset;
+        // Offset of the chunk directory, its capacity, and the number of
+        // chunks it refers to.
+        uint32_t chunkDirOffset;
+        uint32_t chunkDirCapacity;
+        uint32_t numChunks;
 
         uint32_t numRows;
         uint32_t numColumns;
+
+        // Offset of the column-major FieldSlots of a columnar window and the
+        // number of rows they can hold, or 0 if the window is not columnar.
+        uint32_t columnarOffset;
+        uint32_t columnarMaxRows;
     };
 
     struct RowSlot {
@@ -157,7 +238,6 @@ private:
 
     struct RowSlotChunk {
         RowSlot slots[ROW_SLOT_CHUNK_NUM_ROWS];
-        uint32_t nextChunkOffset;
     };
 
     String8 mName;
@@ -167,6 +247,13 @@ private:
     bool mReadOnly;
     Header* mHeader;
 
+    // State of the row being written by the putNext methods.
+    FieldSlot* mNextField;
+    uint32_t mNextFieldStride;
+    uint32_t mFieldsLeft;
+    uint32_t mPayloadOffset;
+    uint32_t mPayloadLeft;
+
     inline void* offsetToPtr(uint32_t offset) {
         return static_cast<uint8_t*>(mData) + offset;
     }
@@ -182,11 +269,44 @@ private:
      */
     uint32_t alloc(size_t size, bool aligned = false);
 
-    RowSlot* getRowSlot(uint32_t row);
+    inline RowSlot* getRowSlot(uint32_t row) {
+        const uint32_t* chunkDir = static_cast<uint32_t*>(
+                offsetToPtr(mHeader->chunkDirOffset));
+        RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
+                offsetToPtr(chunkDir[row / ROW_SLOT_CHUNK_NUM_ROWS]));
+        return &chunk->slots[row % ROW_SLOT_CHUNK_NUM_ROWS];
+    }
+
     RowSlot* allocRowSlot();
+    status_t allocColumnarRow();
+    size_t getRowSlotSpaceNeeded(uint32_t numRows);
+
+    inline FieldSlot* nextFieldSlot() {
+        if (!mFieldsLeft) {
+            return NULL;
+        }
+        mFieldsLeft--;
+        FieldSlot* fieldSlot = mNextField;
+        mNextField += mNextFieldStride;
+        return fieldSlot;
+    }
+
+    // Returns the field slot at the specified row and column, which must be
+    // in the window. In a columnar window consecutive rows of a column are
+    // adjacent, so a column scan walks through memory with a fixed stride.
+    inline FieldSlot* fieldSlotAt(uint32_t row, uint32_t column) {
+        if (mHeader->columnarOffset) {
+            FieldSlot* columns = static_cast<FieldSlot*>(
+                    offsetToPtr(mHeader->columnarOffset));
+            return &columns[column * mHeader->columnarMaxRows + row];
+        }
+        FieldSlot* fieldDir = static_cast<FieldSlot*>(offsetToPtr(getRowSlot(row)->offset));
+        return &fieldDir[column];
+    }
 
     status_t putBlobOrString(uint32_t row, uint32_t column,
             const void* value, size_t size, int32_t type);
+    status_t putNextBlobOrString(const void* value, size_t size, int32_t type);
 };
 
 }; // namespace android
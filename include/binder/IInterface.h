@@ -81,7 +81,8 @@ protected:
 
 
 #define IMPLEMENT_META_INTERFACE(INTERFACE, NAME)                       \
-    const android::String16 I##INTERFACE::descriptor(NAME);             \
+    const android::String16 I##INTERFACE::descriptor(                   \
+            android::String16(NAME).intern());                          \
     const android::String16&                                            \
             I##INTERFACE::getInterfaceDescriptor() const {              \
         return I##INTERFACE::descriptor;                                \
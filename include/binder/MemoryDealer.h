@@ -27,15 +27,26 @@
 namespace android {
 // ----------------------------------------------------------------------------
 
-class SimpleBestFitAllocator;
+class HeapAllocator;
 
 // ----------------------------------------------------------------------------
 
 class MemoryDealer : public RefBase
 {
 public:
+    enum {
+        // Best fit over a single list of blocks. Allocating and freeing
+        // walk the list, so they slow down as allocations accumulate.
+        SIMPLE_BEST_FIT     = 0,
+        // Segregated size-class free lists and a map from offsets to blocks.
+        // Allocating and freeing take constant time, and dump() reports
+        // fragmentation and throughput statistics.
+        SEGREGATED_FIT      = 1
+    };
+
     MemoryDealer(size_t size, const char* name = 0,
-            uint32_t flags = 0 /* or bits such as MemoryHeapBase::READ_ONLY */ );
+            uint32_t flags = 0 /* or bits such as MemoryHeapBase::READ_ONLY */,
+            int allocator = SIMPLE_BEST_FIT);
 
     virtual sp<IMemory> allocate(size_t size);
     virtual void        deallocate(size_t offset);
@@ -48,10 +59,10 @@ protected:
 
 private:
     const sp<IMemoryHeap>&      heap() const;
-    SimpleBestFitAllocator*     allocator() const;
+    HeapAllocator*              allocator() const;
 
     sp<IMemoryHeap>             mHeap;
-    SimpleBestFitAllocator*     mAllocator;
+    HeapAllocator*              mAllocator;
 };
 
 
@@ -31,6 +31,10 @@ struct ABitReader {
     uint32_t getBits(size_t n);
     void skipBits(size_t n);
 
+    // Exp-Golomb coded values as used by H.264 (ue(v) and se(v)).
+    uint32_t getUE();
+    int32_t getSE();
+
     void putBits(uint32_t x, size_t n);
 
     size_t numBitsLeft() const;
@@ -41,7 +45,7 @@ private:
     const uint8_t *mData;
     size_t mSize;
 
-    uint32_t mReservoir;  // left-aligned bits
+    uint64_t mReservoir;  // left-aligned bits, unused low bits are zero
     size_t mNumBitsLeft;
 
     void fillReservoir();
@@ -26,6 +26,7 @@
 
 namespace android {
 
+struct ABufferPool;
 struct AMessage;
 
 struct ABuffer : public RefBase {
@@ -51,6 +52,12 @@ protected:
     virtual ~ABuffer();
 
 private:
+    friend struct ABufferPool;
+
+    // Payload is owned by "pool" and handed back to it on destruction.
+    ABuffer(const sp<ABufferPool> &pool, void *data, size_t capacity);
+
+    sp<ABufferPool> mPool;
     sp<AMessage> mFarewell;
     sp<AMessage> mMeta;
 
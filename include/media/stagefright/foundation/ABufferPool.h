@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef A_BUFFER_POOL_H_
+
+#define A_BUFFER_POOL_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <media/stagefright/foundation/ABase.h>
+#include <utils/RefBase.h>
+#include <utils/threads.h>
+
+namespace android {
+
+struct ABuffer;
+
+// Recycles ABuffer payloads in power-of-two size classes. A pool is meant
+// to be owned by a single ALooper (see ALooper::bufferPool()) or a single
+// session, so its lock is practically never contended. Buffers handed out
+// by acquire() keep a reference to the pool and return their payload to it
+// when the last strong reference to the buffer goes away.
+struct ABufferPool : public RefBase {
+    struct Stats {
+        uint32_t mNumAcquired;   // payloads handed out by acquire()
+        uint32_t mNumRecycled;   // ...of which were served from a freelist
+        uint32_t mNumMallocs;    // ...of which had to be malloc'ed
+        uint32_t mNumFreed;      // payloads freed because a class was full
+        uint32_t mNumCached;     // payloads currently sitting in freelists
+        size_t mBytesCached;
+    };
+
+    ABufferPool(size_t maxCachedPerClass = kDefaultMaxCachedPerClass);
+
+    // Returns a buffer of exactly "capacity" bytes whose payload is taken
+    // from the matching size class. Requests larger than the largest class
+    // are malloc'ed and freed directly.
+    sp<ABuffer> acquire(size_t capacity);
+
+    // Releases all cached payloads back to the system.
+    void trim();
+
+    void getStats(Stats *stats) const;
+
+protected:
+    virtual ~ABufferPool();
+
+private:
+    friend struct ABuffer;
+
+    enum {
+        kMinClassShift = 8,     // 256 bytes
+        kMaxClassShift = 20,    // 1 MB
+        kNumClasses = kMaxClassShift - kMinClassShift + 1,
+
+        kDefaultMaxCachedPerClass = 16,
+    };
+
+    // Payloads on a freelist are chained through their first word.
+    struct FreeBlock {
+        FreeBlock *mNext;
+    };
+
+    mutable Mutex mLock;
+    size_t mMaxCachedPerClass;
+    FreeBlock *mFreeLists[kNumClasses];
+    size_t mNumFree[kNumClasses];
+    Stats mStats;
+
+    static ssize_t ClassForCapacity(size_t capacity);
+
+    void *allocPayload(size_t capacity);
+    void releasePayload(void *data, size_t capacity);
+
+    DISALLOW_EVIL_CONSTRUCTORS(ABufferPool);
+};
+
+}  // namespace android
+
+#endif  // A_BUFFER_POOL_H_
@@ -28,6 +28,7 @@
 
 namespace android {
 
+struct ABufferPool;
 struct AHandler;
 struct AMessage;
 
@@ -53,6 +54,10 @@ struct ALooper : public RefBase {
 
     static int64_t GetNowUs();
 
+    // Payload pool for buffers produced by handlers running on this looper.
+    // Created on first use.
+    sp<ABufferPool> bufferPool();
+
 protected:
     virtual ~ALooper();
 
@@ -69,6 +74,8 @@ private:
 
     AString mName;
 
+    sp<ABufferPool> mBufferPool;
+
     List<Event> mEventQueue;
 
     struct LooperThread;
@@ -90,6 +90,20 @@ struct AMessage : public RefBase {
 
     AString debugString(int32_t indent = 0) const;
 
+    // AMessage storage is recycled through a process-wide freelist: when the
+    // last strong reference goes away (RefBase::decStrong deletes the object)
+    // the memory is kept for the next "new AMessage" instead of being freed.
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+
+    struct PoolStats {
+        uint32_t mNumAllocated;  // total "new AMessage" calls
+        uint32_t mNumRecycled;   // ...served from the freelist
+        uint32_t mNumMallocs;    // ...that had to go to the heap
+        uint32_t mNumCached;     // messages currently on the freelist
+    };
+    static void GetPoolStats(PoolStats *stats);
+
 protected:
     virtual ~AMessage();
 
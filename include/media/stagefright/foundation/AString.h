@@ -38,6 +38,9 @@ struct AString {
     size_t size() const;
     const char *c_str() const;
 
+    // Makes sure "capacity" characters fit without further reallocation.
+    void reserve(size_t capacity);
+
     bool empty() const;
 
     void clear();
@@ -77,13 +80,19 @@ struct AString {
     void tolower();
 
 private:
-    static const char *kEmptyString;
+    enum {
+        // Strings up to kInlineSize - 1 characters live in mInlineData and
+        // never touch the heap.
+        kInlineSize = 24,
+    };
 
     char *mData;
     size_t mSize;
     size_t mAllocSize;
+    char mInlineData[kInlineSize];
 
-    void makeMutable();
+    bool isInline() const { return mData == mInlineData; }
+    void growTo(size_t allocSize);
 };
 
 AString StringPrintf(const char *format, ...);
@@ -28,6 +28,16 @@ struct AString;
 sp<ABuffer> decodeBase64(const AString &s);
 void encodeBase64(const void *data, size_t size, AString *out);
 
+// Returns the number of bytes "size" characters of base64 decode to, or
+// -1 if "size" is not a multiple of 4.
+ssize_t decodedBase64Size(const char *s, size_t size);
+
+// Decodes into a caller-supplied buffer without allocating. Returns the
+// number of bytes written, or -1 if the input is malformed or "outCapacity"
+// is too small.
+ssize_t decodeBase64(
+        const char *s, size_t size, uint8_t *out, size_t outCapacity);
+
 }  // namespace android
 
 #endif  // BASE_64_H_
@@ -27,6 +27,12 @@
 
 namespace android {
 
+class TextOutput;
+
+// For IPCThreadState.cpp: where IF_LOG_COMMANDS() output goes. Unlike
+// alog, its lines are written asynchronously.
+extern TextOutput& gCommandLog;
+
 // For ProcessState.cpp
 extern Mutex gProcessMutex;
 extern sp<ProcessState> gProcess;
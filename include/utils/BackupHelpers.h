@@ -21,6 +21,8 @@
 #include <utils/String8.h>
 #include <utils/KeyedVector.h>
 
+#include <sys/uio.h>
+
 namespace android {
 
 enum {
@@ -53,12 +55,17 @@ struct FileRec {
     String8 file;
     bool deleted;
     FileState s;
+    int64_t inode; // only recorded by back_up_files() with BACKUP_FILES_TRUST_METADATA
 };
 
 
 /**
  * Writes the data.
  *
+ * Nothing is buffered: everything a call writes is on the fd when it returns.
+ * The padding owed by the previous entity, an entity's header and its key go
+ * out together in one writev().
+ *
  * If an error occurs, it poisons this object and all write calls will fail
  * with the error that occurred.
  */
@@ -80,22 +87,35 @@ public:
      */
     status_t WriteEntityData(const void* data, size_t size);
 
+    /* Like WriteEntityData, but copies up to 'size' bytes from the current
+     * position of 'fd', in the kernel when the output allows it.  *copied is
+     * set to the number of bytes copied, which is less than 'size' if 'fd'
+     * ends first.  Errors reading 'fd' are returned without poisoning the
+     * writer.
+     */
+    status_t WriteEntityDataFromFd(int fd, size_t size, size_t* copied);
+
     void SetKeyPrefix(const String8& keyPrefix);
 
 private:
     explicit BackupDataWriter();
-    status_t write_padding_for(int n);
+    status_t write_vectors(struct iovec* iov, int count);
+    status_t copy_through_buffer(int fd, size_t size, size_t* copied);
     
     int m_fd;
     status_t m_status;
     ssize_t m_pos;
     int m_entityCount;
     String8 m_keyPrefix;
+    bool m_canSendfile;
 };
 
 /**
  * Reads the data.
  *
+ * Reads go through a buffer, so the reader may consume more of the fd than
+ * it has returned; nothing else should read from the fd while it is in use.
+ *
  * If an error occurs, it poisons this object and all write calls will fail
  * with the error that occurred.
  */
@@ -114,9 +134,48 @@ public:
     status_t SkipEntityData(); // must be called with the pointer at the beginning of the data.
     ssize_t ReadEntityData(void* data, size_t size);
 
+    /* Iterates over the remaining entities, with the data of each in one
+     * piece and usually without copying it:
+     *
+     *     BackupDataReader::EntityIterator it(&reader);
+     *     while (it.next()) {
+     *         restore(it.key(), it.data(), it.dataSize());
+     *     }
+     *     if (it.status() != NO_ERROR) { ... }
+     *
+     * The data points into the reader's buffer, or into one of the iterator's
+     * own when it doesn't fit there, and is valid until the next call to
+     * next().  dataSize() is -1 for an entity that records a deletion.
+     */
+    class EntityIterator
+    {
+    public:
+        EntityIterator(BackupDataReader* reader);
+        ~EntityIterator();
+
+        bool next();
+
+        const String8& key() const { return m_reader->m_key; }
+        const void* data() const { return m_data; }
+        ssize_t dataSize() const { return m_dataSize; }
+        status_t status() const { return m_status; }
+
+    private:
+        BackupDataReader* m_reader;
+        status_t m_status;
+        const void* m_data;
+        ssize_t m_dataSize;
+        void* m_buf;
+        size_t m_bufSize;
+    };
+
 private:
     explicit BackupDataReader();
+    BackupDataReader(const BackupDataReader&);
     status_t skip_padding();
+    ssize_t fill(size_t size);
+    status_t read_fully(void* data, size_t size);
+    void consume(size_t size) { m_bufPos += size; m_pos += size; }
     
     int m_fd;
     bool m_done;
@@ -129,10 +188,21 @@ private:
         entity_header_v1 entity;
     } m_header;
     String8 m_key;
+    char* m_buf;
+    size_t m_bufPos;        // next byte of m_buf to return
+    size_t m_bufEnd;        // end of the bytes read into m_buf
+};
+
+enum {
+    // Take a file to be unchanged, without reading it, when its modification
+    // time (to the nanosecond), mode, size and inode number all match the old
+    // snapshot. The new snapshot records the inode numbers; the first backup
+    // in this mode still checksums every file.
+    BACKUP_FILES_TRUST_METADATA = 0x0001,
 };
 
 int back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD,
-        char const* const* files, char const* const *keys, int fileCount);
+        char const* const* files, char const* const *keys, int fileCount, int flags = 0);
 
 int write_tarfile(const String8& packageName, const String8& domain,
         const String8& rootPath, const String8& filePath, BackupDataWriter* outputStream);
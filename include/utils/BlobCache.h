@@ -18,21 +18,32 @@
 #define ANDROID_BLOB_CACHE_H
 
 #include <stddef.h>
+#include <string.h>
 
+#include <utils/BasicHashtable.h>
 #include <utils/Flattenable.h>
 #include <utils/RefBase.h>
-#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <utils/threads.h>
 
 namespace android {
 
+class FileMap;
+
 // A BlobCache is an in-memory cache for binary key/value pairs.  A BlobCache
-// does NOT provide any thread-safety guarantees.
+// is thread-safe: entries are spread over a number of independently locked
+// shards so that concurrent lookups of different keys rarely contend.
+//
+// Entries are indexed by a hash of their key bytes and evicted in least
+// recently used order when the cache runs out of room.
 //
 // The cache contents can be serialized to an in-memory buffer or mmap'd file
-// and then reloaded in a subsequent execution of the program.  This
-// serialization is non-portable and the data should only be used by the device
-// that generated it.
+// and then reloaded in a subsequent execution of the program.  Alternatively
+// the cache can be attached to a file that it maintains itself: entries are
+// then served straight out of a read-only mapping of that file and only new
+// entries are appended to it on each sync.  Either serialization is
+// non-portable and the data should only be used by the device that generated
+// it.
 class BlobCache : public RefBase {
 
 public:
@@ -42,6 +53,7 @@ public:
     // maxValueSize, respectively. The total combined size of ALL cache entries
     // (key sizes plus value sizes) will not exceed maxTotalSize.
     BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize);
+    ~BlobCache();
 
     // set inserts a new binary value into the cache and associates it with the
     // given binary key.  If the key or value are too large for the cache then
@@ -101,72 +113,147 @@ public:
     //
     status_t unflatten(void const* buffer, size_t size);
 
+    // attachFile replaces the contents of the cache with the entries stored
+    // in the cache file at 'path' and keeps that file attached, creating it
+    // if needed.  The file is mapped rather than read, so attaching does not
+    // copy any keys or values; they are paged in as they are looked up.  A
+    // file that is corrupt or was written by a different build is truncated
+    // and the cache starts out empty.  A record that turns out not to match
+    // the file's index when it is first looked up is dropped, and the lookup
+    // misses.
+    //
+    // Compaction runs on a background thread that the destructor stops and
+    // joins, so attachFile may be used on a cache that lives on the stack or
+    // on the heap as well as one held by an sp<>.
+    status_t attachFile(const char* path);
+
+    // sync appends the entries that were set since the last sync to the
+    // attached file, followed by a fresh index of all live entries.  Existing
+    // records are never rewritten.  Once the file holds more than twice as
+    // many bytes as the live entries need, a background thread rewrites it
+    // with just the live entries.
+    status_t sync();
+
+    // Stats are the cumulative counters of a BlobCache, summed over all of its
+    // shards.
+    struct Stats {
+        size_t numEntries;
+        size_t totalSize;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    // getStats returns a snapshot of the cache counters.
+    void getStats(Stats* outStats) const;
+
 private:
     // Copying is disallowed.
     BlobCache(const BlobCache&);
     void operator=(const BlobCache&);
 
-    // A random function helper to get around MinGW not having nrand48()
-    long int blob_random();
+    // Maximum number of independently locked shards.
+    enum { MAX_SHARDS = 8 };
+
+    // An Entry is a single key/value pair in the cache.  The key bytes are
+    // followed immediately by the value bytes, either in the same allocation
+    // as the Entry or in the mapping of the attached file.
+    struct Entry {
+        Entry* lruPrev;     // more recently used neighbour, or NULL
+        Entry* lruNext;     // less recently used neighbour, or NULL
+        hash_t hash;
+        size_t keySize;
+        size_t valueSize;
+        uint32_t fileOffset;    // record offset in the attached file, 0 if dirty
+        bool checked;           // false until a mapped record is validated
+        const uint8_t* bytes;   // either data or a pointer into the file map
+        uint8_t data[];
+
+        inline const uint8_t* key() const { return bytes; }
+        inline const uint8_t* value() const { return bytes + keySize; }
+        inline size_t size() const { return keySize + valueSize; }
+        inline bool isMapped() const { return bytes != data; }
+    };
 
-    // clean evicts a randomly chosen set of entries from the cache such that
-    // the total size of all remaining entries is less than mMaxTotalSize/2.
-    void clean();
+    // A BlobKey refers to key bytes owned by someone else, either an Entry
+    // or the caller of get/set, so that lookups never allocate.
+    struct BlobKey {
+        BlobKey() : data(NULL), size(0) { }
+        BlobKey(const void* data, size_t size) : data(data), size(size) { }
 
-    // isCleanable returns true if the cache is full enough for the clean method
-    // to have some effect, and false otherwise.
-    bool isCleanable() const;
+        inline bool operator==(const BlobKey& rhs) const {
+            return size == rhs.size && !memcmp(data, rhs.data, size);
+        }
 
-    // A Blob is an immutable sized unstructured data blob.
-    class Blob : public RefBase {
-    public:
-        Blob(const void* data, size_t size, bool copyData);
-        ~Blob();
+        const void* data;
+        size_t size;
+    };
 
-        bool operator<(const Blob& rhs) const;
+    // An IndexEntry derives its key from the entry it points to, so entries
+    // can move between the heap and the file map without being rehashed.
+    struct IndexEntry {
+        IndexEntry(Entry* entry) : entry(entry) { }
 
-        const void* getData() const;
-        size_t getSize() const;
+        inline BlobKey getKey() const {
+            return BlobKey(entry->key(), entry->keySize);
+        }
 
-    private:
-        // Copying is not allowed.
-        Blob(const Blob&);
-        void operator=(const Blob&);
+        Entry* entry;
+    };
 
-        // mData points to the buffer containing the blob data.
-        const void* mData;
+    // A Shard owns a subset of the entries, selected by key hash, along with
+    // the lock that guards them.
+    struct Shard {
+        Shard();
+
+        mutable Mutex lock;
+        BasicHashtable<BlobKey, IndexEntry> index;
+        Entry* lruHead;     // most recently used
+        Entry* lruTail;     // least recently used
+        size_t totalSize;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
 
-        // mSize is the size of the blob data in bytes.
-        size_t mSize;
+    static hash_t hashKey(const void* key, size_t keySize);
+    Shard& shardFor(hash_t hash);
 
-        // mOwnsData indicates whether or not this Blob object should free the
-        // memory pointed to by mData when the Blob gets destructed.
-        bool mOwnsData;
-    };
+    // Index and LRU list maintenance; the shard lock must be held.
+    static Entry* findLocked(Shard& shard, hash_t hash, const void* key,
+            size_t keySize);
+    static void lruUnlinkLocked(Shard& shard, Entry* entry);
+    static void lruPushFrontLocked(Shard& shard, Entry* entry);
+    static void removeLocked(Shard& shard, Entry* entry);
+    static void clearLocked(Shard& shard);
 
-    // A CacheEntry is a single key/value pair in the cache.
-    class CacheEntry {
-    public:
-        CacheEntry();
-        CacheEntry(const sp<Blob>& key, const sp<Blob>& value);
-        CacheEntry(const CacheEntry& ce);
+    // checkRecordLocked validates the file record of a mapped entry on its
+    // first lookup, and removes the entry if the record is damaged.
+    bool checkRecordLocked(Shard& shard, Entry* entry);
 
-        bool operator<(const CacheEntry& rhs) const;
-        const CacheEntry& operator=(const CacheEntry&);
+    // clear drops every entry from every shard.
+    void clear();
 
-        sp<Blob> getKey() const;
-        sp<Blob> getValue() const;
+    // Shard locks are always taken in index order when several are needed.
+    void lockAllShards() const;
+    void unlockAllShards() const;
 
-        void setValue(const sp<Blob>& value);
+    // insertLocked adds 'entry' to the shard, replacing any entry with the
+    // same key and evicting others as needed.  Takes ownership of 'entry'.
+    bool insertLocked(Shard& shard, Entry* entry);
 
-    private:
+    // Attached file maintenance; mFileLock must be held.
+    status_t loadFileLocked(size_t fileSize);
+    status_t resetFileLocked();
+    void compact();
 
-        // mKey is the key that identifies the cache entry.
-        sp<Blob> mKey;
+    class Compactor;
+    friend class Compactor;
 
-        // mValue is the cached data associated with the key.
-        sp<Blob> mValue;
-    };
+    // evictLocked drops least recently used entries from the shard until
+    // 'size' more bytes fit in its budget, keeping 'keep' if non-NULL.
+    // Returns false if the room could not be made.
+    bool evictLocked(Shard& shard, size_t size, const Entry* keep);
 
     // A Header is the header for the entire BlobCache serialization format. No
     // need to make this portable, so we simply write the struct out.
@@ -231,17 +318,43 @@ private:
     // will be evicted from the cache to make room for the new entry.
     const size_t mMaxTotalSize;
 
-    // mTotalSize is the total combined size of all keys and values currently in
-    // the cache.
-    size_t mTotalSize;
+    // mNumShards is the number of shards in use.  The total size budget is
+    // split evenly between them, so a single shard is used when the largest
+    // possible entry would not fit in an even split.
+    size_t mNumShards;
+
+    // mShardMaxSize is the size budget of each shard.
+    size_t mShardMaxSize;
+
+    Shard mShards[MAX_SHARDS];
+
+    // mFileLock serializes attachFile, sync and compaction.  It is always
+    // taken before any shard lock.
+    Mutex mFileLock;
+
+    // mPath and mFd describe the attached file, mFd is -1 if there is none.
+    String8 mPath;
+    int mFd;
+
+    // mFileMap maps the attached file as it was when it was last loaded or
+    // compacted.  Mapped entries point into it.
+    FileMap* mFileMap;
+
+    // mFileSize is the current size of the attached file and mFileLiveSize
+    // the number of those bytes used by records of live entries.
+    size_t mFileSize;
+    size_t mFileLiveSize;
+
+    // mFileIndexSize and mFileIndexChecksum describe the last index written,
+    // so that a sync with nothing to do leaves the file alone.
+    size_t mFileIndexSize;
+    uint32_t mFileIndexChecksum;
 
-    // mRandState is the pseudo-random number generator state. It is passed to
-    // nrand48 to generate random numbers when needed.
-    unsigned short mRandState[3];
+    // mCompacting is true while a background compaction is pending.
+    bool mCompacting;
 
-    // mCacheEntries stores all the cache entries that are resident in memory.
-    // Cache entries are added to it by the 'set' method.
-    SortedVector<CacheEntry> mCacheEntries;
+    // mCompactor is the thread of the last compaction started, if any.
+    sp<Compactor> mCompactor;
 };
 
 }
@@ -43,8 +43,19 @@ public:
 
     // Immediately collect the stack traces for the specified thread.
     // The default is to dump the stack of the current call.
+    // Only the calling thread's stack can be collected; for other threads
+    // the call stack is left empty.
     void update(int32_t ignoreDepth=1, pid_t tid=-1);
 
+    // Store the program counters of the calling thread's stack into pcs,
+    // starting with the caller's frame after skipping ignoreDepth frames.
+    // Returns the number of frames stored. Doesn't allocate or symbolize,
+    // so it is cheap enough for sampling on hot paths.
+    static size_t capture(uintptr_t* pcs, size_t maxFrames, int32_t ignoreDepth=0);
+
+    // Format a frame captured by capture() the way update() does.
+    static String8 formatFrame(size_t index, uintptr_t pc);
+
     // Dump a stack trace to the log using the supplied logtag.
     void log(const char* logtag,
              android_LogPriority priority = ANDROID_LOG_DEBUG,
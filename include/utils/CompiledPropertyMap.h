@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UTILS_COMPILED_PROPERTY_MAP_H
+#define _UTILS_COMPILED_PROPERTY_MAP_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+#include <utils/PropertyMap.h>
+#include <utils/String8.h>
+
+namespace android {
+
+/*
+ * A read-only form of a PropertyMap for configurations that are read often.
+ *
+ * Compiling a property map parses every value as an integer and as a float
+ * once, and builds a hash index of the keys.  Lookups then neither search a
+ * sorted vector nor reparse the value text.
+ *
+ * The compiled map is a single flat block, so it can be written to a cache
+ * file and read back as is.  The cache records the modification time and
+ * size of the property file it was compiled from, and load() only uses it
+ * while those still match, so an unchanged property file is never tokenized
+ * again.  The cache format is not portable; it should only be read by the
+ * device that wrote it.
+ */
+class CompiledPropertyMap {
+public:
+    ~CompiledPropertyMap();
+
+    /* Gets the number of properties. */
+    size_t size() const;
+
+    /* Returns true if the compiled map contains the specified key. */
+    bool hasProperty(const String8& key) const;
+
+    /* Gets the value of a property, as PropertyMap::tryGetProperty() does.
+     * Returns true and sets outValue if the key was found and its value was parsed successfully.
+     * Otherwise returns false and does not modify outValue.  (Also logs a warning.)
+     */
+    bool tryGetProperty(const String8& key, String8& outValue) const;
+    bool tryGetProperty(const String8& key, bool& outValue) const;
+    bool tryGetProperty(const String8& key, int32_t& outValue) const;
+    bool tryGetProperty(const String8& key, float& outValue) const;
+
+    /* Adds all properties to the specified property map. */
+    void addTo(PropertyMap* map) const;
+
+    /* Writes the compiled map to a cache file.
+     * The file is replaced atomically, so concurrent readers see either the
+     * old or the new contents.
+     */
+    status_t writeToFile(const String8& filename) const;
+
+    /* Compiles a property map.
+     * sourceStat describes the file the map was loaded from, if any, and is
+     * recorded for checking a cache written from the result.
+     */
+    static status_t compile(const PropertyMap* map, const struct stat* sourceStat,
+            CompiledPropertyMap** outMap);
+
+    /* Loads a compiled map from a cache file.
+     * Returns NAME_NOT_FOUND if the cache is missing, corrupt, or was written
+     * for a different version of sourceFilename, or if sourceFilename is gone.
+     */
+    static status_t loadCache(const String8& cacheFilename, const String8& sourceFilename,
+            CompiledPropertyMap** outMap);
+
+    /* Loads a compiled map for a property file.
+     * Uses the cache file if it is up to date.  Otherwise loads and compiles
+     * the property file, then tries to rewrite the cache.
+     */
+    static status_t load(const String8& filename, const String8& cacheFilename,
+            CompiledPropertyMap** outMap);
+
+private:
+    struct Header;
+    struct Entry;
+
+    CompiledPropertyMap(void* data, size_t size);
+    CompiledPropertyMap(const CompiledPropertyMap& other); // not copyable
+
+    const Entry* findEntry(const String8& key) const;
+    static bool validate(const void* data, size_t size);
+
+    void* mData;
+    size_t mSize;
+    const Header* mHeader;
+    const Entry* mEntries;
+    const uint32_t* mBuckets;
+    const char* mStrings;
+};
+
+} // namespace android
+
+#endif // _UTILS_COMPILED_PROPERTY_MAP_H
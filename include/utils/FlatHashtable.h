@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FLAT_HASHTABLE_H
+#define ANDROID_FLAT_HASHTABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/TypeHelpers.h>
+
+namespace android {
+
+/*
+ * A FlatHashtable maps unique keys to values using open addressing with
+ * Robin Hood probing.
+ *
+ * Unlike BasicHashtable, it keeps the 32-bit hash codes of its entries in an
+ * array of their own, apart from the entries.  A lookup scans that compact
+ * array linearly from the key's home slot and only touches an entry when
+ * its full hash code matches.  Robin Hood insertion keeps every entry close
+ * to its home slot, so a lookup can stop as soon as it sees an entry that is
+ * closer to its own home than the key would be.  Removal shifts the
+ * following entries back instead of leaving tombstones.
+ *
+ * The price is that adding or removing an entry may move other entries, so
+ * indices (and references to entries) are only valid until the next add(),
+ * remove() or rehash().  The storage is not shared between copies; copying a
+ * FlatHashtable is not supported.
+ *
+ * TKey must support the following contract:
+ *     bool operator==(const TKey& other) const;  // return true if equal
+ *     hash_t hash_type(const TKey& key);         // hash function
+ */
+template <typename TKey, typename TValue>
+class FlatHashtable {
+public:
+    typedef key_value_pair_t<TKey, TValue> entry_type;
+
+    /* Creates a hashtable that can hold at least minimumInitialCapacity
+     * entries before growing.  The storage is created when the first entry
+     * is added.
+     */
+    explicit FlatHashtable(size_t minimumInitialCapacity = 0);
+
+    /* Clears and destroys the hashtable.
+     */
+    ~FlatHashtable();
+
+    /* Returns the number of entries in the hashtable.
+     */
+    inline size_t size() const { return mSize; }
+    inline bool isEmpty() const { return mSize == 0; }
+
+    /* Returns the number of entries the hashtable can hold before it grows.
+     */
+    inline size_t capacity() const { return (mMask + 1) * MAX_LOAD_NUM / MAX_LOAD_DEN; }
+
+    /* Returns the index of the entry for the given key, or -1 if there is
+     * none.  The index stays valid until the hashtable is next modified.
+     */
+    inline ssize_t find(const TKey& key) const { return find(hash_type(key), key); }
+    ssize_t find(hash_t hash, const TKey& key) const;
+
+    /* Returns the entry at the specified index, which must refer to an
+     * existing entry.
+     */
+    inline const entry_type& entryAt(size_t index) const { return mEntries[index]; }
+    inline const TKey& keyAt(size_t index) const { return mEntries[index].key; }
+    inline const TValue& valueAt(size_t index) const { return mEntries[index].value; }
+    inline TValue& editValueAt(size_t index) { return mEntries[index].value; }
+
+    /* Returns the index of the next entry after 'index', or -1 when there are
+     * no more.  Use -1 to get the first entry.  Iteration order is arbitrary.
+     */
+    ssize_t next(ssize_t index) const;
+
+    /* Associates 'value' with 'key', replacing the value of an existing entry
+     * for that key.  Returns the index of the entry, which stays valid until
+     * the hashtable is next modified.  May grow the hashtable; returns
+     * NO_MEMORY and leaves the hashtable unchanged if that fails.
+     */
+    inline ssize_t add(const TKey& key, const TValue& value) {
+        return add(hash_type(key), key, value);
+    }
+    ssize_t add(hash_t hash, const TKey& key, const TValue& value);
+
+    /* Removes the entry for the specified key.  Returns false if there was
+     * none.
+     */
+    bool remove(const TKey& key);
+
+    /* Removes the entry at the specified index, which must refer to an
+     * existing entry.  Entries that follow it may move back one slot.
+     */
+    void removeAt(size_t index);
+
+    /* Destroys all entries.  The storage is kept.
+     */
+    void clear();
+
+    /* Resizes the hashtable so it can hold at least the larger of
+     * minimumCapacity and size() entries before growing.  All indices change.
+     * Returns NO_MEMORY and leaves the hashtable unchanged if the new storage
+     * cannot be allocated.
+     */
+    status_t rehash(size_t minimumCapacity);
+
+private:
+    FlatHashtable(const FlatHashtable&);
+    FlatHashtable& operator=(const FlatHashtable&);
+
+    // The maximum fraction of slots in use before the table grows.
+    enum { MAX_LOAD_NUM = 7, MAX_LOAD_DEN = 8, MIN_SLOTS = 8 };
+
+    // mHashes[i] is 0 if slot i is empty, or the hash of its entry with the
+    // top bit set.  The home slot of an entry is (mHashes[i] & mMask).
+    static const uint32_t PRESENT = 0x80000000UL;
+
+    inline size_t distanceAt(size_t index) const {
+        return (index - (mHashes[index] & mMask)) & mMask;
+    }
+
+    size_t insertNew(uint32_t stored, const TKey& key, const TValue& value);
+
+    uint32_t* mHashes;
+    entry_type* mEntries;
+    size_t mMask;           // number of slots - 1, or 0 with no storage
+    size_t mSize;
+};
+
+// ---------------------------------------------------------------------------
+// No user serviceable parts from here...
+// ---------------------------------------------------------------------------
+
+template <typename TKey, typename TValue>
+FlatHashtable<TKey, TValue>::FlatHashtable(size_t minimumInitialCapacity) :
+        mHashes(NULL), mEntries(NULL), mMask(0), mSize(0) {
+    if (minimumInitialCapacity) {
+        rehash(minimumInitialCapacity);
+    }
+}
+
+template <typename TKey, typename TValue>
+FlatHashtable<TKey, TValue>::~FlatHashtable() {
+    clear();
+    free(mHashes);
+    free(mEntries);
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashtable<TKey, TValue>::find(hash_t hash, const TKey& key) const {
+    if (!mSize) {
+        return -1;
+    }
+    const uint32_t stored = uint32_t(hash) | PRESENT;
+    size_t index = stored & mMask;
+    for (size_t distance = 0; ; distance++) {
+        const uint32_t h = mHashes[index];
+        // Stop at an empty slot, or at an entry that is closer to its home
+        // than our key would be: Robin Hood would have put the key there.
+        if (!h || distanceAt(index) < distance) {
+            return -1;
+        }
+        if (h == stored && mEntries[index].key == key) {
+            return index;
+        }
+        index = (index + 1) & mMask;
+    }
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashtable<TKey, TValue>::next(ssize_t index) const {
+    if (mSize) {
+        for (size_t i = index + 1; i <= mMask; i++) {
+            if (mHashes[i]) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashtable<TKey, TValue>::add(hash_t hash, const TKey& key, const TValue& value) {
+    ssize_t index = find(hash, key);
+    if (index >= 0) {
+        mEntries[index].value = value;
+        return index;
+    }
+    if (!mHashes || (mSize + 1) * MAX_LOAD_DEN > (mMask + 1) * MAX_LOAD_NUM) {
+        status_t err = rehash((mSize + 1) * 2);
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+    return insertNew(uint32_t(hash) | PRESENT, key, value);
+}
+
+template <typename TKey, typename TValue>
+size_t FlatHashtable<TKey, TValue>::insertNew(uint32_t stored,
+        const TKey& key, const TValue& value) {
+    size_t index = stored & mMask;
+    size_t distance = 0;
+    for (;;) {
+        if (!mHashes[index]) {
+            new (&mEntries[index]) entry_type(key, value);
+            mHashes[index] = stored;
+            mSize++;
+            return index;
+        }
+        if (distanceAt(index) < distance) {
+            break;
+        }
+        index = (index + 1) & mMask;
+        distance++;
+    }
+
+    // The new entry takes this slot from an entry that is closer to its
+    // home, which in turn looks further for a slot, and so on.
+    const size_t result = index;
+    entry_type carry(key, value);
+    uint32_t carryHash = stored;
+    for (;;) {
+        if (!mHashes[index]) {
+            new (&mEntries[index]) entry_type(carry);
+            mHashes[index] = carryHash;
+            mSize++;
+            return result;
+        }
+        const size_t d = distanceAt(index);
+        if (d < distance) {
+            entry_type tmp(mEntries[index]);
+            mEntries[index] = carry;
+            carry = tmp;
+            uint32_t h = mHashes[index];
+            mHashes[index] = carryHash;
+            carryHash = h;
+            distance = d;
+        }
+        index = (index + 1) & mMask;
+        distance++;
+    }
+}
+
+template <typename TKey, typename TValue>
+bool FlatHashtable<TKey, TValue>::remove(const TKey& key) {
+    ssize_t index = find(key);
+    if (index < 0) {
+        return false;
+    }
+    removeAt(index);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+void FlatHashtable<TKey, TValue>::removeAt(size_t index) {
+    destroy_type(&mEntries[index], 1);
+    // Shift back the entries that follow until one is at its home slot.
+    size_t next = (index + 1) & mMask;
+    while (mHashes[next] && distanceAt(next)) {
+        move_backward_type(&mEntries[index], &mEntries[next], 1);
+        mHashes[index] = mHashes[next];
+        index = next;
+        next = (next + 1) & mMask;
+    }
+    mHashes[index] = 0;
+    mSize--;
+}
+
+template <typename TKey, typename TValue>
+void FlatHashtable<TKey, TValue>::clear() {
+    if (mSize) {
+        for (size_t i = 0; i <= mMask; i++) {
+            if (mHashes[i]) {
+                destroy_type(&mEntries[i], 1);
+                mHashes[i] = 0;
+            }
+        }
+        mSize = 0;
+    }
+}
+
+template <typename TKey, typename TValue>
+status_t FlatHashtable<TKey, TValue>::rehash(size_t minimumCapacity) {
+    if (minimumCapacity < mSize) {
+        minimumCapacity = mSize;
+    }
+    if (minimumCapacity > size_t(-1) / sizeof(entry_type) / MAX_LOAD_DEN) {
+        return NO_MEMORY;
+    }
+    size_t slots = MIN_SLOTS;
+    while (slots * MAX_LOAD_NUM < minimumCapacity * MAX_LOAD_DEN) {
+        slots <<= 1;
+    }
+    if (mHashes && slots == mMask + 1) {
+        return NO_ERROR;
+    }
+
+    uint32_t* hashes = static_cast<uint32_t*>(calloc(slots, sizeof(uint32_t)));
+    entry_type* entries = static_cast<entry_type*>(malloc(slots * sizeof(entry_type)));
+    if (!hashes || !entries) {
+        free(hashes);
+        free(entries);
+        return NO_MEMORY;
+    }
+
+    uint32_t* oldHashes = mHashes;
+    entry_type* oldEntries = mEntries;
+    size_t oldSlots = mHashes ? mMask + 1 : 0;
+
+    mHashes = hashes;
+    mEntries = entries;
+    mMask = slots - 1;
+    mSize = 0;
+    for (size_t i = 0; i < oldSlots; i++) {
+        if (oldHashes[i]) {
+            insertNew(oldHashes[i], oldEntries[i].key, oldEntries[i].value);
+            destroy_type(&oldEntries[i], 1);
+        }
+    }
+    free(oldHashes);
+    free(oldEntries);
+    return NO_ERROR;
+}
+
+}; // namespace android
+
+#endif // ANDROID_FLAT_HASHTABLE_H
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_FLAT_LRU_CACHE_H
+#define ANDROID_UTILS_FLAT_LRU_CACHE_H
+
+#include <utils/FlatHashtable.h>
+#include <utils/LruCache.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/**
+ * An LruCache with the same interface, built on FlatHashtable.
+ *
+ * The entries live in a dense array and are linked in LRU order by index
+ * rather than by pointer; the hashtable only maps keys to array indices.
+ * Removing an entry moves the last entry of the array into the hole, so
+ * the array never has gaps and iteration is a linear walk.
+ */
+template <typename TKey, typename TValue>
+class FlatLruCache {
+public:
+    explicit FlatLruCache(uint32_t maxCapacity);
+
+    enum Capacity {
+        kUnlimitedCapacity,
+    };
+
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    size_t size() const;
+    const TValue& get(const TKey& key);
+    bool put(const TKey& key, const TValue& value);
+    bool remove(const TKey& key);
+    bool removeOldest();
+    void clear();
+    const TValue& peekOldestValue();
+
+    class Iterator {
+    public:
+        Iterator(const FlatLruCache<TKey, TValue>& cache): mCache(cache), mIndex(-1) {
+        }
+
+        bool next() {
+            mIndex++;
+            return mIndex < mCache.mEntries.size();
+        }
+
+        size_t index() const {
+            return mIndex;
+        }
+
+        const TValue& value() const {
+            return mCache.mEntries[mIndex].value;
+        }
+
+        const TKey& key() const {
+            return mCache.mEntries[mIndex].key;
+        }
+    private:
+        const FlatLruCache<TKey, TValue>& mCache;
+        size_t mIndex;
+    };
+
+private:
+    FlatLruCache(const FlatLruCache& that);  // disallow copy constructor
+
+    enum { NONE = 0xffffffff };
+
+    struct Entry {
+        TKey key;
+        TValue value;
+        uint32_t parent;
+        uint32_t child;
+
+        Entry() : parent(NONE), child(NONE) {
+        }
+        Entry(const TKey& key_, const TValue& value_) :
+                key(key_), value(value_), parent(NONE), child(NONE) {
+        }
+    };
+
+    void attachToCache(uint32_t index);
+    void detachFromCache(uint32_t index);
+    void removeEntryAt(uint32_t index);
+
+    FlatHashtable<TKey, uint32_t> mTable;
+    Vector<Entry> mEntries;
+    OnEntryRemoved<TKey, TValue>* mListener;
+    uint32_t mOldest;
+    uint32_t mYoungest;
+    uint32_t mMaxCapacity;
+    TValue mNullValue;
+};
+
+// Implementation is here, because it's fully templated
+template <typename TKey, typename TValue>
+FlatLruCache<TKey, TValue>::FlatLruCache(uint32_t maxCapacity)
+    : mListener(NULL)
+    , mOldest(NONE)
+    , mYoungest(NONE)
+    , mMaxCapacity(maxCapacity)
+    , mNullValue(NULL) {
+    if (maxCapacity != kUnlimitedCapacity) {
+        mTable.rehash(maxCapacity);
+        mEntries.setCapacity(maxCapacity);
+    }
+};
+
+template<typename K, typename V>
+void FlatLruCache<K, V>::setOnEntryRemovedListener(OnEntryRemoved<K, V>* listener) {
+    mListener = listener;
+}
+
+template <typename TKey, typename TValue>
+size_t FlatLruCache<TKey, TValue>::size() const {
+    return mEntries.size();
+}
+
+template <typename TKey, typename TValue>
+const TValue& FlatLruCache<TKey, TValue>::get(const TKey& key) {
+    ssize_t index = mTable.find(key);
+    if (index < 0) {
+        return mNullValue;
+    }
+    uint32_t entry = mTable.valueAt(index);
+    if (entry != mYoungest) {
+        detachFromCache(entry);
+        attachToCache(entry);
+    }
+    return mEntries[entry].value;
+}
+
+template <typename TKey, typename TValue>
+bool FlatLruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
+    if (mMaxCapacity != kUnlimitedCapacity && size() >= mMaxCapacity) {
+        removeOldest();
+    }
+
+    hash_t hash = hash_type(key);
+    if (mTable.find(hash, key) >= 0) {
+        return false;
+    }
+
+    ssize_t entry = mEntries.add(Entry(key, value));
+    if (entry < 0) {
+        return false;
+    }
+    if (mTable.add(hash, key, entry) < 0) {
+        // The new entry is the last one, so removing it moves no others.
+        mEntries.removeAt(entry);
+        return false;
+    }
+    attachToCache(entry);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FlatLruCache<TKey, TValue>::remove(const TKey& key) {
+    ssize_t index = mTable.find(key);
+    if (index < 0) {
+        return false;
+    }
+    uint32_t entry = mTable.valueAt(index);
+    mTable.removeAt(index);
+    removeEntryAt(entry);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FlatLruCache<TKey, TValue>::removeOldest() {
+    if (mOldest != NONE) {
+        return remove(mEntries[mOldest].key);
+    }
+    return false;
+}
+
+template <typename TKey, typename TValue>
+const TValue& FlatLruCache<TKey, TValue>::peekOldestValue() {
+    if (mOldest != NONE) {
+        return mEntries[mOldest].value;
+    }
+    return mNullValue;
+}
+
+template <typename TKey, typename TValue>
+void FlatLruCache<TKey, TValue>::clear() {
+    if (mListener) {
+        for (uint32_t p = mOldest; p != NONE; p = mEntries[p].child) {
+            Entry& entry = mEntries.editItemAt(p);
+            (*mListener)(entry.key, entry.value);
+        }
+    }
+    mYoungest = NONE;
+    mOldest = NONE;
+    mTable.clear();
+    mEntries.clear();
+}
+
+template <typename TKey, typename TValue>
+void FlatLruCache<TKey, TValue>::removeEntryAt(uint32_t index) {
+    Entry& entry = mEntries.editItemAt(index);
+    if (mListener) {
+        (*mListener)(entry.key, entry.value);
+    }
+    detachFromCache(index);
+
+    // Fill the hole with the last entry, so the array stays dense.
+    uint32_t last = mEntries.size() - 1;
+    if (index != last) {
+        entry = mEntries[last];
+        if (entry.parent != NONE) {
+            mEntries.editItemAt(entry.parent).child = index;
+        } else {
+            mOldest = index;
+        }
+        if (entry.child != NONE) {
+            mEntries.editItemAt(entry.child).parent = index;
+        } else {
+            mYoungest = index;
+        }
+        mTable.editValueAt(mTable.find(entry.key)) = index;
+    }
+    mEntries.removeItemsAt(last);
+}
+
+template <typename TKey, typename TValue>
+void FlatLruCache<TKey, TValue>::attachToCache(uint32_t index) {
+    Entry& entry = mEntries.editItemAt(index);
+    if (mYoungest == NONE) {
+        mYoungest = mOldest = index;
+    } else {
+        entry.parent = mYoungest;
+        mEntries.editItemAt(mYoungest).child = index;
+        mYoungest = index;
+    }
+}
+
+template <typename TKey, typename TValue>
+void FlatLruCache<TKey, TValue>::detachFromCache(uint32_t index) {
+    Entry& entry = mEntries.editItemAt(index);
+    if (entry.parent != NONE) {
+        mEntries.editItemAt(entry.parent).child = entry.child;
+    } else {
+        mOldest = entry.child;
+    }
+    if (entry.child != NONE) {
+        mEntries.editItemAt(entry.child).parent = entry.parent;
+    } else {
+        mYoungest = entry.parent;
+    }
+
+    entry.parent = NONE;
+    entry.child = NONE;
+}
+
+}
+
+#endif // ANDROID_UTILS_FLAT_LRU_CACHE_H
@@ -83,6 +83,9 @@ public:
              */
              
             ssize_t         add(const KEY& key, const VALUE& item);
+            //! adds 'count' key/value pairs at once, much faster than calling
+            //! add() for each of them. later pairs replace earlier ones.
+            ssize_t         addArray(const KEY* keys, const VALUE* values, size_t count);
             ssize_t         replaceValueFor(const KEY& key, const VALUE& item);
             ssize_t         replaceValueAt(size_t index, const VALUE& item);
 
@@ -177,6 +180,19 @@ ssize_t KeyedVector<KEY,VALUE>::add(const KEY& key, const VALUE& value) {
     return mVector.add( key_value_pair_t<KEY,VALUE>(key, value) );
 }
 
+template<typename KEY, typename VALUE> inline
+ssize_t KeyedVector<KEY,VALUE>::addArray(const KEY* keys, const VALUE* values, size_t count) {
+    Vector< key_value_pair_t<KEY,VALUE> > pairs;
+    ssize_t err = pairs.setCapacity(count);
+    if (err < 0) {
+        return err;
+    }
+    for (size_t i=0 ; i<count ; i++) {
+        pairs.add( key_value_pair_t<KEY,VALUE>(keys[i], values[i]) );
+    }
+    return mVector.merge(pairs);
+}
+
 template<typename KEY, typename VALUE> inline
 ssize_t KeyedVector<KEY,VALUE>::replaceValueFor(const KEY& key, const VALUE& value) {
     key_value_pair_t<KEY,VALUE> pair(key, value);
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LATENCY_PROFILER_H
+#define ANDROID_LATENCY_PROFILER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+class Printer;
+
+/*
+ * Attributes time lost waiting for mutexes and in timed sections to the call
+ * stacks that lost it.
+ *
+ * While enabled, contended Mutex::lock() calls, LogIfSlow scopes and
+ * ScopedLatencyTimer scopes report their duration here. Every event that
+ * takes 1ms or more is recorded, together with one in every sampleInterval
+ * shorter events of each thread. Recording captures the call stack into a
+ * per-thread ring buffer without taking locks or allocating. print()
+ * aggregates the buffers of all threads by label and call stack.
+ * ProcessCallStack includes the report while the profiler is enabled.
+ *
+ * Disabled, the cost is a load and a branch per event.
+ */
+class LatencyProfiler {
+public:
+    enum { DEFAULT_SAMPLE_INTERVAL = 16, MAX_FRAMES = 8 };
+
+    // A call stack captured ahead of the event it belongs to.
+    struct Stack {
+        uint32_t depth;
+        uintptr_t pcs[MAX_FRAMES];
+    };
+
+    // Start or stop recording.
+    static void setEnabled(bool enabled,
+                           uint32_t sampleInterval = DEFAULT_SAMPLE_INTERVAL);
+    static inline bool isEnabled() { return sEnabled != 0; }
+
+    // Record that the caller spent 'duration' in the section named 'label'.
+    // The label is kept by pointer, so it must be a string literal or
+    // otherwise live as long as the process. The first ignoreDepth frames
+    // above the caller are left out of the recorded stack.
+    static void record(const char* label, nsecs_t duration, int32_t ignoreDepth = 0);
+
+    // For callers that mustn't unwind where the event ends, such as with a
+    // lock held: capture the stack beforehand, then record the event with
+    // it. The first ignoreDepth frames above the caller are left out.
+    static void captureStack(Stack* outStack, int32_t ignoreDepth = 0);
+    static void record(const char* label, nsecs_t duration, const Stack& stack);
+
+    // Print the maxEntries costliest label and call stack pairs.
+    static void print(Printer& printer, size_t maxEntries = 20);
+
+    // Forget everything recorded so far.
+    static void reset();
+
+private:
+    static volatile int32_t sEnabled;
+};
+
+/*
+ * Reports the time spent in its scope to the LatencyProfiler.
+ *
+ * {
+ *     ScopedLatencyTimer _timer("decodeFrame");
+ *     decodeFrame();
+ * }
+ */
+class ScopedLatencyTimer {
+public:
+    inline ScopedLatencyTimer(const char* label) :
+            mLabel(label), mStart(LatencyProfiler::isEnabled() ? systemTime() : 0) {
+    }
+    inline ~ScopedLatencyTimer() {
+        if (mStart) {
+            LatencyProfiler::record(mLabel, systemTime() - mStart);
+        }
+    }
+
+private:
+    const char* const mLabel;
+    const nsecs_t mStart;
+};
+
+}; // namespace android
+
+#endif // ANDROID_LATENCY_PROFILER_H
@@ -20,6 +20,7 @@
 #include <utils/threads.h>
 #include <utils/RefBase.h>
 #include <utils/KeyedVector.h>
+#include <utils/Vector.h>
 #include <utils/Timers.h>
 
 #include <sys/epoll.h>
@@ -208,6 +209,17 @@ public:
         EVENT_INVALID = 1 << 4,
     };
 
+    enum {
+        /**
+         * Registration option for addFd(), or'ed into the requested events:
+         * the file descriptor is monitored in edge-triggered mode.  The
+         * callback is then only invoked when new data arrives, so it must
+         * drain the file descriptor until it would block.  Useful for
+         * high-throughput sockets.  Never reported back in poll events.
+         */
+        EVENT_OPTION_EDGE_TRIGGERED = 1 << 30,
+    };
+
     enum {
         /**
          * Option for Looper_prepare: this looper will accept calls to
@@ -291,6 +303,7 @@ public:
      * "ident" is an identifier for this event, which is returned from pollOnce().
      * The identifier must be >= 0, or POLL_CALLBACK if providing a non-NULL callback.
      * "events" are the poll events to wake up on.  Typically this is EVENT_INPUT.
+     * EVENT_OPTION_EDGE_TRIGGERED may be added to request edge-triggered monitoring.
      * "callback" is the function to call when there is an event on the file descriptor.
      * "data" is a private data pointer to supply to the callback.
      *
@@ -418,7 +431,9 @@ public:
 
 private:
     struct Request {
-        int fd;
+        Request() : fd(-1), ident(0), events(0), seq(-1), data(NULL) { }
+
+        int fd; // -1 for an unused slot of mRequests
         int ident;
         int events;
         int seq;
@@ -460,8 +475,10 @@ private:
     int mEpollFd; // guarded by mLock but only modified on the looper thread
     bool mEpollRebuildRequired; // guarded by mLock
 
-    // Locked list of file descriptor monitoring requests.
-    KeyedVector<int, Request> mRequests;  // guarded by mLock
+    // Locked table of file descriptor monitoring requests, indexed directly by
+    // file descriptor so that dispatching a ready fd is O(1).  File descriptors
+    // are small dense integers so the table stays compact.
+    Vector<Request> mRequests;  // guarded by mLock
     int mNextRequestSeq;
 
     // This state is only used privately by pollOnce and does not require a lock since
@@ -474,6 +491,7 @@ private:
     int removeFd(int fd, int seq);
     void awoken();
     void pushResponse(int events, const Request& request);
+    const Request* findRequestLocked(int fd) const;
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
 
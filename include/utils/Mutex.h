@@ -26,6 +26,7 @@
 #endif
 
 #include <utils/Errors.h>
+#include <utils/LatencyProfiler.h>
 #include <utils/Timers.h>
 
 // ---------------------------------------------------------------------------
@@ -33,6 +34,7 @@ namespace android {
 // ---------------------------------------------------------------------------
 
 class Condition;
+struct MutexProfile;
 
 /*
  * Simple mutex class.  The implementation is system-dependent.
@@ -47,6 +49,20 @@ public:
         SHARED = 1
     };
 
+    // Flags that may be or'ed into the type.
+    enum {
+        // When contended, spin briefly before sleeping. The spin length
+        // adapts to how long the lock has recently taken to come free.
+        // Meant for locks that are only ever held for a short time.
+        ADAPTIVE = 0x2,
+        // Record how often and how long lockers wait, and which call sites
+        // held the lock meanwhile. See dumpContention(). Contended waits of
+        // every mutex also go to the LatencyProfiler while it is enabled.
+        // Ignored for SHARED mutexes, whose other users couldn't follow a
+        // pointer to this process's record.
+        PROFILE = 0x4
+    };
+
                 Mutex();
                 Mutex(const char* name);
                 Mutex(int type, const char* name = NULL);
@@ -59,6 +75,10 @@ public:
     // lock if possible; returns 0 on success, error otherwise
     status_t    tryLock();
 
+    // Writes the contention records of all live PROFILE mutexes to fd.
+    // The numbers are approximate while the mutexes are in use.
+    static void dumpContention(int fd);
+
 #if HAVE_ANDROID_OS
     // lock the mutex, but don't wait longer than timeoutMilliseconds.
     // Returns 0 on success, TIMED_OUT for failure due to timeout expiration.
@@ -88,7 +108,14 @@ private:
     Mutex&      operator = (const Mutex&);
 
 #if !defined(_WIN32)
+    status_t    lockSlow();
+    void        initFlags(int type, const char* name);
+    void        destroyProfile();
+
     pthread_mutex_t mMutex;
+    uint16_t        mFlags;
+    uint16_t        mSpinCount;     // recent spins before acquiring, in 1/8ths
+    MutexProfile*   mProfile;
 #else
     void    _init();
     void*   mState;
@@ -99,14 +126,22 @@ private:
 
 #if !defined(_WIN32)
 
-inline Mutex::Mutex() {
+inline Mutex::Mutex() : mFlags(0), mSpinCount(0), mProfile(NULL) {
     pthread_mutex_init(&mMutex, NULL);
 }
-inline Mutex::Mutex(__attribute__((unused)) const char* name) {
+inline Mutex::Mutex(__attribute__((unused)) const char* name)
+        : mFlags(0), mSpinCount(0), mProfile(NULL) {
     pthread_mutex_init(&mMutex, NULL);
 }
-inline Mutex::Mutex(int type, __attribute__((unused)) const char* name) {
-    if (type == SHARED) {
+inline Mutex::Mutex(int type, const char* name)
+        : mFlags(0), mSpinCount(0), mProfile(NULL) {
+    if (type & SHARED) {
+        type &= ~PROFILE;
+    }
+    if (type & (ADAPTIVE | PROFILE)) {
+        initFlags(type, name);
+    }
+    if (type & SHARED) {
         pthread_mutexattr_t attr;
         pthread_mutexattr_init(&attr);
         pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
@@ -117,9 +152,15 @@ inline Mutex::Mutex(int type, __attribute__((unused)) const char* name) {
     }
 }
 inline Mutex::~Mutex() {
+    if (mProfile) {
+        destroyProfile();
+    }
     pthread_mutex_destroy(&mMutex);
 }
 inline status_t Mutex::lock() {
+    if (mFlags || LatencyProfiler::isEnabled()) {
+        return lockSlow();
+    }
     return -pthread_mutex_lock(&mMutex);
 }
 inline void Mutex::unlock() {
@@ -84,6 +84,8 @@ private:
     class Parser {
         PropertyMap* mMap;
         Tokenizer* mTokenizer;
+        const Tokenizer::DelimiterSet mWhitespace;
+        const Tokenizer::DelimiterSet mWhitespaceOrPropertyDelimiter;
 
     public:
         Parser(PropertyMap* map, Tokenizer* tokenizer);
@@ -117,6 +117,72 @@ inline void RWLock::unlock() {
     pthread_rwlock_unlock(&mRWLock);
 }
 
+/*
+ * A reader-writer lock for data that is read far more often than written.
+ *
+ * Readers only touch one of several cache-line sized counters, picked by
+ * thread, so concurrent readers on different CPUs don't bounce a shared
+ * lock word between them. Writers pay for that: they have to look at every
+ * counter and wait for all readers to leave. While a writer holds or waits
+ * for the lock, new readers wait for it to finish.
+ *
+ * Same interface as RWLock. Neither kind of lock may be taken recursively,
+ * and it can't be shared between processes.
+ */
+class ShardedRWLock {
+public:
+                ShardedRWLock();
+                ShardedRWLock(const char* name);
+                ~ShardedRWLock();
+
+    status_t    readLock();
+    status_t    tryReadLock();
+    status_t    writeLock();
+    status_t    tryWriteLock();
+    void        unlock();
+
+    class AutoRLock {
+    public:
+        inline AutoRLock(ShardedRWLock& rwlock) : mLock(rwlock)  { mLock.readLock(); }
+        inline ~AutoRLock() { mLock.unlock(); }
+    private:
+        ShardedRWLock& mLock;
+    };
+
+    class AutoWLock {
+    public:
+        inline AutoWLock(ShardedRWLock& rwlock) : mLock(rwlock)  { mLock.writeLock(); }
+        inline ~AutoWLock() { mLock.unlock(); }
+    private:
+        ShardedRWLock& mLock;
+    };
+
+private:
+    // A ShardedRWLock cannot be copied
+                ShardedRWLock(const ShardedRWLock&);
+    ShardedRWLock& operator = (const ShardedRWLock&);
+
+    enum { NUM_SHARDS = 8, CACHE_LINE_SIZE = 64 };
+
+    struct Shard {
+        volatile int32_t readers;
+        char padding[CACHE_LINE_SIZE - sizeof(int32_t)];
+    };
+
+    static size_t shardForThread();
+    bool        hasReaders() const;
+    void        leaveShard(Shard& shard);
+
+    Shard           mShards[NUM_SHARDS];
+    volatile int32_t mWriterPending;
+    pthread_t       mWriter;            // valid while mWriterOwned
+    volatile int32_t mWriterOwned;
+    pthread_mutex_t mWriterLock;        // held by the writer
+    // A pending writer sleeps on mReadersGone until the readers have left.
+    pthread_mutex_t mReadersGoneLock;
+    pthread_cond_t  mReadersGone;
+};
+
 #endif // !defined(_WIN32)
 
 // ---------------------------------------------------------------------------
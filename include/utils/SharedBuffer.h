@@ -87,17 +87,38 @@ public:
     //! returns wether or not we're the only owner
     inline          bool                    onlyOwner() const;
     
+    /*! Small buffers are allocated from per-thread caches of blocks in a
+     * few size classes, and editResize() keeps a buffer in place while its
+     * new size fits the same class. These statistics cover the whole
+     * process. They are approximate while other threads allocate.
+     */
+    struct Stats {
+        size_t numSmallAllocs;      // buffers allocated from a size class
+        size_t numCacheHits;        // ...of which reused a cached block
+        size_t numLargeAllocs;      // buffers too large for a size class
+        size_t numInPlaceResizes;   // editResize() calls that kept the block
+        size_t numCachedBlocks;     // free blocks held in caches
+        size_t cachedBytes;
+    };
+
+    static          void                    getStats(Stats* stats);
+
+    //! dump the allocation statistics to a file descriptor
+    static          void                    dumpStats(int fd, int indent = 0);
 
 private:
         inline SharedBuffer() { }
         inline ~SharedBuffer() { }
         SharedBuffer(const SharedBuffer&);
         SharedBuffer& operator = (const SharedBuffer&);
+
+        static void freeStorage(const SharedBuffer* buf);
  
         // 16 bytes. must be sized to preserve correct alignment.
         mutable int32_t        mRefs;
                 size_t         mSize;
-                uint32_t       mReserved[2];
+                uint32_t       mClass;      // size class + 1, or 0 if malloc'ed
+                uint32_t       mReserved;
 };
 
 // ---------------------------------------------------------------------------
@@ -111,6 +111,10 @@ public:
                 return *( static_cast<TYPE *>(VectorImpl::editItemLocation(index)) );
             }
 
+            //! adds many items at once (and replaces the ones that are there),
+            //! much faster than calling add() for each of them
+            ssize_t         addArray(const TYPE* array, size_t length);
+
             //! merges a vector into this one
             ssize_t         merge(const Vector<TYPE>& vector);
             ssize_t         merge(const SortedVector<TYPE>& vector);
@@ -146,7 +150,8 @@ SortedVector<TYPE>::SortedVector()
     : SortedVectorImpl(sizeof(TYPE),
                 ((traits<TYPE>::has_trivial_ctor   ? HAS_TRIVIAL_CTOR   : 0)
                 |(traits<TYPE>::has_trivial_dtor   ? HAS_TRIVIAL_DTOR   : 0)
-                |(traits<TYPE>::has_trivial_copy   ? HAS_TRIVIAL_COPY   : 0))
+                |(traits<TYPE>::has_trivial_copy   ? HAS_TRIVIAL_COPY   : 0)
+                |(traits<TYPE>::has_trivial_move   ? HAS_TRIVIAL_MOVE   : 0))
                 )
 {
 }
@@ -207,6 +212,11 @@ ssize_t SortedVector<TYPE>::add(const TYPE& item) {
     return SortedVectorImpl::add(&item);
 }
 
+template<class TYPE> inline
+ssize_t SortedVector<TYPE>::addArray(const TYPE* array, size_t length) {
+    return SortedVectorImpl::addArray(array, length);
+}
+
 template<class TYPE> inline
 ssize_t SortedVector<TYPE>::indexOf(const TYPE& item) const {
     return SortedVectorImpl::indexOf(&item);
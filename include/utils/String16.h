@@ -100,6 +100,18 @@ public:
 
             status_t            remove(size_t len, size_t begin=0);
 
+            // Returns a string with the same contents whose storage is
+            // shared with every other interned copy of them, so interned
+            // strings compare equal by pointer. The interned storage lives
+            // as long as the process. Meant for small, long-lived sets of
+            // strings such as binder interface descriptors.
+            String16            intern() const;
+
+            // Returns the interned copy of this string if there is one, and
+            // this string otherwise. Never adds to the intern table, so it
+            // is safe for strings that come from other processes.
+            String16            findInterned() const;
+
     inline  int                 compare(const String16& other) const;
 
     inline  bool                operator<(const String16& other) const;
@@ -190,6 +202,9 @@ inline bool String16::operator<=(const String16& other) const
 
 inline bool String16::operator==(const String16& other) const
 {
+    if (mString == other.mString) {
+        return true;
+    }
     return strzcmp16(mString, size(), other.mString, other.size()) == 0;
 }
 
@@ -18,6 +18,8 @@
 #define _UTILS_TOKENIZER_H
 
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 #include <utils/Errors.h>
 #include <utils/FileMap.h>
 #include <utils/String8.h>
@@ -32,6 +34,36 @@ class Tokenizer {
             bool ownBuffer, size_t length);
 
 public:
+    /**
+     * A run of characters in the tokenizer's buffer.
+     * Not null terminated.  Valid only as long as the tokenizer.
+     */
+    struct Token {
+        const char* data;
+        size_t length;
+
+        inline bool isEmpty() const { return length == 0; }
+        inline bool contains(char ch) const { return memchr(data, ch, length) != NULL; }
+    };
+
+    /**
+     * A set of delimiter characters, for callers that scan with the same
+     * delimiters over and over.  The null character is always a member, so
+     * that embedded nulls end tokens as they do with a delimiter string.
+     */
+    class DelimiterSet {
+    public:
+        explicit DelimiterSet(const char* delimiters);
+
+        inline bool contains(char ch) const {
+            uint8_t index = uint8_t(ch);
+            return (mBits[index >> 5] >> (index & 31)) & 1;
+        }
+
+    private:
+        uint32_t mBits[8];
+    };
+
     ~Tokenizer();
 
     /**
@@ -88,6 +120,11 @@ public:
      */
     String8 peekRemainderOfLine() const;
 
+    /**
+     * Like peekRemainderOfLine() but points into the buffer instead of copying.
+     */
+    Token peekRemainderOfLineToken() const;
+
     /**
      * Gets the character at the current position and advances past it.
      * Returns null at end of file.
@@ -103,6 +140,11 @@ public:
      */
     String8 nextToken(const char* delimiters);
 
+    /**
+     * Like nextToken(const char*) but points into the buffer instead of copying.
+     */
+    Token nextToken(const DelimiterSet& delimiters);
+
     /**
      * Advances to the next line.
      * Does nothing if already at the end of the file.
@@ -114,6 +156,7 @@ public:
      * Also skips embedded nulls.
      */
     void skipDelimiters(const char* delimiters);
+    void skipDelimiters(const DelimiterSet& delimiters);
 
 private:
     Tokenizer(const Tokenizer& other); // not copyable
@@ -151,6 +151,15 @@ void utf8_to_utf32(const char* src, size_t src_len, char32_t* dst);
  */
 ssize_t utf8_to_utf16_length(const uint8_t* src, size_t srcLen);
 
+/**
+ * Returns the UTF-16 length of UTF-8 string "src", or -1 if "src" is not
+ * well-formed UTF-8: a stray continuation byte, a sequence cut short, an
+ * overlong encoding, an encoded surrogate, or a code point above U+10FFFF.
+ * utf8_to_utf16_length accepts all of these, and decodes them as best it can.
+ * Never reads past "srcLen" bytes.
+ */
+ssize_t utf8_to_utf16_length_validated(const uint8_t* src, size_t srcLen);
+
 /**
  * Convert UTF-8 to UTF-16 including surrogate pairs.
  * Returns a pointer to the end of the string (where a null terminator might go
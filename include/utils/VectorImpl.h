@@ -44,6 +44,7 @@ public:
         HAS_TRIVIAL_CTOR    = 0x00000001,
         HAS_TRIVIAL_DTOR    = 0x00000002,
         HAS_TRIVIAL_COPY    = 0x00000004,
+        HAS_TRIVIAL_MOVE    = 0x00000008,
     };
 
                             VectorImpl(size_t itemSize, uint32_t flags);
@@ -98,6 +99,7 @@ public:
 protected:
             size_t          itemSize() const;
             void            release_storage();
+            void            release_moved_storage();
 
     virtual void            do_construct(void* storage, size_t num) const = 0;
     virtual void            do_destroy(void* storage, size_t num) const = 0;
@@ -109,6 +111,7 @@ protected:
 private:
         void* _grow(size_t where, size_t amount);
         void  _shrink(size_t where, size_t amount);
+        bool  _can_relocate() const;
 
         inline void _do_construct(void* storage, size_t num) const;
         inline void _do_destroy(void* storage, size_t num) const;
@@ -146,6 +149,10 @@ public:
     //! add an item in the right place (or replaces it if there is one)
             ssize_t         add(const void* item);
 
+    //! adds many items at once (or replaces the ones already there), in
+    //! O(n log n) rather than one O(n) insertion per item
+            ssize_t         addArray(const void* array, size_t length);
+
     //! merges a vector into this one
             ssize_t         merge(const VectorImpl& vector);
             ssize_t         merge(const SortedVectorImpl& vector);
@@ -158,6 +165,7 @@ protected:
 
 private:
             ssize_t         _indexOrderOf(const void* item, size_t* order = 0) const;
+    static  int             compareProxy(const void* lhs, const void* rhs, void* self);
 
             // these are made private, because they can't be used on a SortedVector
             // (they don't have an implementation either)
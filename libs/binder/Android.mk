@@ -16,6 +16,7 @@
 sources := \
 	AppOpsManager.cpp \
 	Binder.cpp \
+	BinderTrace.cpp \
 	BpBinder.cpp \
 	BufferedTextOutput.cpp \
 	CursorWindow.cpp \
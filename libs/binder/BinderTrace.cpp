@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BinderTrace"
+
+#include <binder/BinderTrace.h>
+#include <binder/TextOutput.h>
+
+#include <cutils/atomic.h>
+#include <utils/Debug.h>
+#include <utils/Log.h>
+#include <utils/Timers.h>
+
+#include <private/binder/binder_module.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+#define gettid() syscall(__NR_gettid)
+
+// ---------------------------------------------------------------------------
+
+namespace android {
+
+static const char *kReturnStrings[] = {
+    "BR_ERROR",
+    "BR_OK",
+    "BR_TRANSACTION",
+    "BR_REPLY",
+    "BR_ACQUIRE_RESULT",
+    "BR_DEAD_REPLY",
+    "BR_TRANSACTION_COMPLETE",
+    "BR_INCREFS",
+    "BR_ACQUIRE",
+    "BR_RELEASE",
+    "BR_DECREFS",
+    "BR_ATTEMPT_ACQUIRE",
+    "BR_NOOP",
+    "BR_SPAWN_LOOPER",
+    "BR_FINISHED",
+    "BR_DEAD_BINDER",
+    "BR_CLEAR_DEATH_NOTIFICATION_DONE",
+    "BR_FAILED_REPLY"
+};
+
+static const char *kCommandStrings[] = {
+    "BC_TRANSACTION",
+    "BC_REPLY",
+    "BC_ACQUIRE_RESULT",
+    "BC_FREE_BUFFER",
+    "BC_INCREFS",
+    "BC_ACQUIRE",
+    "BC_RELEASE",
+    "BC_DECREFS",
+    "BC_INCREFS_DONE",
+    "BC_ACQUIRE_DONE",
+    "BC_ATTEMPT_ACQUIRE",
+    "BC_REGISTER_LOOPER",
+    "BC_ENTER_LOOPER",
+    "BC_EXIT_LOOPER",
+    "BC_REQUEST_DEATH_NOTIFICATION",
+    "BC_CLEAR_DEATH_NOTIFICATION",
+    "BC_DEAD_BINDER_DONE"
+};
+
+
+static const void* printBinderTransactionData(TextOutput& out, const void* data)
+{
+    const binder_transaction_data* btd =
+        (const binder_transaction_data*)data;
+    if (btd->target.handle < 1024) {
+        /* want to print descriptors in decimal; guess based on value */
+        out << "target.desc=" << btd->target.handle;
+    } else {
+        out << "target.ptr=" << btd->target.ptr;
+    }
+    out << " (cookie " << btd->cookie << ")" << endl
+        << "code=" << TypeCode(btd->code) << ", flags=" << (void*)(long)btd->flags << endl
+        << "data=" << btd->data.ptr.buffer << " (" << (void*)btd->data_size
+        << " bytes)" << endl
+        << "offsets=" << btd->data.ptr.offsets << " (" << (void*)btd->offsets_size
+        << " bytes)";
+    return btd+1;
+}
+
+const void* BinderTrace::printReturnCommand(TextOutput& out, const void* _cmd)
+{
+    static const size_t N = sizeof(kReturnStrings)/sizeof(kReturnStrings[0]);
+    const int32_t* cmd = (const int32_t*)_cmd;
+    uint32_t code = (uint32_t)*cmd++;
+    size_t cmdIndex = code & 0xff;
+    if (code == BR_ERROR) {
+        out << "BR_ERROR: " << (void*)(long)(*cmd++) << endl;
+        return cmd;
+    } else if (cmdIndex >= N) {
+        out << "Unknown reply: " << code << endl;
+        return cmd;
+    }
+    out << kReturnStrings[cmdIndex];
+    
+    switch (code) {
+        case BR_TRANSACTION:
+        case BR_REPLY: {
+            out << ": " << indent;
+            cmd = (const int32_t *)printBinderTransactionData(out, cmd);
+            out << dedent;
+        } break;
+        
+        case BR_ACQUIRE_RESULT: {
+            const int32_t res = *cmd++;
+            out << ": " << res << (res ? " (SUCCESS)" : " (FAILURE)");
+        } break;
+        
+        case BR_INCREFS:
+        case BR_ACQUIRE:
+        case BR_RELEASE:
+        case BR_DECREFS: {
+            const int32_t b = *cmd++;
+            const int32_t c = *cmd++;
+            out << ": target=" << (void*)(long)b << " (cookie " << (void*)(long)c << ")";
+        } break;
+    
+        case BR_ATTEMPT_ACQUIRE: {
+            const int32_t p = *cmd++;
+            const int32_t b = *cmd++;
+            const int32_t c = *cmd++;
+            out << ": target=" << (void*)(long)b << " (cookie " << (void*)(long)c
+                << "), pri=" << p;
+        } break;
+
+        case BR_DEAD_BINDER:
+        case BR_CLEAR_DEATH_NOTIFICATION_DONE: {
+            const int32_t c = *cmd++;
+            out << ": death cookie " << (void*)(long)c;
+        } break;
+
+        default:
+            // no details to show for: BR_OK, BR_DEAD_REPLY,
+            // BR_TRANSACTION_COMPLETE, BR_FINISHED
+            break;
+    }
+    
+    out << endl;
+    return cmd;
+}
+
+const void* BinderTrace::printCommand(TextOutput& out, const void* _cmd)
+{
+    static const size_t N = sizeof(kCommandStrings)/sizeof(kCommandStrings[0]);
+    const int32_t* cmd = (const int32_t*)_cmd;
+    uint32_t code = (uint32_t)*cmd++;
+    size_t cmdIndex = code & 0xff;
+
+    if (cmdIndex >= N) {
+        out << "Unknown command: " << code << endl;
+        return cmd;
+    }
+    out << kCommandStrings[cmdIndex];
+
+    switch (code) {
+        case BC_TRANSACTION:
+        case BC_REPLY: {
+            out << ": " << indent;
+            cmd = (const int32_t *)printBinderTransactionData(out, cmd);
+            out << dedent;
+        } break;
+        
+        case BC_ACQUIRE_RESULT: {
+            const int32_t res = *cmd++;
+            out << ": " << res << (res ? " (SUCCESS)" : " (FAILURE)");
+        } break;
+        
+        case BC_FREE_BUFFER: {
+            const int32_t buf = *cmd++;
+            out << ": buffer=" << (void*)(long)buf;
+        } break;
+        
+        case BC_INCREFS:
+        case BC_ACQUIRE:
+        case BC_RELEASE:
+        case BC_DECREFS: {
+            const int32_t d = *cmd++;
+            out << ": desc=" << d;
+        } break;
+    
+        case BC_INCREFS_DONE:
+        case BC_ACQUIRE_DONE: {
+            const int32_t b = *cmd++;
+            const int32_t c = *cmd++;
+            out << ": target=" << (void*)(long)b << " (cookie " << (void*)(long)c << ")";
+        } break;
+        
+        case BC_ATTEMPT_ACQUIRE: {
+            const int32_t p = *cmd++;
+            const int32_t d = *cmd++;
+            out << ": desc=" << d << ", pri=" << p;
+        } break;
+        
+        case BC_REQUEST_DEATH_NOTIFICATION:
+        case BC_CLEAR_DEATH_NOTIFICATION: {
+            const int32_t h = *cmd++;
+            const int32_t c = *cmd++;
+            out << ": handle=" << h << " (death cookie " << (void*)(long)c << ")";
+        } break;
+
+        case BC_DEAD_BINDER_DONE: {
+            const int32_t c = *cmd++;
+            out << ": death cookie " << (void*)(long)c;
+        } break;
+
+        default:
+            // no details to show for: BC_REGISTER_LOOPER, BC_ENTER_LOOPER,
+            // BC_EXIT_LOOPER
+            break;
+    }
+    
+    out << endl;
+    return cmd;
+}
+
+const char* BinderTrace::returnString(uint32_t cmd)
+{
+    const size_t idx = cmd & 0xff;
+    if (idx < sizeof(kReturnStrings) / sizeof(kReturnStrings[0]))
+        return kReturnStrings[idx];
+    else
+        return "unknown";
+}
+
+void BinderTrace::printRecord(TextOutput& out, const Record& record)
+{
+    // Rebuild the command as it was passed to or from the driver, with its
+    // arguments aligned as the structures they hold require.
+    uint64_t buffer[1 + ARGS_SIZE/sizeof(uint64_t)];
+    memset(buffer, 0, sizeof(buffer));
+    uint32_t* cmd = reinterpret_cast<uint32_t*>(buffer) + 1;
+    cmd[0] = record.cmd;
+    memcpy(cmd + 1, record.args,
+            record.argsSize < size_t(ARGS_SIZE) ? record.argsSize : size_t(ARGS_SIZE));
+    if (record.kind == KIND_RETURN) {
+        printReturnCommand(out, cmd);
+    } else {
+        printCommand(out, cmd);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+volatile int32_t BinderTrace::sEnabled = 0;
+
+static volatile int32_t gStarted = 0;
+static BinderTrace::FileHeader* gHeader = NULL;
+static pthread_key_t gRingKey;
+
+typedef BinderTrace::RingHeader Ring;
+
+// Stored for threads that found no free ring.
+static Ring* const kNoRing = reinterpret_cast<Ring*>(1);
+
+static inline BinderTrace::Record* recordsOf(Ring* ring)
+{
+    return reinterpret_cast<BinderTrace::Record*>(ring + 1);
+}
+
+static size_t ringSize(uint32_t recordsPerRing)
+{
+    return sizeof(BinderTrace::RingHeader) + recordsPerRing * sizeof(BinderTrace::Record);
+}
+
+status_t BinderTrace::start(const char* path, uint32_t numThreads,
+        uint32_t recordsPerThread)
+{
+    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(sizeof(FileHeader) == 64);
+    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(sizeof(RingHeader) == 64);
+    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(sizeof(Record) == RECORD_SIZE);
+
+    if (numThreads == 0 || recordsPerThread == 0
+            || recordsPerThread > (SIZE_MAX / 2 / numThreads - sizeof(RingHeader))
+                    / sizeof(Record)) {
+        return BAD_VALUE;
+    }
+    if (android_atomic_cmpxchg(0, 1, &gStarted)) {
+        return INVALID_OPERATION;
+    }
+
+    const size_t size = sizeof(FileHeader) + numThreads * ringSize(recordsPerThread);
+    status_t err = NO_ERROR;
+    // The trace holds the start of every transaction, so only the owner may
+    // read it.  Replace whatever is at the path rather than writing through
+    // it, in case it is a link planted by someone else.
+    if (unlink(path) < 0 && errno != ENOENT) {
+        const status_t err = -errno;
+        LOGE("Can't remove old binder trace %s: %s", path, strerror(errno));
+        android_atomic_release_store(0, &gStarted);
+        return err;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    void* base = MAP_FAILED;
+    if (fd < 0 || ftruncate(fd, size) < 0
+            || (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+                    == MAP_FAILED) {
+        err = -errno;
+        LOGE("Can't create binder trace %s: %s", path, strerror(errno));
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (err != NO_ERROR || pthread_key_create(&gRingKey, NULL) != 0) {
+        if (base != MAP_FAILED) {
+            munmap(base, size);
+        }
+        android_atomic_release_store(0, &gStarted);
+        return err != NO_ERROR ? err : NO_MEMORY;
+    }
+
+    // The file is zero filled, so only the header needs to be set up.
+    FileHeader* header = static_cast<FileHeader*>(base);
+    header->magic = MAGIC;
+    header->version = VERSION;
+    header->pointerSize = sizeof(void*);
+    header->recordSize = sizeof(Record);
+    header->recordsPerRing = recordsPerThread;
+    header->numRings = numThreads;
+    header->pid = getpid();
+    header->startTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    gHeader = header;
+    android_atomic_release_store(1, &sEnabled);
+    return NO_ERROR;
+}
+
+void BinderTrace::stop()
+{
+    android_atomic_release_store(0, &sEnabled);
+}
+
+static Ring* getRing()
+{
+    Ring* ring = static_cast<Ring*>(pthread_getspecific(gRingKey));
+    if (ring == NULL) {
+        const uint32_t index = uint32_t(android_atomic_inc(&gHeader->ringsUsed));
+        if (index < gHeader->numRings) {
+            ring = reinterpret_cast<Ring*>(reinterpret_cast<uint8_t*>(gHeader + 1)
+                    + index * ringSize(gHeader->recordsPerRing));
+            ring->tid = gettid();
+        } else {
+            android_atomic_inc(&gHeader->threadsDropped);
+            ring = kNoRing;
+        }
+        pthread_setspecific(gRingKey, ring);
+    }
+    return ring != kNoRing ? ring : NULL;
+}
+
+void BinderTrace::recordCommands(const void* data, size_t size)
+{
+    record(KIND_COMMAND, data, size);
+}
+
+void BinderTrace::recordReturns(const void* data, size_t size)
+{
+    record(KIND_RETURN, data, size);
+}
+
+void BinderTrace::record(uint16_t kind, const void* data, size_t size)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    Ring* ring = getRing();
+    if (ring == NULL) {
+        return;
+    }
+
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    const uint32_t recordsPerRing = gHeader->recordsPerRing;
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = p + size;
+    while (size_t(end - p) >= sizeof(uint32_t)) {
+        uint32_t cmd;
+        memcpy(&cmd, p, sizeof(cmd));
+        p += sizeof(cmd);
+        size_t argsSize = _IOC_SIZE(cmd);
+        if (argsSize > size_t(end - p)) {
+            argsSize = end - p;
+        }
+
+        const int32_t seq = ring->next;
+        Record& r = recordsOf(ring)[uint32_t(seq) % recordsPerRing];
+        android_atomic_release_store(0, &r.seq);
+        r.tid = ring->tid;
+        r.when = now;
+        r.cmd = cmd;
+        r.kind = kind;
+        r.argsSize = uint16_t(argsSize < size_t(ARGS_SIZE) ? argsSize : size_t(ARGS_SIZE));
+        memcpy(r.args, p, r.argsSize);
+        r.handle = r.code = r.dataSize = r.offsetsSize = r.payloadSize = 0;
+
+        const bool transaction = kind == KIND_COMMAND
+                ? (cmd == BC_TRANSACTION || cmd == BC_REPLY)
+                : (cmd == BR_TRANSACTION || cmd == BR_REPLY);
+        if (transaction && argsSize >= sizeof(binder_transaction_data)) {
+            binder_transaction_data tr;
+            memcpy(&tr, p, sizeof(tr));
+            r.handle = tr.target.handle;
+            r.code = tr.code;
+            r.dataSize = tr.data_size;
+            r.offsetsSize = tr.offsets_size;
+            r.payloadSize = uint32_t(tr.data_size < size_t(PAYLOAD_SIZE)
+                    ? tr.data_size : size_t(PAYLOAD_SIZE));
+            const void* buffer = (const void*)(uintptr_t)tr.data.ptr.buffer;
+            if (buffer != NULL) {
+                memcpy(r.payload, buffer, r.payloadSize);
+            } else {
+                r.payloadSize = 0;
+            }
+        }
+
+        android_atomic_release_store(seq + 1, &r.seq);
+        android_atomic_release_store(seq + 1, &ring->next);
+        p += argsSize;
+    }
+}
+
+}; // namespace android
@@ -111,7 +111,11 @@ const String16& BpBinder::getInterfaceDescriptor() const
         status_t err = const_cast<BpBinder*>(this)->transact(
                 INTERFACE_TRANSACTION, send, &reply);
         if (err == NO_ERROR) {
-            String16 res(reply.readString16());
+            // Shares the interned copy when this process implements the
+            // interface, so it compares equal to the local descriptor by
+            // pointer. Never interned here: the remote side chooses the
+            // string, and the intern table is never trimmed.
+            String16 res(reply.readString16().findInterned());
             Mutex::Autolock _l(mLock);
             // mDescriptorCache could have been assigned while the lock was
             // released.
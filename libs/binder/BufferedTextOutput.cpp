@@ -24,13 +24,95 @@
 
 #include <private/utils/Static.h>
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // ---------------------------------------------------------------------------
 
 namespace android {
 
+// Size of each thread's ring in ASYNC mode, and the most memory the rings
+// of one BufferedTextOutput may take. Threads beyond the budget print
+// synchronously.
+static const uint32_t kAsyncRingSize = 16 * 1024;
+static const size_t kAsyncMemoryBudget = 1024 * 1024;
+
+// A single-producer, single-consumer ring of records, each a 32-bit length
+// followed by that many bytes of complete lines, padded to 4 bytes. A
+// record that doesn't fit before the end of the ring is preceded by a
+// kRingWrap marker and starts over at the beginning.
+static const uint32_t kRingWrap = 0xffffffff;
+
+struct BufferedTextOutput::AsyncRing : public RefBase
+{
+    AsyncRing() : head(0), tail(0), dropped(0), detached(0) {
+    }
+
+    // Called by the owning thread. Returns false if there is no room.
+    bool write(const char* txt, size_t len) {
+        const uint32_t size = (sizeof(uint32_t) + len + 3) & ~3;
+        const uint32_t h = uint32_t(head);
+        const uint32_t t = uint32_t(android_atomic_acquire_load(&tail));
+        const uint32_t pos = h & (kAsyncRingSize-1);
+        const uint32_t toEnd = kAsyncRingSize - pos;
+        const uint32_t skip = toEnd < size ? toEnd : 0;
+        if (len > kAsyncRingSize || h - t + skip + size > kAsyncRingSize) {
+            return false;
+        }
+        uint32_t p = pos;
+        if (skip) {
+            memcpy(data + p, &kRingWrap, sizeof(uint32_t));
+            p = 0;
+        }
+        const uint32_t len32 = len;
+        memcpy(data + p, &len32, sizeof(uint32_t));
+        memcpy(data + p + sizeof(uint32_t), txt, len);
+        android_atomic_release_store(int32_t(h + skip + size), &head);
+        return true;
+    }
+
+    volatile int32_t head;      // bytes ever written, owned by the thread
+    volatile int32_t tail;      // bytes ever consumed, owned by the writer
+    volatile int32_t dropped;   // records dropped since the last drain
+    volatile int32_t detached;  // the thread has exited
+    char data[kAsyncRingSize];
+};
+
+class BufferedTextOutput::AsyncWriter : public Thread
+{
+public:
+    AsyncWriter(BufferedTextOutput* output)
+        : Thread(false), mOutput(output) {
+    }
+
+    // Signaled, with mAsyncLock held, to wake the thread. Each writer has
+    // its own, so that a forked child doesn't inherit the state of a
+    // condition the parent's writer was waiting on.
+    Condition wake;
+
+private:
+    virtual bool threadLoop() {
+        AutoMutex _l(mOutput->mAsyncLock);
+        if (mOutput->drainRings_l() || exitPending()) {
+            return true;
+        }
+        // Announce that we are going to sleep, then look once more, so that
+        // a thread that queued a record meanwhile either sees the flag and
+        // wakes us or had its record seen here.
+        android_atomic_release_store(1, &mOutput->mAsyncIdle);
+        android_memory_barrier();
+        if (!mOutput->hasQueuedRecords_l()) {
+            wake.wait(mOutput->mAsyncLock);
+        }
+        android_atomic_release_store(0, &mOutput->mAsyncIdle);
+        return true;
+    }
+
+    BufferedTextOutput* const mOutput;
+};
+
 struct BufferedTextOutput::BufferState : public RefBase
 {
     BufferState(int32_t _seq)
@@ -43,6 +125,9 @@ struct BufferedTextOutput::BufferState : public RefBase
         , bundle(0) {
     }
     ~BufferState() {
+        if (ring != NULL) {
+            android_atomic_release_store(1, &ring->detached);
+        }
         free(buffer);
     }
     
@@ -79,6 +164,7 @@ struct BufferedTextOutput::BufferState : public RefBase
     bool atFront;
     int32_t indent;
     int32_t bundle;
+    sp<AsyncRing> ring;
 };
 
 struct BufferedTextOutput::ThreadState
@@ -88,6 +174,11 @@ struct BufferedTextOutput::ThreadState
 
 static mutex_t          gMutex;
 
+// All ASYNC outputs, guarded by gMutex, so that their locks can be taken
+// around fork() and their writer state reset in the child.
+static BufferedTextOutput* gAsyncOutputs = NULL;
+static pthread_once_t   gAtForkOnce = PTHREAD_ONCE_INIT;
+
 static thread_store_t   tls;
 
 BufferedTextOutput::ThreadState* BufferedTextOutput::getThreadState()
@@ -143,32 +234,89 @@ BufferedTextOutput::BufferedTextOutput(uint32_t flags)
     : mFlags(flags)
     , mSeq(android_atomic_inc(&gSequence))
     , mIndex(allocBufferIndex())
+    , mAsyncIdle(0)
+    , mAsyncStopped(0)
+    , mNextAsync(NULL)
 {
     mGlobalState = new BufferState(mSeq);
     if (mGlobalState) mGlobalState->incStrong(this);
+
+    if ((mFlags&ASYNC) != 0) {
+        pthread_once(&gAtForkOnce, registerAtFork);
+        mutex_lock(&gMutex);
+        mNextAsync = gAsyncOutputs;
+        gAsyncOutputs = this;
+        mutex_unlock(&gMutex);
+    }
 }
     
 BufferedTextOutput::~BufferedTextOutput()
 {
+    if ((mFlags&ASYNC) != 0) {
+        mutex_lock(&gMutex);
+        BufferedTextOutput** p = &gAsyncOutputs;
+        while (*p != this) p = &(*p)->mNextAsync;
+        *p = mNextAsync;
+        mutex_unlock(&gMutex);
+    }
+
+    // The subclass is already destroyed, so the writer may have been
+    // calling its writeLines() all along.
+    LOG_ALWAYS_FATAL_IF(mAsyncWriter != NULL,
+            "ASYNC BufferedTextOutput destroyed without calling stopAsync()");
+    stopWriter();
+    mRings.clear();
     if (mGlobalState) mGlobalState->decStrong(this);
     freeBufferIndex(mIndex);
 }
 
+void BufferedTextOutput::stopAsync()
+{
+    stopWriter();
+    AutoMutex _l(mAsyncLock);
+    drainRings_l();
+}
+
+void BufferedTextOutput::stopWriter()
+{
+    sp<AsyncWriter> writer;
+    {
+        AutoMutex _l(mAsyncLock);
+        writer = mAsyncWriter;
+        mAsyncWriter.clear();
+        android_atomic_release_store(1, &mAsyncStopped);
+    }
+    if (writer != NULL) {
+        writer->requestExit();
+        {
+            // The writer checks exitPending() with mAsyncLock held before
+            // it waits, so signaling with the lock held can't be missed.
+            AutoMutex _l(mAsyncLock);
+            writer->wake.signal();
+        }
+        writer->requestExitAndWait();
+    }
+}
+
 status_t BufferedTextOutput::print(const char* txt, size_t len)
 {
     //printf("BufferedTextOutput: printing %d\n", len);
     
-    AutoMutex _l(mLock);
+    // Only the shared buffer needs the lock; a thread's own buffer
+    // is only touched by that thread.
     BufferState* b = getBuffer();
+    const bool shared = b == mGlobalState;
+    if (shared) mLock.lock();
     
     const char* const end = txt+len;
     
-    status_t err;
+    status_t err = NO_ERROR;
 
     while (txt < end) {
         // Find the next line.
         const char* first = txt;
-        while (txt < end && *txt != '\n') txt++;
+        txt = (const char*)memchr(txt, '\n', end-txt);
+        if (txt == NULL) txt = end;
         
         // Include this and all following empty lines.
         while (txt < end && *txt == '\n') txt++;
@@ -179,7 +327,7 @@ status_t BufferedTextOutput::print(const char* txt, size_t len)
                 // If this is the start of a line, add the indent.
                 const char* prefix = stringForIndent(b->indent);
                 err = b->append(prefix, strlen(prefix));
-                if (err != NO_ERROR) return err;
+                if (err != NO_ERROR) break;
                 
             } else if (*(txt-1) == '\n' && !b->bundle) {
                 // Fast path: if we are not indenting or bundling, and
@@ -187,15 +335,10 @@ status_t BufferedTextOutput::print(const char* txt, size_t len)
                 // them out without going through the buffer.
                 
                 // Slurp up all of the lines.
-                const char* lastLine = txt+1;
-                while (txt < end) {
-                    if (*txt++ == '\n') lastLine = txt;
-                }
-                struct iovec vec;
-                vec.iov_base = (void*)first;
-                vec.iov_len = lastLine-first;
-                //printf("Writing %d bytes of data!\n", vec.iov_len);
-                writeLines(vec, 1);
+                const char* lastLine = end;
+                while (lastLine > txt && lastLine[-1] != '\n') lastLine--;
+                //printf("Writing %d bytes of data!\n", lastLine-first);
+                emitLines(b, first, lastLine-first);
                 txt = lastLine;
                 continue;
             }
@@ -203,44 +346,47 @@ status_t BufferedTextOutput::print(const char* txt, size_t len)
         
         // Append the new text to the buffer.
         err = b->append(first, txt-first);
-        if (err != NO_ERROR) return err;
+        if (err != NO_ERROR) break;
         b->atFront = *(txt-1) == '\n';
         
         // If we have finished a line and are not bundling, write
         // it out.
         //printf("Buffer is now %d bytes\n", b->bufferPos);
         if (b->atFront && !b->bundle) {
-            struct iovec vec;
-            vec.iov_base = b->buffer;
-            vec.iov_len = b->bufferPos;
-            //printf("Writing %d bytes of data!\n", vec.iov_len);
-            writeLines(vec, 1);
+            //printf("Writing %d bytes of data!\n", b->bufferPos);
+            emitLines(b, b->buffer, b->bufferPos);
             b->restart();
         }
     }
     
-    return NO_ERROR;
+    if (shared) mLock.unlock();
+    return err;
 }
 
 void BufferedTextOutput::moveIndent(int delta)
 {
-    AutoMutex _l(mLock);
     BufferState* b = getBuffer();
+    const bool shared = b == mGlobalState;
+    if (shared) mLock.lock();
     b->indent += delta;
     if (b->indent < 0) b->indent = 0;
+    if (shared) mLock.unlock();
 }
 
 void BufferedTextOutput::pushBundle()
 {
-    AutoMutex _l(mLock);
     BufferState* b = getBuffer();
+    const bool shared = b == mGlobalState;
+    if (shared) mLock.lock();
     b->bundle++;
+    if (shared) mLock.unlock();
 }
 
 void BufferedTextOutput::popBundle()
 {
-    AutoMutex _l(mLock);
     BufferState* b = getBuffer();
+    const bool shared = b == mGlobalState;
+    if (shared) mLock.lock();
     b->bundle--;
     LOG_FATAL_IF(b->bundle < 0,
         "TextOutput::popBundle() called more times than pushBundle()");
@@ -251,16 +397,14 @@ void BufferedTextOutput::popBundle()
         // complete, don't write until the last line is done... this may
         // or may not be the write thing to do, but it's the easiest.
         if (b->bufferPos > 0 && b->atFront) {
-            struct iovec vec;
-            vec.iov_base = b->buffer;
-            vec.iov_len = b->bufferPos;
-            writeLines(vec, 1);
+            emitLines(b, b->buffer, b->bufferPos);
             b->restart();
         }
     }
+    if (shared) mLock.unlock();
 }
 
-BufferedTextOutput::BufferState* BufferedTextOutput::getBuffer() const
+BufferedTextOutput::BufferState* BufferedTextOutput::getBuffer()
 {
     if ((mFlags&MULTITHREADED) != 0) {
         ThreadState* ts = getThreadState();
@@ -269,13 +413,178 @@ BufferedTextOutput::BufferState* BufferedTextOutput::getBuffer() const
             BufferState* bs = ts->states[mIndex].get();
             if (bs != NULL && bs->seq == mSeq) return bs;
             
-            ts->states.editItemAt(mIndex) = new BufferState(mIndex);
+            ts->states.editItemAt(mIndex) = new BufferState(mSeq);
             bs = ts->states[mIndex].get();
-            if (bs != NULL) return bs;
+            if (bs != NULL) {
+                if ((mFlags&ASYNC) != 0) bs->ring = attachRing();
+                return bs;
+            }
         }
     }
     
     return mGlobalState;
 }
 
+void BufferedTextOutput::emitLines(BufferState* b, const char* txt, size_t len)
+{
+    struct iovec vec;
+    vec.iov_base = (void*)txt;
+    vec.iov_len = len;
+
+    AsyncRing* ring = b->ring.get();
+    if (ring != NULL && len <= kAsyncRingSize/2
+            && !android_atomic_acquire_load(&mAsyncStopped)) {
+        if (ring->write(txt, len)) {
+            // The writer drains until all rings are empty before it sleeps,
+            // so it only needs waking if it is asleep. See threadLoop().
+            android_memory_barrier();
+            if (android_atomic_acquire_load(&mAsyncStopped)) {
+                // stopAsync() ran meanwhile and may have drained the ring
+                // before this record was in it, so write it out here.
+                AutoMutex _l(mAsyncLock);
+                drainRings_l();
+            } else if (android_atomic_acquire_load(&mAsyncIdle)) {
+                AutoMutex _l(mAsyncLock);
+                android_atomic_release_store(0, &mAsyncIdle);
+                if (mAsyncWriter != NULL) mAsyncWriter->wake.signal();
+            }
+        } else {
+            android_atomic_inc(&ring->dropped);
+        }
+        return;
+    }
+
+    // Writes of the shared buffer happen with mLock already held. Records
+    // too large for the ring are written directly, ahead of any lines
+    // still queued.
+    if (b == mGlobalState) {
+        writeLines(vec, 1);
+    } else {
+        AutoMutex _l(mLock);
+        writeLines(vec, 1);
+    }
+}
+
+sp<BufferedTextOutput::AsyncRing> BufferedTextOutput::attachRing()
+{
+    AutoMutex _l(mAsyncLock);
+    if (mAsyncStopped || (mRings.size() + 1) * sizeof(AsyncRing) > kAsyncMemoryBudget) {
+        return NULL;
+    }
+    if (mAsyncWriter == NULL) {
+        sp<AsyncWriter> writer = new AsyncWriter(this);
+        if (writer->run("BufferedTextOutput", PRIORITY_BACKGROUND) != NO_ERROR) {
+            return NULL;
+        }
+        mAsyncWriter = writer;
+    }
+    sp<AsyncRing> ring = new AsyncRing;
+    mRings.add(ring);
+    return ring;
+}
+
+bool BufferedTextOutput::hasQueuedRecords_l()
+{
+    for (size_t i = 0; i < mRings.size(); i++) {
+        const AsyncRing* ring = mRings[i].get();
+        if (android_atomic_acquire_load(&ring->head) != ring->tail || ring->dropped) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BufferedTextOutput::drainRings_l()
+{
+    bool wrote = false;
+    for (size_t i = 0; i < mRings.size(); ) {
+        AsyncRing* ring = mRings[i].get();
+        const bool detached = android_atomic_acquire_load(&ring->detached) != 0;
+        const uint32_t head = uint32_t(android_atomic_acquire_load(&ring->head));
+        uint32_t tail = uint32_t(ring->tail);
+        while (tail != head) {
+            const uint32_t pos = tail & (kAsyncRingSize-1);
+            uint32_t len;
+            memcpy(&len, ring->data + pos, sizeof(uint32_t));
+            if (len == kRingWrap) {
+                tail += kAsyncRingSize - pos;
+                continue;
+            }
+            struct iovec vec;
+            vec.iov_base = ring->data + pos + sizeof(uint32_t);
+            vec.iov_len = len;
+            {
+                AutoMutex _l(mLock);
+                writeLines(vec, 1);
+            }
+            tail += (sizeof(uint32_t) + len + 3) & ~3;
+            android_atomic_release_store(int32_t(tail), &ring->tail);
+            wrote = true;
+        }
+
+        const int32_t dropped = android_atomic_and(0, &ring->dropped);
+        if (dropped > 0) {
+            char line[80];
+            struct iovec vec;
+            vec.iov_base = line;
+            vec.iov_len = snprintf(line, sizeof(line),
+                    "BufferedTextOutput: %d lines dropped\n", dropped);
+            AutoMutex _l(mLock);
+            writeLines(vec, 1);
+        }
+
+        if (detached) {
+            // The thread is gone and everything it wrote has been drained.
+            mRings.removeAt(i);
+        } else {
+            i++;
+        }
+    }
+    return wrote;
+}
+
+void BufferedTextOutput::registerAtFork()
+{
+    pthread_atfork(prepareFork, parentAfterFork, childAfterFork);
+}
+
+// A thread holding one of these locks across fork() would leave it locked
+// forever in the child, so fork() waits for them.
+void BufferedTextOutput::prepareFork()
+{
+    mutex_lock(&gMutex);
+    for (BufferedTextOutput* o = gAsyncOutputs; o != NULL; o = o->mNextAsync) {
+        o->mAsyncLock.lock();
+        o->mLock.lock();
+    }
+}
+
+void BufferedTextOutput::parentAfterFork()
+{
+    for (BufferedTextOutput* o = gAsyncOutputs; o != NULL; o = o->mNextAsync) {
+        o->mLock.unlock();
+        o->mAsyncLock.unlock();
+    }
+    mutex_unlock(&gMutex);
+}
+
+// The child has none of the parent's other threads, including the writer.
+// Forget the writer and the rings, whose lines the parent writes anyway,
+// and give the output a new sequence number so that the forking thread
+// gets a fresh buffer and ring the next time it prints.
+void BufferedTextOutput::childAfterFork()
+{
+    for (BufferedTextOutput* o = gAsyncOutputs; o != NULL; o = o->mNextAsync) {
+        // Dropping the last reference to a Thread is harmless once the
+        // thread is gone; its own reference is leaked with its stack.
+        o->mAsyncWriter.clear();
+        o->mRings.clear();
+        o->mAsyncIdle = 0;
+        o->mSeq = android_atomic_inc(&gSequence);
+        o->mLock.unlock();
+        o->mAsyncLock.unlock();
+    }
+    mutex_unlock(&gMutex);
+}
+
 }; // namespace android
@@ -31,7 +31,9 @@ namespace android {
 
 CursorWindow::CursorWindow(const String8& name, int ashmemFd,
         void* data, size_t size, bool readOnly) :
-        mName(name), mAshmemFd(ashmemFd), mData(data), mSize(size), mReadOnly(readOnly) {
+        mName(name), mAshmemFd(ashmemFd), mData(data), mSize(size), mReadOnly(readOnly),
+        mNextField(NULL), mNextFieldStride(0), mFieldsLeft(0),
+        mPayloadOffset(0), mPayloadLeft(0) {
     mHeader = static_cast<Header*>(mData);
 }
 
@@ -135,13 +137,20 @@ status_t CursorWindow::clear() {
         return INVALID_OPERATION;
     }
 
-    mHeader->freeOffset = sizeof(Header) + sizeof(RowSlotChunk);
-    mHeader->firstChunkOffset = sizeof(Header);
+    mFieldsLeft = 0;
+
+    const size_t chunkDirSize = INITIAL_CHUNK_DIR_CAPACITY * sizeof(uint32_t);
+    mHeader->freeOffset = sizeof(Header) + chunkDirSize + sizeof(RowSlotChunk);
+    mHeader->chunkDirOffset = sizeof(Header);
+    mHeader->chunkDirCapacity = INITIAL_CHUNK_DIR_CAPACITY;
+    mHeader->numChunks = 1;
     mHeader->numRows = 0;
     mHeader->numColumns = 0;
+    mHeader->columnarOffset = 0;
+    mHeader->columnarMaxRows = 0;
 
-    RowSlotChunk* firstChunk = static_cast<RowSlotChunk*>(offsetToPtr(mHeader->firstChunkOffset));
-    firstChunk->nextChunkOffset = 0;
+    uint32_t* chunkDir = static_cast<uint32_t*>(offsetToPtr(mHeader->chunkDirOffset));
+    chunkDir[0] = sizeof(Header) + chunkDirSize;
     return OK;
 }
 
@@ -159,11 +168,40 @@ status_t CursorWindow::setNumColumns(uint32_t numColumns) {
     return OK;
 }
 
+status_t CursorWindow::setColumnar(uint32_t maxRows) {
+    if (mReadOnly) {
+        return INVALID_OPERATION;
+    }
+
+    uint32_t numColumns = mHeader->numColumns;
+    if (!numColumns || mHeader->numRows > 0 || isColumnar()) {
+        LOGE("Columnar layout must be chosen after setting the columns "
+                "and before adding rows");
+        return INVALID_OPERATION;
+    }
+    if (!maxRows || maxRows > mSize / (numColumns * sizeof(FieldSlot))) {
+        return NO_MEMORY;
+    }
+
+    uint32_t offset = alloc(size_t(maxRows) * numColumns * sizeof(FieldSlot), true /*aligned*/);
+    if (!offset) {
+        return NO_MEMORY;
+    }
+    mHeader->columnarOffset = offset;
+    mHeader->columnarMaxRows = maxRows;
+    return OK;
+}
+
 status_t CursorWindow::allocRow() {
     if (mReadOnly) {
         return INVALID_OPERATION;
     }
 
+    mFieldsLeft = 0;
+    if (isColumnar()) {
+        return allocColumnarRow();
+    }
+
     // Fill in the row slot
     RowSlot* rowSlot = allocRowSlot();
     if (rowSlot == NULL) {
@@ -193,12 +231,107 @@ status_t CursorWindow::freeLastRow() {
         return INVALID_OPERATION;
     }
 
+    mFieldsLeft = 0;
     if (mHeader->numRows > 0) {
         mHeader->numRows--;
     }
     return OK;
 }
 
+size_t CursorWindow::getSpaceNeeded(const size_t* payloadSizes, uint32_t numRows) {
+    size_t size;
+    size_t fieldDirSize;
+    if (isColumnar()) {
+        if (numRows > mHeader->columnarMaxRows - mHeader->numRows) {
+            return SIZE_MAX;
+        }
+        size = 0;
+        fieldDirSize = 0;
+    } else {
+        size = getRowSlotSpaceNeeded(numRows);
+        fieldDirSize = mHeader->numColumns * sizeof(FieldSlot);
+    }
+
+    // Rows are allocated in multiples of 4 bytes, so only the first
+    // allocation can need padding.
+    for (uint32_t i = 0; i < numRows && size <= mSize; i++) {
+        if (payloadSizes[i] > mSize) {
+            return SIZE_MAX;
+        }
+        size += (fieldDirSize + payloadSizes[i] + 3) & ~3;
+    }
+    if (size > mSize) {
+        return SIZE_MAX;
+    }
+    if (size) {
+        size += (~mHeader->freeOffset + 1) & 3;
+    }
+    return size;
+}
+
+status_t CursorWindow::beginRow(size_t payloadSize) {
+    if (mReadOnly) {
+        return INVALID_OPERATION;
+    }
+
+    mFieldsLeft = 0;
+    if (getSpaceNeeded(&payloadSize, 1) > freeSpace()) {
+        LOG_WINDOW("No room for a row with %d bytes of payload", payloadSize);
+        return NO_MEMORY;
+    }
+
+    // The allocations below cannot fail now.
+    uint32_t row = mHeader->numRows;
+    uint32_t numColumns = mHeader->numColumns;
+    if (isColumnar()) {
+        allocColumnarRow();
+        mNextField = static_cast<FieldSlot*>(offsetToPtr(mHeader->columnarOffset)) + row;
+        mNextFieldStride = mHeader->columnarMaxRows;
+        mPayloadOffset = payloadSize ? alloc((payloadSize + 3) & ~3, true /*aligned*/) : 0;
+    } else {
+        size_t fieldDirSize = numColumns * sizeof(FieldSlot);
+        size_t rowSize = (fieldDirSize + payloadSize + 3) & ~3;
+        RowSlot* rowSlot = allocRowSlot();
+        uint32_t offset = rowSize ? alloc(rowSize, true /*aligned*/) : 0;
+        rowSlot->offset = offset;
+        mNextField = static_cast<FieldSlot*>(offsetToPtr(offset));
+        mNextFieldStride = 1;
+        mPayloadOffset = offset + fieldDirSize;
+        memset(mNextField, 0, fieldDirSize);
+    }
+    mFieldsLeft = numColumns;
+    mPayloadLeft = payloadSize;
+    return OK;
+}
+
+status_t CursorWindow::putNextBlob(const void* value, size_t size) {
+    return putNextBlobOrString(value, size, FIELD_TYPE_BLOB);
+}
+
+status_t CursorWindow::putNextString(const char* value, size_t sizeIncludingNull) {
+    return putNextBlobOrString(value, sizeIncludingNull, FIELD_TYPE_STRING);
+}
+
+status_t CursorWindow::putNextBlobOrString(const void* value, size_t size, int32_t type) {
+    if (size > mPayloadLeft) {
+        LOGE("Field of %d bytes exceeds the %d bytes left in the row", size, mPayloadLeft);
+        return BAD_VALUE;
+    }
+    FieldSlot* fieldSlot = nextFieldSlot();
+    if (!fieldSlot) {
+        return INVALID_OPERATION;
+    }
+
+    memcpy(offsetToPtr(mPayloadOffset), value, size);
+
+    fieldSlot->type = type;
+    fieldSlot->data.buffer.offset = mPayloadOffset;
+    fieldSlot->data.buffer.size = size;
+    mPayloadOffset += size;
+    mPayloadLeft -= size;
+    return OK;
+}
+
 uint32_t CursorWindow::alloc(size_t size, bool aligned) {
     uint32_t padding;
     if (aligned) {
@@ -221,38 +354,64 @@ uint32_t CursorWindow::alloc(size_t size, bool aligned) {
     return offset;
 }
 
-CursorWindow::RowSlot* CursorWindow::getRowSlot(uint32_t row) {
-    uint32_t chunkPos = row;
-    RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
-            offsetToPtr(mHeader->firstChunkOffset));
-    while (chunkPos >= ROW_SLOT_CHUNK_NUM_ROWS) {
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
-        chunkPos -= ROW_SLOT_CHUNK_NUM_ROWS;
-    }
-    return &chunk->slots[chunkPos];
-}
-
 CursorWindow::RowSlot* CursorWindow::allocRowSlot() {
-    uint32_t chunkPos = mHeader->numRows;
-    RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
-            offsetToPtr(mHeader->firstChunkOffset));
-    while (chunkPos > ROW_SLOT_CHUNK_NUM_ROWS) {
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
-        chunkPos -= ROW_SLOT_CHUNK_NUM_ROWS;
-    }
-    if (chunkPos == ROW_SLOT_CHUNK_NUM_ROWS) {
-        if (!chunk->nextChunkOffset) {
-            chunk->nextChunkOffset = alloc(sizeof(RowSlotChunk), true /*aligned*/);
-            if (!chunk->nextChunkOffset) {
+    uint32_t row = mHeader->numRows;
+    uint32_t chunkIndex = row / ROW_SLOT_CHUNK_NUM_ROWS;
+    if (chunkIndex == mHeader->numChunks) {
+        // Move the chunk directory to twice the space when it is full. The old
+        // copy is left behind, but it is small next to the rows it refers to.
+        if (chunkIndex == mHeader->chunkDirCapacity) {
+            uint32_t capacity = mHeader->chunkDirCapacity * 2;
+            uint32_t chunkDirOffset = alloc(capacity * sizeof(uint32_t), true /*aligned*/);
+            if (!chunkDirOffset) {
                 return NULL;
             }
+            memcpy(offsetToPtr(chunkDirOffset), offsetToPtr(mHeader->chunkDirOffset),
+                    mHeader->numChunks * sizeof(uint32_t));
+            mHeader->chunkDirOffset = chunkDirOffset;
+            mHeader->chunkDirCapacity = capacity;
+        }
+        uint32_t chunkOffset = alloc(sizeof(RowSlotChunk), true /*aligned*/);
+        if (!chunkOffset) {
+            return NULL;
         }
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
-        chunk->nextChunkOffset = 0;
-        chunkPos = 0;
+        uint32_t* chunkDir = static_cast<uint32_t*>(offsetToPtr(mHeader->chunkDirOffset));
+        chunkDir[chunkIndex] = chunkOffset;
+        mHeader->numChunks += 1;
+    }
+    mHeader->numRows += 1;
+    return getRowSlot(row);
+}
+
+size_t CursorWindow::getRowSlotSpaceNeeded(uint32_t numRows) {
+    size_t rows = size_t(mHeader->numRows) + numRows;
+    size_t numChunks = (rows + ROW_SLOT_CHUNK_NUM_ROWS - 1) / ROW_SLOT_CHUNK_NUM_ROWS;
+    size_t chunkDirCapacity = mHeader->chunkDirCapacity;
+    size_t size = 0;
+    for (size_t i = mHeader->numChunks; i < numChunks && size <= mSize; i++) {
+        if (i == chunkDirCapacity) {
+            chunkDirCapacity *= 2;
+            size += chunkDirCapacity * sizeof(uint32_t);
+        }
+        size += sizeof(RowSlotChunk);
+    }
+    return size;
+}
+
+status_t CursorWindow::allocColumnarRow() {
+    uint32_t row = mHeader->numRows;
+    if (row == mHeader->columnarMaxRows) {
+        LOG_WINDOW("Columnar window is full: %u rows", row);
+        return NO_MEMORY;
+    }
+
+    FieldSlot* fieldSlot = static_cast<FieldSlot*>(offsetToPtr(mHeader->columnarOffset)) + row;
+    for (uint32_t i = 0; i < mHeader->numColumns; i++) {
+        memset(fieldSlot, 0, sizeof(FieldSlot));
+        fieldSlot += mHeader->columnarMaxRows;
     }
     mHeader->numRows += 1;
-    return &chunk->slots[chunkPos];
+    return OK;
 }
 
 CursorWindow::FieldSlot* CursorWindow::getFieldSlot(uint32_t row, uint32_t column) {
@@ -262,13 +421,59 @@ CursorWindow::FieldSlot* CursorWindow::getFieldSlot(uint32_t row, uint32_t colum
                 row, column, mHeader->numRows, mHeader->numColumns);
         return NULL;
     }
-    RowSlot* rowSlot = getRowSlot(row);
-    if (!rowSlot) {
-        LOGE("Failed to find rowSlot for row %d.", row);
-        return NULL;
+    return fieldSlotAt(row, column);
+}
+
+status_t CursorWindow::getColumnLongs(uint32_t column, uint32_t startRow, uint32_t numRows,
+        int64_t* outValues) {
+    if (column >= mHeader->numColumns || startRow > mHeader->numRows
+            || numRows > mHeader->numRows - startRow) {
+        return BAD_VALUE;
+    }
+
+    for (uint32_t i = 0; i < numRows; i++) {
+        const FieldSlot* fieldSlot = fieldSlotAt(startRow + i, column);
+        switch (fieldSlot->type) {
+        case FIELD_TYPE_INTEGER:
+            outValues[i] = fieldSlot->data.l;
+            break;
+        case FIELD_TYPE_FLOAT:
+            outValues[i] = int64_t(fieldSlot->data.d);
+            break;
+        case FIELD_TYPE_NULL:
+            outValues[i] = 0;
+            break;
+        default:
+            return BAD_TYPE;
+        }
     }
-    FieldSlot* fieldDir = static_cast<FieldSlot*>(offsetToPtr(rowSlot->offset));
-    return &fieldDir[column];
+    return OK;
+}
+
+status_t CursorWindow::getColumnDoubles(uint32_t column, uint32_t startRow, uint32_t numRows,
+        double* outValues) {
+    if (column >= mHeader->numColumns || startRow > mHeader->numRows
+            || numRows > mHeader->numRows - startRow) {
+        return BAD_VALUE;
+    }
+
+    for (uint32_t i = 0; i < numRows; i++) {
+        const FieldSlot* fieldSlot = fieldSlotAt(startRow + i, column);
+        switch (fieldSlot->type) {
+        case FIELD_TYPE_INTEGER:
+            outValues[i] = double(fieldSlot->data.l);
+            break;
+        case FIELD_TYPE_FLOAT:
+            outValues[i] = fieldSlot->data.d;
+            break;
+        case FIELD_TYPE_NULL:
+            outValues[i] = 0;
+            break;
+        default:
+            return BAD_TYPE;
+        }
+    }
+    return OK;
 }
 
 status_t CursorWindow::putBlob(uint32_t row, uint32_t column, const void* value, size_t size) {
@@ -19,6 +19,7 @@
 #include <binder/IPCThreadState.h>
 
 #include <binder/Binder.h>
+#include <binder/BinderTrace.h>
 #include <binder/BpBinder.h>
 #include <binder/TextOutput.h>
 
@@ -66,215 +67,6 @@
 
 namespace android {
 
-static const char* getReturnString(size_t idx);
-static const void* printReturnCommand(TextOutput& out, const void* _cmd);
-static const void* printCommand(TextOutput& out, const void* _cmd);
-
-// Static const and functions will be optimized out if not used,
-// when LOG_NDEBUG and references in IF_LOG_COMMANDS() are optimized out.
-static const char *kReturnStrings[] = {
-    "BR_ERROR",
-    "BR_OK",
-    "BR_TRANSACTION",
-    "BR_REPLY",
-    "BR_ACQUIRE_RESULT",
-    "BR_DEAD_REPLY",
-    "BR_TRANSACTION_COMPLETE",
-    "BR_INCREFS",
-    "BR_ACQUIRE",
-    "BR_RELEASE",
-    "BR_DECREFS",
-    "BR_ATTEMPT_ACQUIRE",
-    "BR_NOOP",
-    "BR_SPAWN_LOOPER",
-    "BR_FINISHED",
-    "BR_DEAD_BINDER",
-    "BR_CLEAR_DEATH_NOTIFICATION_DONE",
-    "BR_FAILED_REPLY"
-};
-
-static const char *kCommandStrings[] = {
-    "BC_TRANSACTION",
-    "BC_REPLY",
-    "BC_ACQUIRE_RESULT",
-    "BC_FREE_BUFFER",
-    "BC_INCREFS",
-    "BC_ACQUIRE",
-    "BC_RELEASE",
-    "BC_DECREFS",
-    "BC_INCREFS_DONE",
-    "BC_ACQUIRE_DONE",
-    "BC_ATTEMPT_ACQUIRE",
-    "BC_REGISTER_LOOPER",
-    "BC_ENTER_LOOPER",
-    "BC_EXIT_LOOPER",
-    "BC_REQUEST_DEATH_NOTIFICATION",
-    "BC_CLEAR_DEATH_NOTIFICATION",
-    "BC_DEAD_BINDER_DONE"
-};
-
-static const char* getReturnString(size_t idx)
-{
-    if (idx < sizeof(kReturnStrings) / sizeof(kReturnStrings[0]))
-        return kReturnStrings[idx];
-    else
-        return "unknown";
-}
-
-static const void* printBinderTransactionData(TextOutput& out, const void* data)
-{
-    const binder_transaction_data* btd =
-        (const binder_transaction_data*)data;
-    if (btd->target.handle < 1024) {
-        /* want to print descriptors in decimal; guess based on value */
-        out << "target.desc=" << btd->target.handle;
-    } else {
-        out << "target.ptr=" << btd->target.ptr;
-    }
-    out << " (cookie " << btd->cookie << ")" << endl
-        << "code=" << TypeCode(btd->code) << ", flags=" << (void*)(long)btd->flags << endl
-        << "data=" << btd->data.ptr.buffer << " (" << (void*)btd->data_size
-        << " bytes)" << endl
-        << "offsets=" << btd->data.ptr.offsets << " (" << (void*)btd->offsets_size
-        << " bytes)";
-    return btd+1;
-}
-
-static const void* printReturnCommand(TextOutput& out, const void* _cmd)
-{
-    static const size_t N = sizeof(kReturnStrings)/sizeof(kReturnStrings[0]);
-    const int32_t* cmd = (const int32_t*)_cmd;
-    uint32_t code = (uint32_t)*cmd++;
-    size_t cmdIndex = code & 0xff;
-    if (code == BR_ERROR) {
-        out << "BR_ERROR: " << (void*)(long)(*cmd++) << endl;
-        return cmd;
-    } else if (cmdIndex >= N) {
-        out << "Unknown reply: " << code << endl;
-        return cmd;
-    }
-    out << kReturnStrings[cmdIndex];
-    
-    switch (code) {
-        case BR_TRANSACTION:
-        case BR_REPLY: {
-            out << ": " << indent;
-            cmd = (const int32_t *)printBinderTransactionData(out, cmd);
-            out << dedent;
-        } break;
-        
-        case BR_ACQUIRE_RESULT: {
-            const int32_t res = *cmd++;
-            out << ": " << res << (res ? " (SUCCESS)" : " (FAILURE)");
-        } break;
-        
-        case BR_INCREFS:
-        case BR_ACQUIRE:
-        case BR_RELEASE:
-        case BR_DECREFS: {
-            const int32_t b = *cmd++;
-            const int32_t c = *cmd++;
-            out << ": target=" << (void*)(long)b << " (cookie " << (void*)(long)c << ")";
-        } break;
-    
-        case BR_ATTEMPT_ACQUIRE: {
-            const int32_t p = *cmd++;
-            const int32_t b = *cmd++;
-            const int32_t c = *cmd++;
-            out << ": target=" << (void*)(long)b << " (cookie " << (void*)(long)c
-                << "), pri=" << p;
-        } break;
-
-        case BR_DEAD_BINDER:
-        case BR_CLEAR_DEATH_NOTIFICATION_DONE: {
-            const int32_t c = *cmd++;
-            out << ": death cookie " << (void*)(long)c;
-        } break;
-
-        default:
-            // no details to show for: BR_OK, BR_DEAD_REPLY,
-            // BR_TRANSACTION_COMPLETE, BR_FINISHED
-            break;
-    }
-    
-    out << endl;
-    return cmd;
-}
-
-static const void* printCommand(TextOutput& out, const void* _cmd)
-{
-    static const size_t N = sizeof(kCommandStrings)/sizeof(kCommandStrings[0]);
-    const int32_t* cmd = (const int32_t*)_cmd;
-    uint32_t code = (uint32_t)*cmd++;
-    size_t cmdIndex = code & 0xff;
-
-    if (cmdIndex >= N) {
-        out << "Unknown command: " << code << endl;
-        return cmd;
-    }
-    out << kCommandStrings[cmdIndex];
-
-    switch (code) {
-        case BC_TRANSACTION:
-        case BC_REPLY: {
-            out << ": " << indent;
-            cmd = (const int32_t *)printBinderTransactionData(out, cmd);
-            out << dedent;
-        } break;
-        
-        case BC_ACQUIRE_RESULT: {
-            const int32_t res = *cmd++;
-            out << ": " << res << (res ? " (SUCCESS)" : " (FAILURE)");
-        } break;
-        
-        case BC_FREE_BUFFER: {
-            const int32_t buf = *cmd++;
-            out << ": buffer=" << (void*)(long)buf;
-        } break;
-        
-        case BC_INCREFS:
-        case BC_ACQUIRE:
-        case BC_RELEASE:
-        case BC_DECREFS: {
-            const int32_t d = *cmd++;
-            out << ": desc=" << d;
-        } break;
-    
-        case BC_INCREFS_DONE:
-        case BC_ACQUIRE_DONE: {
-            const int32_t b = *cmd++;
-            const int32_t c = *cmd++;
-            out << ": target=" << (void*)(long)b << " (cookie " << (void*)(long)c << ")";
-        } break;
-        
-        case BC_ATTEMPT_ACQUIRE: {
-            const int32_t p = *cmd++;
-            const int32_t d = *cmd++;
-            out << ": desc=" << d << ", pri=" << p;
-        } break;
-        
-        case BC_REQUEST_DEATH_NOTIFICATION:
-        case BC_CLEAR_DEATH_NOTIFICATION: {
-            const int32_t h = *cmd++;
-            const int32_t c = *cmd++;
-            out << ": handle=" << h << " (death cookie " << (void*)(long)c << ")";
-        } break;
-
-        case BC_DEAD_BINDER_DONE: {
-            const int32_t c = *cmd++;
-            out << ": death cookie " << (void*)(long)c;
-        } break;
-
-        default:
-            // no details to show for: BC_REGISTER_LOOPER, BC_ENTER_LOOPER,
-            // BC_EXIT_LOOPER
-            break;
-    }
-    
-    out << endl;
-    return cmd;
-}
-
 static pthread_mutex_t gTLSMutex = PTHREAD_MUTEX_INITIALIZER;
 static bool gHaveTLS = false;
 static pthread_key_t gTLS = 0;
@@ -426,8 +218,8 @@ status_t IPCThreadState::getAndExecuteCommand()
         if (IN < sizeof(int32_t)) return result;
         cmd = mIn.readInt32();
         IF_LOG_COMMANDS() {
-            alog << "Processing top-level Command: "
-                 << getReturnString(cmd) << endl;
+            gCommandLog << "Processing top-level Command: "
+                 << BinderTrace::returnString(cmd) << endl;
         }
 
         pthread_mutex_lock(&mProcess->mThreadCountLock);
@@ -727,8 +519,8 @@ status_t IPCThreadState::waitForResponse(Parcel *reply, status_t *acquireResult)
         cmd = (uint32_t)mIn.readInt32();
         
         IF_LOG_COMMANDS() {
-            alog << "Processing waitForResponse Command: "
-                << getReturnString(cmd) << endl;
+            gCommandLog << "Processing waitForResponse Command: "
+                << BinderTrace::returnString(cmd) << endl;
         }
 
         switch (cmd) {
@@ -833,16 +625,16 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
     }
 
     IF_LOG_COMMANDS() {
-        TextOutput::Bundle _b(alog);
+        TextOutput::Bundle _b(gCommandLog);
         if (outAvail != 0) {
-            alog << "Sending commands to driver: " << indent;
+            gCommandLog << "Sending commands to driver: " << indent;
             const void* cmds = (const void*)bwr.write_buffer;
             const void* end = ((const uint8_t*)cmds)+bwr.write_size;
-            alog << HexDump(cmds, bwr.write_size) << endl;
-            while (cmds < end) cmds = printCommand(alog, cmds);
-            alog << dedent;
+            gCommandLog << HexDump(cmds, bwr.write_size) << endl;
+            while (cmds < end) cmds = BinderTrace::printCommand(gCommandLog, cmds);
+            gCommandLog << dedent;
         }
-        alog << "Size of receive buffer: " << bwr.read_size
+        gCommandLog << "Size of receive buffer: " << bwr.read_size
             << ", needRead: " << needRead << ", doReceive: " << doReceive << endl;
     }
     
@@ -854,7 +646,7 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
     status_t err;
     do {
         IF_LOG_COMMANDS() {
-            alog << "About to read/write, write size = " << mOut.dataSize() << endl;
+            gCommandLog << "About to read/write, write size = " << mOut.dataSize() << endl;
         }
 #if defined(HAVE_ANDROID_OS)
         if (ioctl(mProcess->mDriverFD, BINDER_WRITE_READ, &bwr) >= 0)
@@ -868,17 +660,21 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
             err = -EBADF;
         }
         IF_LOG_COMMANDS() {
-            alog << "Finished read/write, write size = " << mOut.dataSize() << endl;
+            gCommandLog << "Finished read/write, write size = " << mOut.dataSize() << endl;
         }
     } while (err == -EINTR);
 
     IF_LOG_COMMANDS() {
-        alog << "Our err: " << (void*)(intptr_t)err << ", write consumed: "
+        gCommandLog << "Our err: " << (void*)(intptr_t)err << ", write consumed: "
             << bwr.write_consumed << " (of " << mOut.dataSize()
                         << "), read consumed: " << bwr.read_consumed << endl;
     }
 
     if (err >= NO_ERROR) {
+        if (BinderTrace::isEnabled()) {
+            BinderTrace::recordCommands((const void*)bwr.write_buffer, bwr.write_consumed);
+            BinderTrace::recordReturns((const void*)bwr.read_buffer, bwr.read_consumed);
+        }
         if (bwr.write_consumed > 0) {
             if (bwr.write_consumed < mOut.dataSize())
                 mOut.remove(0, bwr.write_consumed);
@@ -890,14 +686,14 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
             mIn.setDataPosition(0);
         }
         IF_LOG_COMMANDS() {
-            TextOutput::Bundle _b(alog);
-            alog << "Remaining data size: " << mOut.dataSize() << endl;
-            alog << "Received commands from driver: " << indent;
+            TextOutput::Bundle _b(gCommandLog);
+            gCommandLog << "Remaining data size: " << mOut.dataSize() << endl;
+            gCommandLog << "Received commands from driver: " << indent;
             const void* cmds = mIn.data();
             const void* end = mIn.data() + mIn.dataSize();
-            alog << HexDump(cmds, mIn.dataSize()) << endl;
-            while (cmds < end) cmds = printReturnCommand(alog, cmds);
-            alog << dedent;
+            gCommandLog << HexDump(cmds, mIn.dataSize()) << endl;
+            while (cmds < end) cmds = BinderTrace::printReturnCommand(gCommandLog, cmds);
+            gCommandLog << dedent;
         }
         return NO_ERROR;
     }
@@ -1187,7 +983,7 @@ void IPCThreadState::freeBuffer(Parcel* parcel, const uint8_t* data,
 {
     //LOGI("Freeing parcel %p", &parcel);
     IF_LOG_COMMANDS() {
-        alog << "Writing BC_FREE_BUFFER for " << data << endl;
+        gCommandLog << "Writing BC_FREE_BUFFER for " << data << endl;
     }
     LOG_ASSERT(data != NULL, "Called with NULL data");
     if (parcel != NULL) parcel->closeFileDescriptors();
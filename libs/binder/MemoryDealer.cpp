@@ -20,9 +20,12 @@
 #include <binder/IPCThreadState.h>
 #include <binder/MemoryBase.h>
 
+#include <utils/FlatHashtable.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 #include <utils/SortedVector.h>
 #include <utils/String8.h>
+#include <utils/Timers.h>
 #include <utils/threads.h>
 
 #include <stdint.h>
@@ -120,20 +123,34 @@ private:
 
 // ----------------------------------------------------------------------------
 
-class SimpleBestFitAllocator
+class HeapAllocator
 {
+public:
     enum {
         PAGE_ALIGNED = 0x00000001
     };
+
+    virtual ~HeapAllocator() { }
+
+    virtual size_t      allocate(size_t size, uint32_t flags = 0) = 0;
+    virtual status_t    deallocate(size_t offset) = 0;
+    virtual size_t      size() const = 0;
+    virtual void        dump(const char* what) const = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+class SimpleBestFitAllocator : public HeapAllocator
+{
 public:
     SimpleBestFitAllocator(size_t size);
-    ~SimpleBestFitAllocator();
+    virtual ~SimpleBestFitAllocator();
 
-    size_t      allocate(size_t size, uint32_t flags = 0);
-    status_t    deallocate(size_t offset);
-    size_t      size() const;
-    void        dump(const char* what) const;
-    void        dump(String8& res, const char* what) const;
+    virtual size_t      allocate(size_t size, uint32_t flags = 0);
+    virtual status_t    deallocate(size_t offset);
+    virtual size_t      size() const;
+    virtual void        dump(const char* what) const;
+    void                dump(String8& res, const char* what) const;
 
 private:
 
@@ -161,6 +178,85 @@ private:
 
 // ----------------------------------------------------------------------------
 
+/*
+ * A two-level segregated fit allocator, after TLSF.
+ *
+ * Free blocks are kept in lists by size class. The first level splits sizes
+ * by powers of two and the second level splits each power of two in
+ * SL_COUNT steps. A bitmap per level records which lists are non-empty, so
+ * the smallest class that can hold a request is found with two bit scans.
+ * Allocated blocks are found by offset through a hashtable, and blocks are
+ * linked in address order so a freed block merges with its free neighbors
+ * in constant time. Block records are recycled rather than freed.
+ */
+class SegregatedFitAllocator : public HeapAllocator
+{
+public:
+    SegregatedFitAllocator(size_t size);
+    virtual ~SegregatedFitAllocator();
+
+    virtual size_t      allocate(size_t size, uint32_t flags = 0);
+    virtual status_t    deallocate(size_t offset);
+    virtual size_t      size() const;
+    virtual void        dump(const char* what) const;
+    void                dump(String8& res, const char* what) const;
+
+private:
+    enum {
+        SL_LOG2     = 3,
+        SL_COUNT    = 1 << SL_LOG2,
+        FL_COUNT    = 32
+    };
+
+    struct chunk_t {
+        size_t              start;
+        size_t              size;
+        int                 free;
+        chunk_t*            prev;
+        chunk_t*            next;
+        chunk_t*            freePrev;
+        chunk_t*            freeNext;
+    };
+
+    struct stats_t {
+        uint64_t            numAllocs;
+        uint64_t            numFrees;
+        uint64_t            numFailures;
+        nsecs_t             allocTime;
+        nsecs_t             freeTime;
+        size_t              allocatedSize;
+        size_t              peakAllocatedSize;
+    };
+
+    static inline uint32_t hashStart(size_t start) {
+        return JenkinsHashWhiten(uint32_t(start));
+    }
+
+    static void mapping(size_t size, uint32_t* fl, uint32_t* sl);
+
+    ssize_t  alloc(size_t size, uint32_t flags);
+    chunk_t* dealloc(size_t start);
+    chunk_t* findFree(size_t size);
+    void     insertFree(chunk_t* chunk);
+    void     removeFree(chunk_t* chunk);
+    chunk_t* newChunk(size_t start, size_t size);
+    void     recycleChunk(chunk_t* chunk);
+    void     dump_l(String8& res, const char* what) const;
+
+    static const int    kMemoryAlign;
+    mutable Mutex       mLock;
+    LinkedList<chunk_t> mList;
+    chunk_t*            mFreeLists[FL_COUNT][SL_COUNT];
+    uint32_t            mFlBitmap;
+    uint32_t            mSlBitmaps[FL_COUNT];
+    FlatHashtable<uint32_t, chunk_t*> mAllocated;
+    chunk_t*            mSpareChunks;
+    size_t              mHeapSize;
+    stats_t             mStats;
+};
+
+// ----------------------------------------------------------------------------
+
 Allocation::Allocation(
         const sp<MemoryDealer>& dealer,
         const sp<IMemoryHeap>& heap, ssize_t offset, size_t size)
@@ -225,10 +321,15 @@ Allocation::~Allocation()
 
 // ----------------------------------------------------------------------------
 
-MemoryDealer::MemoryDealer(size_t size, const char* name, uint32_t flags)
-    : mHeap(new MemoryHeapBase(size, flags, name)),
-    mAllocator(new SimpleBestFitAllocator(size))
-{    
+MemoryDealer::MemoryDealer(size_t size, const char* name, uint32_t flags,
+        int allocator)
+    : mHeap(new MemoryHeapBase(size, flags, name))
+{
+    if (allocator == SEGREGATED_FIT) {
+        mAllocator = new SegregatedFitAllocator(size);
+    } else {
+        mAllocator = new SimpleBestFitAllocator(size);
+    }
 }
 
 MemoryDealer::~MemoryDealer()
@@ -260,7 +361,7 @@ const sp<IMemoryHeap>& MemoryDealer::heap() const {
     return mHeap;
 }
 
-SimpleBestFitAllocator* MemoryDealer::allocator() const {
+HeapAllocator* MemoryDealer::allocator() const {
     return mAllocator;
 }
 
@@ -464,5 +565,320 @@ void SimpleBestFitAllocator::dump_l(String8& result,
     result.append(buffer);
 }
 
+// ----------------------------------------------------------------------------
+
+// align all the memory blocks on a cache-line boundary
+const int SegregatedFitAllocator::kMemoryAlign = 32;
+
+SegregatedFitAllocator::SegregatedFitAllocator(size_t size)
+    : mFlBitmap(0), mSpareChunks(0)
+{
+    size_t pagesize = getpagesize();
+    mHeapSize = ((size + pagesize-1) & ~(pagesize-1));
+
+    memset(mFreeLists, 0, sizeof(mFreeLists));
+    memset(mSlBitmaps, 0, sizeof(mSlBitmaps));
+    memset(&mStats, 0, sizeof(mStats));
+
+    if (mHeapSize / kMemoryAlign) {
+        chunk_t* node = newChunk(0, mHeapSize / kMemoryAlign);
+        mList.insertHead(node);
+        insertFree(node);
+    }
+}
+
+SegregatedFitAllocator::~SegregatedFitAllocator()
+{
+    while (!mList.isEmpty()) {
+        delete mList.remove(mList.head());
+    }
+    while (mSpareChunks) {
+        chunk_t* next = mSpareChunks->next;
+        delete mSpareChunks;
+        mSpareChunks = next;
+    }
+}
+
+size_t SegregatedFitAllocator::size() const
+{
+    return mHeapSize;
+}
+
+size_t SegregatedFitAllocator::allocate(size_t size, uint32_t flags)
+{
+    Mutex::Autolock _l(mLock);
+    const nsecs_t start = systemTime();
+    ssize_t offset = alloc(size, flags);
+    mStats.allocTime += systemTime() - start;
+    if (offset >= 0) {
+        mStats.numAllocs++;
+    } else {
+        mStats.numFailures++;
+    }
+    return offset;
+}
+
+status_t SegregatedFitAllocator::deallocate(size_t offset)
+{
+    Mutex::Autolock _l(mLock);
+    const nsecs_t start = systemTime();
+    chunk_t const * const freed = dealloc(offset);
+    mStats.freeTime += systemTime() - start;
+    if (freed) {
+        mStats.numFrees++;
+        return NO_ERROR;
+    }
+    return NAME_NOT_FOUND;
+}
+
+void SegregatedFitAllocator::mapping(size_t size, uint32_t* fl, uint32_t* sl)
+{
+    if (size < SL_COUNT) {
+        *fl = 0;
+        *sl = size;
+    } else {
+        const uint32_t log2 = 31 - __builtin_clz(uint32_t(size));
+        *fl = log2 - SL_LOG2 + 1;
+        *sl = (size >> (log2 - SL_LOG2)) - SL_COUNT;
+    }
+}
+
+SegregatedFitAllocator::chunk_t* SegregatedFitAllocator::findFree(size_t size)
+{
+    // Round the request up to the next class boundary, so that any block
+    // of the class found is large enough.
+    uint32_t fl, sl;
+    size_t rounded = size;
+    if (size >= SL_COUNT) {
+        const uint32_t log2 = 31 - __builtin_clz(uint32_t(size));
+        rounded += (size_t(1) << (log2 - SL_LOG2)) - 1;
+    }
+    mapping(rounded, &fl, &sl);
+
+    if (fl < FL_COUNT) {
+        uint32_t slMap = mSlBitmaps[fl] & (~0U << sl);
+        if (!slMap) {
+            const uint32_t flMap = fl + 1 < FL_COUNT ? mFlBitmap & (~0U << (fl + 1)) : 0;
+            if (flMap) {
+                fl = __builtin_ctz(flMap);
+                slMap = mSlBitmaps[fl];
+            }
+        }
+        if (slMap) {
+            return mFreeLists[fl][__builtin_ctz(slMap)];
+        }
+    }
+
+    // Nothing in the larger classes; a block of the request's own class
+    // may still be large enough.
+    mapping(size, &fl, &sl);
+    for (chunk_t* cur = mFreeLists[fl][sl]; cur; cur = cur->freeNext) {
+        if (cur->size >= size) {
+            return cur;
+        }
+    }
+    return 0;
+}
+
+void SegregatedFitAllocator::insertFree(chunk_t* chunk)
+{
+    uint32_t fl, sl;
+    mapping(chunk->size, &fl, &sl);
+    chunk->free = 1;
+    chunk->freePrev = 0;
+    chunk->freeNext = mFreeLists[fl][sl];
+    if (chunk->freeNext) {
+        chunk->freeNext->freePrev = chunk;
+    }
+    mFreeLists[fl][sl] = chunk;
+    mSlBitmaps[fl] |= 1U << sl;
+    mFlBitmap |= 1U << fl;
+}
+
+void SegregatedFitAllocator::removeFree(chunk_t* chunk)
+{
+    uint32_t fl, sl;
+    mapping(chunk->size, &fl, &sl);
+    if (chunk->freePrev) {
+        chunk->freePrev->freeNext = chunk->freeNext;
+    } else {
+        mFreeLists[fl][sl] = chunk->freeNext;
+        if (!chunk->freeNext) {
+            mSlBitmaps[fl] &= ~(1U << sl);
+            if (!mSlBitmaps[fl]) {
+                mFlBitmap &= ~(1U << fl);
+            }
+        }
+    }
+    if (chunk->freeNext) {
+        chunk->freeNext->freePrev = chunk->freePrev;
+    }
+    chunk->free = 0;
+}
+
+SegregatedFitAllocator::chunk_t* SegregatedFitAllocator::newChunk(
+        size_t start, size_t size)
+{
+    chunk_t* chunk = mSpareChunks;
+    if (chunk) {
+        mSpareChunks = chunk->next;
+    } else {
+        chunk = new chunk_t;
+    }
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->start = start;
+    chunk->size = size;
+    return chunk;
+}
+
+void SegregatedFitAllocator::recycleChunk(chunk_t* chunk)
+{
+    chunk->next = mSpareChunks;
+    mSpareChunks = chunk;
+}
+
+ssize_t SegregatedFitAllocator::alloc(size_t size, uint32_t flags)
+{
+    if (size == 0) {
+        return 0;
+    }
+    if (size > mHeapSize) {
+        return NO_MEMORY;
+    }
+    size = (size + kMemoryAlign-1) / kMemoryAlign;
+
+    const size_t pageUnits = getpagesize() / kMemoryAlign;
+    size_t needed = size;
+    if (flags & PAGE_ALIGNED) {
+        needed += pageUnits - 1;
+    }
+
+    chunk_t* chunk = findFree(needed);
+    if (!chunk) {
+        return NO_MEMORY;
+    }
+
+    // Index the block before touching the free lists, so that running out
+    // of memory for the index leaves the heap as it was.
+    const size_t extra = (flags & PAGE_ALIGNED) ? (-chunk->start & (pageUnits-1)) : 0;
+    const size_t start = chunk->start + extra;
+    const ssize_t index = mAllocated.add(hashStart(start), start, chunk);
+    if (index < 0) {
+        return index;
+    }
+    removeFree(chunk);
+
+    // Free blocks never touch, so the pieces split off either end are
+    // next to allocated blocks and stay as they are.
+    if (extra) {
+        chunk_t* split = newChunk(chunk->start, extra);
+        chunk->start += extra;
+        chunk->size -= extra;
+        mList.insertBefore(chunk, split);
+        insertFree(split);
+    }
+    if (chunk->size > size) {
+        chunk_t* split = newChunk(chunk->start + size, chunk->size - size);
+        chunk->size = size;
+        mList.insertAfter(chunk, split);
+        insertFree(split);
+    }
+
+    mStats.allocatedSize += chunk->size * kMemoryAlign;
+    if (mStats.allocatedSize > mStats.peakAllocatedSize) {
+        mStats.peakAllocatedSize = mStats.allocatedSize;
+    }
+    return chunk->start * kMemoryAlign;
+}
+
+SegregatedFitAllocator::chunk_t* SegregatedFitAllocator::dealloc(size_t start)
+{
+    start = start / kMemoryAlign;
+    const ssize_t index = mAllocated.find(hashStart(start), start);
+    if (index < 0) {
+        return 0;
+    }
+    chunk_t* freed = mAllocated.valueAt(index);
+    mAllocated.removeAt(index);
+    mStats.allocatedSize -= freed->size * kMemoryAlign;
+
+    // merge freed blocks together
+    chunk_t* const p = freed->prev;
+    if (p && p->free) {
+        removeFree(p);
+        p->size += freed->size;
+        recycleChunk(mList.remove(freed));
+        freed = p;
+    }
+    chunk_t* const n = freed->next;
+    if (n && n->free) {
+        removeFree(n);
+        freed->size += n->size;
+        recycleChunk(mList.remove(n));
+    }
+    insertFree(freed);
+    return freed;
+}
+
+void SegregatedFitAllocator::dump(const char* what) const
+{
+    String8 result;
+    dump(result, what);
+    LOGD("%s", result.string());
+}
+
+void SegregatedFitAllocator::dump(String8& result,
+        const char* what) const
+{
+    Mutex::Autolock _l(mLock);
+    dump_l(result, what);
+}
+
+void SegregatedFitAllocator::dump_l(String8& result,
+        const char* what) const
+{
+    size_t freeSize = 0;
+    size_t largestFree = 0;
+    size_t numFree = 0;
+    int32_t i = 0;
+
+    result.appendFormat("  %s (%p, size=%u, segregated fit)\n",
+            what, this, (unsigned int)mHeapSize);
+
+    for (chunk_t const* cur = mList.head(); cur; cur = cur->next, i++) {
+        result.appendFormat("  %3u: %p | 0x%08X | 0x%08X | %s\n",
+                i, cur, int(cur->start*kMemoryAlign),
+                int(cur->size*kMemoryAlign), cur->free ? "F" : "A");
+        if (cur->free) {
+            const size_t size = cur->size*kMemoryAlign;
+            freeSize += size;
+            numFree++;
+            if (size > largestFree) {
+                largestFree = size;
+            }
+        }
+    }
+
+    // Fragmentation is the share of free memory outside the largest free
+    // block, i.e. unusable for a request that needs all of it.
+    const unsigned int fragmentation = freeSize ?
+            (unsigned int)(100 - uint64_t(largestFree) * 100 / freeSize) : 0;
+    result.appendFormat("  size allocated: %u (%u KB), peak %u (%u KB)\n",
+            int(mStats.allocatedSize), int(mStats.allocatedSize/1024),
+            int(mStats.peakAllocatedSize), int(mStats.peakAllocatedSize/1024));
+    result.appendFormat("  %u live allocations, %u free blocks, largest free %u, "
+            "fragmentation %u%%\n",
+            (unsigned int)mAllocated.size(), (unsigned int)numFree,
+            (unsigned int)largestFree, fragmentation);
+    const uint64_t numAllocCalls = mStats.numAllocs + mStats.numFailures;
+    result.appendFormat("  %llu allocations (%llu failed) at %lld ns avg, "
+            "%llu frees at %lld ns avg\n",
+            (unsigned long long)mStats.numAllocs,
+            (unsigned long long)mStats.numFailures,
+            (long long)(numAllocCalls ? mStats.allocTime / nsecs_t(numAllocCalls) : 0),
+            (unsigned long long)mStats.numFrees,
+            (long long)(mStats.numFrees ? mStats.freeTime / nsecs_t(mStats.numFrees) : 0));
+}
+
 
 }; // namespace android
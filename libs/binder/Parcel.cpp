@@ -614,12 +614,17 @@ bool Parcel::enforceInterface(const String16& interface,
     } else {
       threadState->setStrictModePolicy(strictPolicy);
     }
-    const String16 str(readString16());
-    if (str == interface) {
+    // Compare in place rather than copying the token into a String16 on
+    // every transaction.
+    size_t len;
+    const char16_t* str = readString16Inplace(&len);
+    if (len == interface.size() && (len == 0
+            || memcmp(str, interface.string(), len * sizeof(char16_t)) == 0)) {
         return true;
     } else {
         LOGW("**** enforceInterface() expected '%s' but read '%s'",
-                String8(interface).string(), String8(str).string());
+                String8(interface).string(),
+                str != NULL ? String8(str, len).string() : "");
         return false;
     }
 }
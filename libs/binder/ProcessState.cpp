@@ -17,10 +17,12 @@
 #define LOG_TAG "ProcessState"
 
 #include <cutils/process_name.h>
+#include <cutils/properties.h>
 
 #include <binder/ProcessState.h>
 
 #include <utils/Atomic.h>
+#include <binder/BinderTrace.h>
 #include <binder/BpBinder.h>
 #include <binder/IPCThreadState.h>
 #include <utils/Log.h>
@@ -36,6 +38,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -336,6 +339,28 @@ static int open_driver()
     return fd;
 }
 
+// On debuggable builds, setting debug.binder.trace_dir to a directory makes
+// every process that opens the driver afterwards record its binder commands
+// to <dir>/binder-<pid>.trace, which the process must be able to create.
+static void start_trace()
+{
+    char dir[PROPERTY_VALUE_MAX];
+    char debuggable[PROPERTY_VALUE_MAX];
+    if (property_get("debug.binder.trace_dir", dir, NULL) <= 0) {
+        return;
+    }
+    property_get("ro.debuggable", debuggable, "0");
+    if (strcmp(debuggable, "1") != 0) {
+        LOGW("Ignoring debug.binder.trace_dir on a non-debuggable build");
+        return;
+    }
+    String8 path = String8::format("%s/binder-%d.trace", dir, getpid());
+    status_t err = BinderTrace::start(path.string());
+    if (err != NO_ERROR) {
+        LOGW("Unable to record binder trace to %s: %s", path.string(), strerror(-err));
+    }
+}
+
 ProcessState::ProcessState()
     : mDriverFD(open_driver())
     , mVMStart(MAP_FAILED)
@@ -368,6 +393,8 @@ ProcessState::ProcessState()
     }
 
     LOG_ALWAYS_FATAL_IF(mDriverFD < 0, "Binder driver could not be opened.  Terminating.");
+
+    start_trace();
 }
 
 ProcessState::~ProcessState()
@@ -34,7 +34,7 @@ Vector<int32_t> gTextBuffers;
 class LogTextOutput : public BufferedTextOutput
 {
 public:
-    LogTextOutput() : BufferedTextOutput(MULTITHREADED) { }
+    LogTextOutput(uint32_t flags = MULTITHREADED) : BufferedTextOutput(flags) { }
     virtual ~LogTextOutput() { };
 
 protected:
@@ -64,13 +64,24 @@ private:
     int mFD;
 };
 
+// Command logging in IPCThreadState runs around every driver round trip,
+// so its lines are queued and written by a background thread instead.
+class AsyncLogTextOutput : public LogTextOutput
+{
+public:
+    AsyncLogTextOutput() : LogTextOutput(MULTITHREADED | ASYNC) { }
+    virtual ~AsyncLogTextOutput() { stopAsync(); }
+};
+
 static LogTextOutput gLogTextOutput;
+static AsyncLogTextOutput gCommandLogTextOutput;
 static FdTextOutput gStdoutTextOutput(STDOUT_FILENO);
 static FdTextOutput gStderrTextOutput(STDERR_FILENO);
 
 TextOutput& alog(gLogTextOutput);
 TextOutput& aout(gStdoutTextOutput);
 TextOutput& aerr(gStderrTextOutput);
+TextOutput& gCommandLog(gCommandLogTextOutput);
 
 // ------------ ProcessState.cpp
 
@@ -18,6 +18,7 @@ LOCAL_PATH:= $(call my-dir)
 # and once for the device.
 
 commonSources:= \
+	CompiledPropertyMap.cpp \
 	LinearTransform.cpp \
 	ObbFile.cpp \
 	PropertyMap.cpp \
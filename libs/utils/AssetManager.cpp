@@ -1373,6 +1373,12 @@ SortedVector<AssetDir::FileInfo>* AssetManager::scanDirLocked(const String8& pat
 
     pContents = new SortedVector<AssetDir::FileInfo>;
 
+    /*
+     * readdir() order is arbitrary, so collect everything first and sort
+     * once rather than inserting each entry in place.
+     */
+    Vector<AssetDir::FileInfo> entries;
+
     while (1) {
         entry = readdir(dir);
         if (entry == NULL)
@@ -1402,10 +1408,11 @@ SortedVector<AssetDir::FileInfo>* AssetManager::scanDirLocked(const String8& pat
         if (strcasecmp(info.getFileName().getPathExtension().string(), ".gz") == 0)
             info.setFileName(info.getFileName().getBasePath());
         info.setSourceName(path.appendPathCopy(info.getFileName()));
-        pContents->add(info);
+        entries.add(info);
     }
 
     closedir(dir);
+    pContents->merge(entries);
     return pContents;
 }
 
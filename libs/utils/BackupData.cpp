@@ -19,8 +19,12 @@
 #include <utils/BackupHelpers.h>
 #include <utils/ByteOrder.h>
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <cutils/log.h>
@@ -56,11 +60,15 @@ padding_extra(size_t n)
     return ROUND_UP[n % 4];
 }
 
+// Readers fill a buffer this big, and hand out entities that fit in it in place.
+static const size_t READ_BUFFER_SIZE = 64 * 1024;
+
 BackupDataWriter::BackupDataWriter(int fd)
     :m_fd(fd),
      m_status(NO_ERROR),
      m_pos(0),
-     m_entityCount(0)
+     m_entityCount(0),
+     m_canSendfile(true)
 {
 }
 
@@ -68,23 +76,32 @@ BackupDataWriter::~BackupDataWriter()
 {
 }
 
-// Pad out anything they've previously written to the next 4 byte boundary.
+static const uint32_t PADDING = 0xbcbcbcbc;
+
+// Write all of the vectors, picking up after short writes.  The vectors are
+// modified.
 status_t
-BackupDataWriter::write_padding_for(int n)
+BackupDataWriter::write_vectors(struct iovec* iov, int count)
 {
-    ssize_t amt;
-    ssize_t paddingSize;
-
-    paddingSize = padding_extra(n);
-    if (paddingSize > 0) {
-        uint32_t padding = 0xbcbcbcbc;
-        if (DEBUG) LOGI("writing %d padding bytes for %d", paddingSize, n);
-        amt = write(m_fd, &padding, paddingSize);
-        if (amt != paddingSize) {
+    while (count > 0) {
+        ssize_t amt = writev(m_fd, iov, count);
+        if (amt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             m_status = errno;
             return m_status;
         }
         m_pos += amt;
+        while (count > 0 && (size_t)amt >= iov->iov_len) {
+            amt -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + amt;
+            iov->iov_len -= amt;
+        }
     }
     return NO_ERROR;
 }
@@ -96,13 +113,6 @@ BackupDataWriter::WriteEntityHeader(const String8& key, size_t dataSize)
         return m_status;
     }
 
-    ssize_t amt;
-
-    amt = write_padding_for(m_pos);
-    if (amt != 0) {
-        return amt;
-    }
-
     String8 k;
     if (m_keyPrefix.length() > 0) {
         k = m_keyPrefix;
@@ -125,27 +135,36 @@ BackupDataWriter::WriteEntityHeader(const String8& key, size_t dataSize)
     header.keyLen = tolel(keyLen);
     header.dataSize = tolel(dataSize);
 
-    if (DEBUG) LOGI("writing entity header, %d bytes", sizeof(entity_header_v1));
-    amt = write(m_fd, &header, sizeof(entity_header_v1));
-    if (amt != sizeof(entity_header_v1)) {
-        m_status = errno;
-        return m_status;
+    // Pad out anything they've previously written to the next 4 byte boundary,
+    // then write the header and the key, padded the same way, all at once.
+    struct iovec iov[4];
+    int count = 0;
+    if (padding_extra(m_pos) > 0) {
+        iov[count].iov_base = (void*)&PADDING;
+        iov[count].iov_len = padding_extra(m_pos);
+        count++;
     }
-    m_pos += amt;
-
-    if (DEBUG) LOGI("writing entity header key, %d bytes", keyLen+1);
-    amt = write(m_fd, k.string(), keyLen+1);
-    if (amt != keyLen+1) {
-        m_status = errno;
-        return m_status;
+    iov[count].iov_base = &header;
+    iov[count].iov_len = sizeof(entity_header_v1);
+    count++;
+    iov[count].iov_base = (void*)k.string();
+    iov[count].iov_len = keyLen+1;
+    count++;
+    if (padding_extra(keyLen+1) > 0) {
+        iov[count].iov_base = (void*)&PADDING;
+        iov[count].iov_len = padding_extra(keyLen+1);
+        count++;
     }
-    m_pos += amt;
 
-    amt = write_padding_for(keyLen+1);
+    if (DEBUG) LOGI("writing entity header and key, %d vectors", count);
+    status_t err = write_vectors(iov, count);
+    if (err != NO_ERROR) {
+        return err;
+    }
 
     m_entityCount++;
 
-    return amt;
+    return NO_ERROR;
 }
 
 status_t
@@ -173,6 +192,78 @@ BackupDataWriter::WriteEntityData(const void* data, size_t size)
     return NO_ERROR;
 }
 
+status_t
+BackupDataWriter::WriteEntityDataFromFd(int fd, size_t size, size_t* copied)
+{
+    if (DEBUG) LOGD("Writing data from fd %d: size=%lu", fd, (unsigned long) size);
+
+    *copied = 0;
+    if (m_status != NO_ERROR) {
+        return m_status;
+    }
+
+    while (*copied < size && m_canSendfile) {
+        ssize_t amt = sendfile(m_fd, fd, NULL, size - *copied);
+        if (amt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS) {
+                // Older kernels only send to sockets; copy through a buffer instead.
+                m_canSendfile = false;
+                break;
+            }
+            // We can't tell which side failed; leave poisoning to the next write.
+            return errno;
+        }
+        if (amt == 0) {
+            return NO_ERROR;
+        }
+        *copied += amt;
+        m_pos += amt;
+    }
+
+    return copy_through_buffer(fd, size, copied);
+}
+
+status_t
+BackupDataWriter::copy_through_buffer(int fd, size_t size, size_t* copied)
+{
+    const size_t BUFSIZE = 64 * 1024;
+    char* buf = NULL;
+    status_t err = NO_ERROR;
+
+    while (*copied < size) {
+        if (buf == NULL) {
+            buf = (char*)malloc(BUFSIZE);
+            if (buf == NULL) {
+                err = NO_MEMORY;
+                break;
+            }
+        }
+        size_t toRead = size - *copied < BUFSIZE ? size - *copied : BUFSIZE;
+        ssize_t amt = read(fd, buf, toRead);
+        if (amt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err = errno;
+            break;
+        }
+        if (amt == 0) {
+            break;
+        }
+        err = WriteEntityData(buf, amt);
+        if (err != NO_ERROR) {
+            break;
+        }
+        *copied += amt;
+    }
+
+    free(buf);
+    return err;
+}
+
 void
 BackupDataWriter::SetKeyPrefix(const String8& keyPrefix)
 {
@@ -185,13 +276,20 @@ BackupDataReader::BackupDataReader(int fd)
      m_done(false),
      m_status(NO_ERROR),
      m_pos(0),
-     m_entityCount(0)
+     m_entityCount(0),
+     m_bufPos(0),
+     m_bufEnd(0)
 {
     memset(&m_header, 0, sizeof(m_header));
+    m_buf = (char*)malloc(READ_BUFFER_SIZE);
+    if (m_buf == NULL) {
+        m_status = ENOMEM;
+    }
 }
 
 BackupDataReader::~BackupDataReader()
 {
+    free(m_buf);
 }
 
 status_t
@@ -200,20 +298,6 @@ BackupDataReader::Status()
     return m_status;
 }
 
-#define CHECK_SIZE(actual, expected) \
-    do { \
-        if ((actual) != (expected)) { \
-            if ((actual) == 0) { \
-                m_status = EIO; \
-                m_done = true; \
-            } else { \
-                m_status = errno; \
-                LOGD("CHECK_SIZE(a=%ld e=%ld) failed at line %d m_status='%s'", \
-                    long(actual), long(expected), __LINE__, strerror(m_status)); \
-            } \
-            return m_status; \
-        } \
-    } while(0)
 #define SKIP_PADDING() \
     do { \
         status_t err = skip_padding(); \
@@ -224,6 +308,86 @@ BackupDataReader::Status()
         } \
     } while(0)
 
+// Make at least 'size' bytes, which must fit in the buffer, available in it
+// unless the stream ends first.  Returns the number of bytes available, or -1
+// with m_status set on error.
+ssize_t
+BackupDataReader::fill(size_t size)
+{
+    if (m_bufEnd - m_bufPos >= size) {
+        return m_bufEnd - m_bufPos;
+    }
+
+    if (m_bufPos > 0) {
+        memmove(m_buf, m_buf + m_bufPos, m_bufEnd - m_bufPos);
+        m_bufEnd -= m_bufPos;
+        m_bufPos = 0;
+    }
+    while (m_bufEnd < size) {
+        ssize_t amt = read(m_fd, m_buf + m_bufEnd, READ_BUFFER_SIZE - m_bufEnd);
+        if (amt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            m_status = errno;
+            return -1;
+        }
+        if (amt == 0) {
+            break;
+        }
+        m_bufEnd += amt;
+    }
+    return m_bufEnd;
+}
+
+// Read exactly 'size' bytes, from the buffer first.  Running out of data is an
+// error.
+status_t
+BackupDataReader::read_fully(void* data, size_t size)
+{
+    size_t amt = m_bufEnd - m_bufPos;
+    if (amt > size) {
+        amt = size;
+    }
+    memcpy(data, m_buf + m_bufPos, amt);
+    consume(amt);
+    data = (char*)data + amt;
+    size -= amt;
+
+    while (size > 0) {
+        ssize_t got;
+        if (size <= READ_BUFFER_SIZE) {
+            got = fill(size);
+            if (got > (ssize_t)size) {
+                got = size;
+            }
+            memcpy(data, m_buf + m_bufPos, got > 0 ? got : 0);
+            consume(got > 0 ? got : 0);
+        } else {
+            got = read(m_fd, data, size);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                m_status = errno;
+            } else {
+                m_pos += got;
+            }
+        }
+        if (got < 0) {
+            return m_status;
+        }
+        if (got == 0) {
+            m_status = EIO;
+            m_done = true;
+            return m_status;
+        }
+        data = (char*)data + got;
+        size -= got;
+    }
+    return NO_ERROR;
+}
+
 status_t
 BackupDataReader::ReadNextHeader(bool* done, int* type)
 {
@@ -242,13 +406,21 @@ BackupDataReader::ReadNextHeader(bool* done, int* type)
     else if (amt != NO_ERROR) {
         return amt;
     }
-    amt = read(m_fd, &m_header, sizeof(m_header));
-    *done = m_done = (amt == 0);
+    ssize_t avail = fill(sizeof(m_header));
+    if (avail < 0) {
+        return m_status;
+    }
+    *done = m_done = (avail == 0);
     if (*done) {
         return NO_ERROR;
     }
-    CHECK_SIZE(amt, sizeof(m_header));
-    m_pos += sizeof(m_header);
+    if (avail < (ssize_t)sizeof(m_header)) {
+        LOGD("Chunk header at %d is truncated", (int)m_pos);
+        m_status = EIO;
+        return m_status;
+    }
+    memcpy(&m_header, m_buf + m_bufPos, sizeof(m_header));
+    consume(sizeof(m_header));
     if (type) {
         *type = m_header.type;
     }
@@ -264,6 +436,7 @@ BackupDataReader::ReadNextHeader(bool* done, int* type)
                 LOGD("Entity header at %d has keyLen<=0: 0x%08x\n", (int)m_pos,
                         (int)m_header.entity.keyLen);
                 m_status = EINVAL;
+                return m_status;
             }
             m_header.entity.dataSize = fromlel(m_header.entity.dataSize);
             m_entityCount++;
@@ -275,10 +448,11 @@ BackupDataReader::ReadNextHeader(bool* done, int* type)
                 m_status = ENOMEM;
                 return m_status;
             }
-            int amt = read(m_fd, buf, size+1);
-            CHECK_SIZE(amt, (int)size+1);
+            status_t err = read_fully(buf, size+1);
             m_key.unlockBuffer(size);
-            m_pos += size+1;
+            if (err != NO_ERROR) {
+                return err;
+            }
             SKIP_PADDING();
             m_dataEndPos = m_pos + m_header.entity.dataSize;
 
@@ -322,10 +496,32 @@ BackupDataReader::SkipEntityData()
     if (m_header.type != BACKUP_HEADER_ENTITY_V1) {
         return EINVAL;
     }
-    if (m_header.entity.dataSize > 0) {
-        int pos = lseek(m_fd, m_dataEndPos, SEEK_SET);
-        if (pos == -1) {
-            return errno;
+    if (m_header.entity.dataSize > 0 && m_dataEndPos > m_pos) {
+        size_t skip = m_dataEndPos - m_pos;
+        size_t buffered = m_bufEnd - m_bufPos;
+        if (buffered > skip) {
+            buffered = skip;
+        }
+        consume(buffered);
+        skip -= buffered;
+
+        if (skip > 0) {
+            if (lseek(m_fd, skip, SEEK_CUR) != -1) {
+                m_pos += skip;
+            } else if (errno == ESPIPE) {
+                // Can't seek a pipe; read through the data instead.
+                while (skip > 0) {
+                    ssize_t avail = fill(1);
+                    if (avail <= 0) {
+                        return avail < 0 ? m_status : EIO;
+                    }
+                    size_t amt = (size_t)avail < skip ? avail : skip;
+                    consume(amt);
+                    skip -= amt;
+                }
+            } else {
+                return errno;
+            }
         }
     }
     SKIP_PADDING();
@@ -347,35 +543,135 @@ BackupDataReader::ReadEntityData(void* data, size_t size)
     if (((int)size) > remaining) {
         size = remaining;
     }
-    //LOGD("   reading %d bytes", size);
-    int amt = read(m_fd, data, size);
-    if (amt < 0) {
-        m_status = errno;
-        return -1;
+
+    // Return what's buffered first.
+    size_t total = m_bufEnd - m_bufPos;
+    if (total > size) {
+        total = size;
     }
-    if (amt == 0) {
-        m_status = EIO;
-        m_done = true;
+    memcpy(data, m_buf + m_bufPos, total);
+    consume(total);
+
+    // Read the rest into the caller's memory, and read ahead into the now
+    // empty buffer in the same call.  Stop short only at the end of the
+    // stream or on an error.
+    while (total < size) {
+        const size_t wanted = size - total;
+        //LOGD("   reading %d bytes", wanted);
+        struct iovec iov[2];
+        iov[0].iov_base = (char*)data + total;
+        iov[0].iov_len = wanted;
+        iov[1].iov_base = m_buf;
+        iov[1].iov_len = READ_BUFFER_SIZE;
+        ssize_t amt = readv(m_fd, iov, 2);
+        if (amt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            m_status = errno;
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        if (amt == 0) {
+            m_status = EIO;
+            m_done = true;
+            break;
+        }
+        m_bufPos = 0;
+        m_bufEnd = 0;
+        if ((size_t)amt > wanted) {
+            m_bufEnd = amt - wanted;
+            amt = wanted;
+        }
+        m_pos += amt;
+        total += amt;
     }
-    m_pos += amt;
-    return amt;
+    return total;
 }
 
 status_t
 BackupDataReader::skip_padding()
 {
-    ssize_t amt;
     ssize_t paddingSize;
 
     paddingSize = padding_extra(m_pos);
     if (paddingSize > 0) {
-        uint32_t padding;
-        amt = read(m_fd, &padding, paddingSize);
-        CHECK_SIZE(amt, paddingSize);
-        m_pos += amt;
+        ssize_t amt = fill(paddingSize);
+        if (amt < 0) {
+            return m_status;
+        }
+        if (amt < paddingSize) {
+            m_status = EIO;
+            m_done = (amt == 0);
+            return m_status;
+        }
+        consume(paddingSize);
     }
     return NO_ERROR;
 }
 
+BackupDataReader::EntityIterator::EntityIterator(BackupDataReader* reader)
+    :m_reader(reader),
+     m_status(NO_ERROR),
+     m_data(NULL),
+     m_dataSize(0),
+     m_buf(NULL),
+     m_bufSize(0)
+{
+}
+
+BackupDataReader::EntityIterator::~EntityIterator()
+{
+    free(m_buf);
+}
+
+bool
+BackupDataReader::EntityIterator::next()
+{
+    m_data = NULL;
+    m_dataSize = 0;
+    if (m_status != NO_ERROR) {
+        return false;
+    }
+
+    bool done;
+    m_status = m_reader->ReadNextHeader(&done, NULL);
+    if (m_status != NO_ERROR || done) {
+        return false;
+    }
+
+    ssize_t size = m_reader->m_header.entity.dataSize;
+    if (size > 0 && (size_t)size <= READ_BUFFER_SIZE) {
+        // Hand out the data where it lies in the reader's buffer.
+        ssize_t avail = m_reader->fill(size);
+        if (avail < size) {
+            if (avail >= 0) {
+                m_reader->m_status = EIO;
+                m_reader->m_done = true;
+            }
+            m_status = m_reader->m_status;
+            return false;
+        }
+        m_data = m_reader->m_buf + m_reader->m_bufPos;
+        m_reader->consume(size);
+    } else if (size > 0) {
+        if ((size_t)size > m_bufSize) {
+            void* buf = realloc(m_buf, size);
+            if (buf == NULL) {
+                m_status = ENOMEM;
+                return false;
+            }
+            m_buf = buf;
+            m_bufSize = size;
+        }
+        m_status = m_reader->read_fully(m_buf, size);
+        if (m_status != NO_ERROR) {
+            return false;
+        }
+        m_data = m_buf;
+    }
+    m_dataSize = size;
+    return true;
+}
+
 
 } // namespace android
@@ -18,9 +18,11 @@
 
 #include <utils/BackupHelpers.h>
 
+#include <utils/Atomic.h>
 #include <utils/KeyedVector.h>
 #include <utils/ByteOrder.h>
 #include <utils/String8.h>
+#include <utils/Thread.h>
 
 #include <errno.h>
 #include <sys/types.h>
@@ -40,6 +42,14 @@ namespace android {
 
 #define MAGIC0 0x70616e53 // Snap
 #define MAGIC1 0x656c6946 // File
+#define MAGIC1_V2 0x326c6946 // Fil2
+
+/*
+ * Snapshot files start with a SnapshotHeader, then hold a FileState and the
+ * padded file name of each file.  In snapshots with MAGIC1_V2, written by
+ * back_up_files() with BACKUP_FILES_TRUST_METADATA, each FileState is followed
+ * by the 64-bit inode number of the file.
+ */
 
 /*
  * File entity data format (v1):
@@ -87,7 +97,8 @@ round_up(int n)
 }
 
 static int
-read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
+read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot,
+        KeyedVector<String8,int64_t>* inodes = NULL)
 {
     int bytesRead = 0;
     int amt;
@@ -99,7 +110,7 @@ read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
     }
     bytesRead += amt;
 
-    if (header.magic0 != MAGIC0 || header.magic1 != MAGIC1) {
+    if (header.magic0 != MAGIC0 || (header.magic1 != MAGIC1 && header.magic1 != MAGIC1_V2)) {
         LOGW("read_snapshot_file header.magic0=0x%08x magic1=0x%08x", header.magic0, header.magic1);
         return 1;
     }
@@ -115,6 +126,16 @@ read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
         }
         bytesRead += amt;
 
+        int64_t inode = 0;
+        if (header.magic1 == MAGIC1_V2) {
+            amt = read(fd, &inode, sizeof(inode));
+            if (amt != sizeof(inode)) {
+                LOGW("read_snapshot_file inode truncated/error with read at %d bytes\n", bytesRead);
+                return 1;
+            }
+            bytesRead += amt;
+        }
+
         // filename is not NULL terminated, but it is padded
         int nameBufSize = round_up(file.nameLen);
         char* filename = nameBufSize <= (int)sizeof(filenameBuf)
@@ -122,7 +143,11 @@ read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
                 : (char*)malloc(nameBufSize);
         amt = read(fd, filename, nameBufSize);
         if (amt == nameBufSize) {
-            snapshot->add(String8(filename, file.nameLen), file);
+            String8 name(filename, file.nameLen);
+            snapshot->add(name, file);
+            if (inodes != NULL && header.magic1 == MAGIC1_V2) {
+                inodes->add(name, inode);
+            }
         }
         bytesRead += amt;
         if (filename != filenameBuf) {
@@ -144,8 +169,9 @@ read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
 }
 
 static int
-write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
+write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot, bool withInodes = false)
 {
+    const int stateSize = sizeof(FileState) + (withInodes ? sizeof(int64_t) : 0);
     int fileCount = 0;
     int bytesWritten = sizeof(SnapshotHeader);
     // preflight size
@@ -154,7 +180,7 @@ write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
         const FileRec& g = snapshot.valueAt(i);
         if (!g.deleted) {
             const String8& name = snapshot.keyAt(i);
-            bytesWritten += sizeof(FileState) + round_up(name.length());
+            bytesWritten += stateSize + round_up(name.length());
             fileCount++;
         }
     }
@@ -162,7 +188,7 @@ write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
     LOGP("write_snapshot_file fd=%d\n", fd);
 
     int amt;
-    SnapshotHeader header = { MAGIC0, fileCount, MAGIC1, bytesWritten };
+    SnapshotHeader header = { MAGIC0, fileCount, withInodes ? MAGIC1_V2 : MAGIC1, bytesWritten };
 
     amt = write(fd, &header, sizeof(header));
     if (amt != sizeof(header)) {
@@ -182,6 +208,14 @@ write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
                 return 1;
             }
 
+            if (withInodes) {
+                amt = write(fd, &r.inode, sizeof(r.inode));
+                if (amt != sizeof(r.inode)) {
+                    LOGW("write_snapshot_file error writing inode %s", strerror(errno));
+                    return 1;
+                }
+            }
+
             // filename is not NULL terminated, but it is padded
             amt = write(fd, name.string(), nameLen);
             if (amt != nameLen) {
@@ -213,11 +247,11 @@ write_delete_file(BackupDataWriter* dataStream, const String8& key)
 
 static int
 write_update_file(BackupDataWriter* dataStream, int fd, int mode, const String8& key,
-        char const* realFilename)
+        char const* realFilename, int* outCrc)
 {
     LOGP("write_update_file %s (%s) : mode 0%o\n", realFilename, key.string(), mode);
 
-    const int bufsize = 4*1024;
+    const int bufsize = 64*1024;
     int err;
     int amt;
     int fileSize;
@@ -253,8 +287,9 @@ write_update_file(BackupDataWriter* dataStream, int fd, int mode, const String8&
     }
     bytesLeft -= sizeof(metadata); // bytesLeft should == fileSize now
 
-    // now store the file content
-    while ((amt = read(fd, buf, bufsize)) != 0 && bytesLeft > 0) {
+    // now store the file content, checksumming it on the way so the snapshot
+    // doesn't need to read the file again
+    while ((amt = read(fd, buf, bufsize)) > 0 && bytesLeft > 0) {
         bytesLeft -= amt;
         if (bytesLeft < 0) {
             amt += bytesLeft; // Plus a negative is minus.  Don't write more than we promised.
@@ -264,6 +299,7 @@ write_update_file(BackupDataWriter* dataStream, int fd, int mode, const String8&
             free(buf);
             return err;
         }
+        crc = crc32(crc, (Bytef*)buf, amt);
     }
     if (bytesLeft != 0) {
         if (bytesLeft > 0) {
@@ -285,11 +321,13 @@ write_update_file(BackupDataWriter* dataStream, int fd, int mode, const String8&
     }
 
     free(buf);
+    *outCrc = crc;
     return NO_ERROR;
 }
 
 static int
-write_update_file(BackupDataWriter* dataStream, const String8& key, char const* realFilename)
+write_update_file(BackupDataWriter* dataStream, const String8& key, char const* realFilename,
+        int* outCrc)
 {
     int err;
     struct stat st;
@@ -304,43 +342,138 @@ write_update_file(BackupDataWriter* dataStream, const String8& key, char const*
         return errno;
     }
 
-    err = write_update_file(dataStream, fd, st.st_mode, key, realFilename);
+    err = write_update_file(dataStream, fd, st.st_mode, key, realFilename, outCrc);
     close(fd);
     return err;
 }
 
 static int
-compute_crc32(int fd)
+compute_crc32(int fd, char* buf, int bufsize)
 {
-    const int bufsize = 4*1024;
     int amt;
-
-    char* buf = (char*)malloc(bufsize);
     int crc = crc32(0L, Z_NULL, 0);
 
     lseek(fd, 0, SEEK_SET);
 
-    while ((amt = read(fd, buf, bufsize)) != 0) {
+    while ((amt = read(fd, buf, bufsize)) > 0) {
         crc = crc32(crc, (Bytef*)buf, amt);
     }
 
-    free(buf);
     return crc;
 }
 
+static inline int
+mtime_nsec(const struct stat& st)
+{
+#ifdef HAVE_ANDROID_OS
+    return st.st_mtime_nsec;
+#else
+    return st.st_mtim.tv_nsec;
+#endif
+}
+
+static inline bool
+same_metadata(const FileState& a, const FileState& b, bool compareNsec)
+{
+    return a.modTime_sec == b.modTime_sec
+            && (!compareNsec || a.modTime_nsec == b.modTime_nsec)
+            && a.mode == b.mode && a.size == b.size;
+}
+
+enum {
+    CRC_BUFFER_SIZE = 256*1024,
+    MAX_CRC_THREADS = 4,
+};
+
+struct CrcJob {
+    const char* path;
+    int crc;
+    bool opened;
+};
+
+static void
+run_crc_jobs(CrcJob* jobs, int count, volatile int32_t* next)
+{
+    char* buf = (char*)malloc(CRC_BUFFER_SIZE);
+    if (buf == NULL) {
+        return;
+    }
+
+    int i;
+    while ((i = android_atomic_inc(next)) < count) {
+        CrcJob& job = jobs[i];
+        int fd = open(job.path, O_RDONLY);
+        job.opened = fd != -1;
+        if (job.opened) {
+            job.crc = compute_crc32(fd, buf, CRC_BUFFER_SIZE);
+            close(fd);
+        }
+    }
+
+    free(buf);
+}
+
+class CrcThread : public Thread
+{
+public:
+    CrcThread(CrcJob* jobs, int count, volatile int32_t* next)
+        : Thread(false), mJobs(jobs), mCount(count), mNext(next) {
+    }
+
+private:
+    virtual bool threadLoop() {
+        run_crc_jobs(mJobs, mCount, mNext);
+        return false;
+    }
+
+    CrcJob* mJobs;
+    int mCount;
+    volatile int32_t* mNext;
+};
+
+// Checksums the files of all jobs, on up to MAX_CRC_THREADS threads including
+// the calling one.  Jobs whose file can't be opened are left with opened false.
+static void
+compute_crc32s(CrcJob* jobs, int count)
+{
+    for (int i=0; i<count; i++) {
+        jobs[i].opened = false;
+    }
+
+    volatile int32_t next = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_CRC_THREADS) threads = MAX_CRC_THREADS;
+    if (threads > count) threads = count;
+
+    Vector<sp<CrcThread> > workers;
+    for (long i=1; i<threads; i++) {
+        sp<CrcThread> worker = new CrcThread(jobs, count, &next);
+        if (worker->run("BackupCrc") == NO_ERROR) {
+            workers.add(worker);
+        }
+    }
+    run_crc_jobs(jobs, count, &next);
+    for (size_t i=0; i<workers.size(); i++) {
+        workers[i]->join();
+    }
+}
+
 int
 back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD,
-        char const* const* files, char const* const* keys, int fileCount)
+        char const* const* files, char const* const* keys, int fileCount, int flags)
 {
     int err;
+    const bool trustMetadata = (flags & BACKUP_FILES_TRUST_METADATA) != 0;
     KeyedVector<String8,FileState> oldSnapshot;
+    KeyedVector<String8,int64_t> oldInodes;
     KeyedVector<String8,FileRec> newSnapshot;
 
     if (oldSnapshotFD != -1) {
-        err = read_snapshot_file(oldSnapshotFD, &oldSnapshot);
+        err = read_snapshot_file(oldSnapshotFD, &oldSnapshot, &oldInodes);
         if (err != 0) {
             // On an error, treat this as a full backup.
             oldSnapshot.clear();
+            oldInodes.clear();
         }
     }
 
@@ -349,6 +482,7 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
         FileRec r;
         char const* file = files[i];
         r.file = file;
+        r.inode = 0;
         struct stat st;
 
         err = stat(file, &st);
@@ -359,9 +493,14 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
             r.s.modTime_sec = st.st_mtime;
             r.s.modTime_nsec = 0; // workaround sim breakage
             //r.s.modTime_nsec = st.st_mtime_nsec;
+            if (trustMetadata) {
+                r.s.modTime_nsec = mtime_nsec(st);
+            }
             r.s.mode = st.st_mode;
             r.s.size = st.st_size;
-            // we compute the crc32 later down below, when we already have the file open.
+            r.s.crc32 = 0;
+            r.inode = st.st_ino;
+            // the crc32 is computed below, or while the file is written out.
 
             if (newSnapshot.indexOfKey(key) >= 0) {
                 LOGP("back_up_files key already in use '%s'", key.string());
@@ -371,6 +510,46 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
         newSnapshot.add(key, r);
     }
 
+    // Only snapshots written with BACKUP_FILES_TRUST_METADATA have nanosecond
+    // times, and they have the inode numbers of all their files.
+    const bool compareNsec = trustMetadata && oldInodes.size() == oldSnapshot.size();
+
+    // A file whose metadata changed is written out whatever its contents, so
+    // only files that look unchanged need their checksum compared.  Compute
+    // those up front, several at a time.
+    Vector<CrcJob> crcJobs;
+    Vector<size_t> crcFiles;
+    for (size_t i=0; i<newSnapshot.size(); i++) {
+        const String8& key = newSnapshot.keyAt(i);
+        FileRec& g = newSnapshot.editValueAt(i);
+        ssize_t n = g.deleted ? -1 : oldSnapshot.indexOfKey(key);
+        if (n < 0 || !same_metadata(oldSnapshot.valueAt(n), g.s, compareNsec)) {
+            continue;
+        }
+        if (compareNsec && oldInodes.valueFor(key) == g.inode) {
+            g.s.crc32 = oldSnapshot.valueAt(n).crc32;
+            continue;
+        }
+        CrcJob job;
+        job.path = g.file.string();
+        crcJobs.add(job);
+        crcFiles.add(i);
+    }
+    compute_crc32s(crcJobs.editArray(), crcJobs.size());
+    for (size_t i=0; i<crcJobs.size(); i++) {
+        const CrcJob& job = crcJobs[i];
+        FileRec& g = newSnapshot.editValueAt(crcFiles[i]);
+        if (job.opened) {
+            g.s.crc32 = job.crc;
+        } else {
+            // We can't open the file.  Don't report it as a delete either.  Let the
+            // server keep the old version.  Maybe they'll be able to deal with it
+            // on restore.
+            LOGP("Unable to open file %s - skipping", g.file.string());
+            g.s.crc32 = oldSnapshot.valueFor(newSnapshot.keyAt(crcFiles[i])).crc32;
+        }
+    }
+
     int n = 0;
     int N = oldSnapshot.size();
     int m = 0;
@@ -390,33 +569,21 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
         else if (cmp > 0) {
             // file added
             LOGP("file added: %s", g.file.string());
-            write_update_file(dataStream, q, g.file.string());
+            write_update_file(dataStream, q, g.file.string(), &g.s.crc32);
             m++;
         }
         else {
             // both files exist, check them
             const FileState& f = oldSnapshot.valueAt(n);
 
-            int fd = open(g.file.string(), O_RDONLY);
-            if (fd < 0) {
-                // We can't open the file.  Don't report it as a delete either.  Let the
-                // server keep the old version.  Maybe they'll be able to deal with it
-                // on restore.
-                LOGP("Unable to open file %s - skipping", g.file.string());
-            } else {
-                g.s.crc32 = compute_crc32(fd);
-
-                LOGP("%s", q.string());
-                LOGP("  new: modTime=%d,%d mode=%04o size=%-3d crc32=0x%08x",
-                        f.modTime_sec, f.modTime_nsec, f.mode, f.size, f.crc32);
-                LOGP("  old: modTime=%d,%d mode=%04o size=%-3d crc32=0x%08x",
-                        g.s.modTime_sec, g.s.modTime_nsec, g.s.mode, g.s.size, g.s.crc32);
-                if (f.modTime_sec != g.s.modTime_sec || f.modTime_nsec != g.s.modTime_nsec
-                        || f.mode != g.s.mode || f.size != g.s.size || f.crc32 != g.s.crc32) {
-                    write_update_file(dataStream, fd, g.s.mode, p, g.file.string());
-                }
-
-                close(fd);
+            LOGP("%s", q.string());
+            LOGP("  new: modTime=%d,%d mode=%04o size=%-3d crc32=0x%08x",
+                    f.modTime_sec, f.modTime_nsec, f.mode, f.size, f.crc32);
+            LOGP("  old: modTime=%d,%d mode=%04o size=%-3d crc32=0x%08x",
+                    g.s.modTime_sec, g.s.modTime_nsec, g.s.mode, g.s.size, g.s.crc32);
+            if (!same_metadata(f, g.s, compareNsec) || f.crc32 != g.s.crc32) {
+                // If the file can't be opened, it is skipped as above.
+                write_update_file(dataStream, p, g.file.string(), &g.s.crc32);
             }
             n++;
             m++;
@@ -433,11 +600,11 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
     while (m<fileCount) {
         const String8& q = newSnapshot.keyAt(m);
         FileRec& g = newSnapshot.editValueAt(m);
-        write_update_file(dataStream, q, g.file.string());
+        write_update_file(dataStream, q, g.file.string(), &g.s.crc32);
         m++;
     }
 
-    err = write_snapshot_file(newSnapshotFD, newSnapshot);
+    err = write_snapshot_file(newSnapshotFD, newSnapshot, trustMetadata);
 
     return 0;
 }
@@ -489,6 +656,15 @@ void send_tarfile_chunk(BackupDataWriter* writer, const char* buffer, size_t siz
     if (size != 0) writer->WriteEntityData(buffer, size);
 }
 
+static void send_zeros(BackupDataWriter* writer, size_t size) {
+    static const char zeros[512] = { 0 };
+    while (size > 0) {
+        size_t amt = (size < sizeof(zeros)) ? size : sizeof(zeros);
+        writer->WriteEntityData(zeros, amt);
+        size -= amt;
+    }
+}
+
 int write_tarfile(const String8& packageName, const String8& domain,
         const String8& rootpath, const String8& filepath, BackupDataWriter* writer)
 {
@@ -535,7 +711,6 @@ int write_tarfile(const String8& packageName, const String8& domain,
     const int isdir = S_ISDIR(s.st_mode);
     if (isdir) s.st_size = 0;   // directories get no actual data in the tar stream
 
-    // !!! TODO: use mmap when possible to avoid churning the buffer cache
     // !!! TODO: this will break with symlinks; need to use readlink(2)
     int fd = open(filepath.string(), O_RDONLY);
     if (fd < 0) {
@@ -544,11 +719,17 @@ int write_tarfile(const String8& packageName, const String8& domain,
         return err;
     }
 
-    // read/write up to this much at a time.
+    // File data goes out in chunks of up to this much, copied by the kernel.
+    const size_t CHUNKSIZE = 1024 * 1024;
+
+    // Scratch for the headers, which go out together in one write.
     const size_t BUFSIZE = 32 * 1024;
+    const size_t PAXSIZE = 12 * 1024;
     char* buf = new char[BUFSIZE];
     char* paxHeader = buf + 512;    // use a different chunk of it as separate scratch
     char* paxData = buf + 1024;
+    char* batch = paxData + PAXSIZE;    // 4-byte chunk size, then the headers
+    char* batchEnd = batch + 4;
 
     if (buf == NULL) {
         LOGE("Out of mem allocating transfer buffer");
@@ -637,7 +818,7 @@ int write_tarfile(const String8& packageName, const String8& domain,
         char* p = paxData;
 
         // construct the pax extended header data block
-        memset(paxData, 0, BUFSIZE - (paxData - buf));
+        memset(paxData, 0, PAXSIZE);
         int len;
 
         // size header -- calc len in digits by actually rendering the number
@@ -666,50 +847,56 @@ int write_tarfile(const String8& packageName, const String8& domain,
         memset(paxHeader + 124, 0, 12);
         snprintf(paxHeader + 124, 12, "%011o", p - paxData);
 
-        // Checksum and write the pax block header
+        // Checksum the pax block header and queue it
         calc_tar_checksum(paxHeader);
-        send_tarfile_chunk(writer, paxHeader, 512);
+        memcpy(batchEnd, paxHeader, 512);
+        batchEnd += 512;
 
-        // Now write the pax data itself
+        // Now queue the pax data itself
         int paxblocks = (paxLen + 511) / 512;
-        send_tarfile_chunk(writer, paxData, 512 * paxblocks);
+        memcpy(batchEnd, paxData, 512 * paxblocks);
+        batchEnd += 512 * paxblocks;
     }
 
-    // Checksum and write the 512-byte ustar file header block to the output
+    // Checksum and queue the 512-byte ustar file header block
     calc_tar_checksum(buf);
-    send_tarfile_chunk(writer, buf, 512);
-
-    // Now write the file data itself, for real files.  We honor tar's convention that
-    // only full 512-byte blocks are sent to write().
-    if (!isdir) {
-        off64_t toWrite = s.st_size;
-        while (toWrite > 0) {
-            size_t toRead = (toWrite < BUFSIZE) ? toWrite : BUFSIZE;
-            ssize_t nRead = read(fd, buf, toRead);
-            if (nRead < 0) {
-                err = errno;
-                LOGE("Unable to read file [%s], err=%d (%s)", filepath.string(),
-                        err, strerror(err));
-                break;
-            } else if (nRead == 0) {
-                LOGE("EOF but expect %lld more bytes in [%s]", (long long) toWrite,
-                        filepath.string());
-                err = EIO;
-                break;
-            }
+    memcpy(batchEnd, buf, 512);
+    batchEnd += 512;
 
-            // At EOF we might have a short block; NUL-pad that to a 512-byte multiple.  This
-            // depends on the OS guarantee that for ordinary files, read() will never return
-            // less than the number of bytes requested.
-            ssize_t partial = (nRead+512) % 512;
-            if (partial > 0) {
-                ssize_t remainder = 512 - partial;
-                memset(buf + nRead, 0, remainder);
-                nRead += remainder;
+    // Now write the headers, followed by the file data itself for real files.  The
+    // headers go out with the first chunk of data, and the data is copied by the
+    // kernel straight from the file to the output.  We honor tar's convention that
+    // only full 512-byte blocks are sent, NUL-padding the end of the file.
+    {
+        off64_t toWrite = isdir ? 0 : s.st_size;
+        size_t headerSize = batchEnd - (batch + 4);
+        do {
+            size_t dataSize = (toWrite < (off64_t)CHUNKSIZE) ? toWrite : CHUNKSIZE;
+            size_t paddedSize = (dataSize + 511) & ~511;
+
+            uint32_t chunk_size_no = htonl(headerSize + paddedSize);
+            memcpy(batch, &chunk_size_no, 4);
+            writer->WriteEntityData(batch, 4 + headerSize);
+            headerSize = 0;
+
+            size_t copied = 0;
+            if (dataSize > 0) {
+                status_t result = writer->WriteEntityDataFromFd(fd, dataSize, &copied);
+                if (result != NO_ERROR) {
+                    err = result;
+                    LOGE("Unable to read file [%s], err=%d (%s)", filepath.string(),
+                            err, strerror(err));
+                } else if (copied < dataSize) {
+                    LOGE("EOF but expect %lld more bytes in [%s]",
+                            (long long) (toWrite - copied), filepath.string());
+                    err = EIO;
+                }
             }
-            send_tarfile_chunk(writer, buf, nRead);
-            toWrite -= nRead;
-        }
+
+            // Pad out the chunk we promised, even if the file came up short.
+            send_zeros(writer, paddedSize - copied);
+            toWrite -= dataSize;
+        } while (toWrite > 0 && err == 0);
     }
 
 cleanup:
@@ -17,13 +17,20 @@
 #define LOG_TAG "BlobCache"
 //#define LOG_NDEBUG 0
 
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <utils/BlobCache.h>
 #include <utils/Errors.h>
+#include <utils/FileMap.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
+#include <utils/Vector.h>
 
 #include <cutils/properties.h>
 
@@ -38,20 +45,267 @@ static const uint32_t blobCacheVersion = 3;
 // BlobCache::Header::mDeviceVersion value
 static const uint32_t blobCacheDeviceVersion = 1;
 
+// An attached cache file is an append-only sequence of records:
+//
+//   BlobFileHeader
+//   BlobFileRecord...                   (entries added by a sync)
+//   BlobFileIndexEntry... BlobFileTrailer  (live entries as of that sync)
+//   BlobFileRecord...                   (entries added by the next sync)
+//   BlobFileIndexEntry... BlobFileTrailer
+//   ...
+//
+// Only the index in front of the last trailer is meaningful; everything it
+// does not reference is garbage until the next compaction.  All structures
+// are 4-byte aligned.
+
+static const uint32_t blobFileMagic = ('_' << 24) + ('B' << 16) + ('f' << 8) + '$';
+static const uint32_t blobFileIndexMagic = ('_' << 24) + ('B' << 16) + ('i' << 8) + '$';
+static const uint32_t blobFileVersion = 1;
+
+// Compaction is not worth it for files smaller than this.
+static const size_t blobFileMinCompactSize = 1024 * 1024;
+
+struct BlobFileHeader {
+    uint32_t mMagicNumber;
+    uint32_t mFileVersion;
+    uint32_t mDeviceVersion;
+    int32_t mBuildIdLength;
+    char mBuildId[PROPERTY_VALUE_MAX];
+};
+
+struct BlobFileRecord {
+    uint32_t mKeySize;
+    uint32_t mValueSize;
+    uint8_t mData[];
+};
+
+struct BlobFileIndexEntry {
+    uint32_t mOffset;
+    uint32_t mKeySize;
+    uint32_t mValueSize;
+    uint32_t mHash;
+};
+
+struct BlobFileTrailer {
+    uint32_t mMagicNumber;
+    uint32_t mNumEntries;
+    uint32_t mIndexOffset;
+    uint32_t mChecksum;     // JenkinsHashMixBytes of the index entries
+};
+
+// Maps a record offset in the old file to its offset after compaction.
+struct BlobFileRelocation {
+    uint32_t mFrom;
+    uint32_t mTo;
+};
+
+static int compareRelocations(const void* lhs, const void* rhs) {
+    uint32_t l = static_cast<const BlobFileRelocation*>(lhs)->mFrom;
+    uint32_t r = static_cast<const BlobFileRelocation*>(rhs)->mFrom;
+    return l < r ? -1 : (l > r ? 1 : 0);
+}
+
+static inline size_t align4(size_t size) {
+    return (size + 3) & ~3;
+}
+
+static inline size_t recordSize(size_t keySize, size_t valueSize) {
+    return align4(sizeof(BlobFileRecord) + keySize + valueSize);
+}
+
+static void initFileHeader(BlobFileHeader* header) {
+    memset(header, 0, sizeof(*header));
+    header->mMagicNumber = blobFileMagic;
+    header->mFileVersion = blobFileVersion;
+    header->mDeviceVersion = blobCacheDeviceVersion;
+    header->mBuildIdLength = property_get("ro.build.id", header->mBuildId, "");
+}
+
+static status_t writeFully(int fd, const void* data, size_t size, off_t offset) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, bytes, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("write of %zu bytes at %lld failed: %s", size, (long long)offset,
+                    strerror(errno));
+            return -errno;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return OK;
+}
+
+static inline uint32_t indexChecksum(const BlobFileIndexEntry* index,
+        size_t numEntries) {
+    return JenkinsHashMixBytes(0, reinterpret_cast<const uint8_t*>(index),
+            numEntries * sizeof(BlobFileIndexEntry));
+}
+
+// Appends an index of 'numEntries' entries and its trailer at *fileSize.
+static status_t writeIndex(int fd, size_t* fileSize,
+        const BlobFileIndexEntry* index, size_t numEntries) {
+    size_t indexSize = numEntries * sizeof(BlobFileIndexEntry);
+    if (*fileSize + indexSize + sizeof(BlobFileTrailer) > UINT32_MAX) {
+        LOGE("cache file would exceed 4GB");
+        return NO_MEMORY;
+    }
+    BlobFileTrailer trailer;
+    trailer.mMagicNumber = blobFileIndexMagic;
+    trailer.mNumEntries = numEntries;
+    trailer.mIndexOffset = *fileSize;
+    trailer.mChecksum = indexChecksum(index, numEntries);
+    status_t err = writeFully(fd, index, indexSize, *fileSize);
+    if (err == OK) {
+        err = writeFully(fd, &trailer, sizeof(trailer), *fileSize + indexSize);
+    }
+    if (err == OK) {
+        *fileSize += indexSize + sizeof(trailer);
+    }
+    return err;
+}
+
+// Compacts an attached file on a background thread.  The cache owns the
+// thread and waits for it in its destructor, so a plain pointer is enough;
+// the cache need not be held by an sp<>.
+class BlobCache::Compactor : public Thread {
+public:
+    Compactor(BlobCache* cache) : Thread(false), mCache(cache) { }
+
+private:
+    virtual bool threadLoop() {
+        mCache->compact();
+        return false;
+    }
+
+    BlobCache* const mCache;
+};
+
+BlobCache::Shard::Shard():
+        lruHead(NULL),
+        lruTail(NULL),
+        totalSize(0),
+        hits(0),
+        misses(0),
+        evictions(0) {
+}
+
 BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize):
         mMaxKeySize(maxKeySize),
         mMaxValueSize(maxValueSize),
         mMaxTotalSize(maxTotalSize),
-        mTotalSize(0) {
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-#ifdef _WIN32
-    srand(now);
-#else
-    mRandState[0] = (now >> 0) & 0xFFFF;
-    mRandState[1] = (now >> 16) & 0xFFFF;
-    mRandState[2] = (now >> 32) & 0xFFFF;
-#endif
-    LOGV("initializing random seed using %lld", (unsigned long long)now);
+        mNumShards(MAX_SHARDS),
+        mFd(-1),
+        mFileMap(NULL),
+        mFileSize(0),
+        mFileLiveSize(0),
+        mFileIndexSize(0),
+        mFileIndexChecksum(0),
+        mCompacting(false) {
+    // Every entry that passes the size checks in set must fit in its shard,
+    // so fall back to fewer, larger shards for caches of a few big entries.
+    while (mNumShards > 1 && mMaxTotalSize / mNumShards < mMaxKeySize + mMaxValueSize) {
+        mNumShards /= 2;
+    }
+    mShardMaxSize = mMaxTotalSize / mNumShards;
+    LOGV("using %zu shards of %zu bytes", mNumShards, mShardMaxSize);
+}
+
+BlobCache::~BlobCache() {
+    // Skips a compaction that has not started yet.
+    if (mCompactor != NULL) {
+        mCompactor->requestExitAndWait();
+    }
+    clear();
+    delete mFileMap;
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+hash_t BlobCache::hashKey(const void* key, size_t keySize) {
+    uint32_t hash = JenkinsHashMixBytes(0, static_cast<const uint8_t*>(key), keySize);
+    return JenkinsHashWhiten(hash);
+}
+
+BlobCache::Shard& BlobCache::shardFor(hash_t hash) {
+    // BasicHashtable picks buckets from the low bits, so use the high ones.
+    return mShards[(uint32_t(hash) >> 24) & (mNumShards - 1)];
+}
+
+BlobCache::Entry* BlobCache::findLocked(Shard& shard, hash_t hash,
+        const void* key, size_t keySize) {
+    ssize_t index = shard.index.find(-1, hash, BlobKey(key, keySize));
+    return index < 0 ? NULL : shard.index.entryAt(index).entry;
+}
+
+void BlobCache::lruUnlinkLocked(Shard& shard, Entry* entry) {
+    if (entry->lruPrev) {
+        entry->lruPrev->lruNext = entry->lruNext;
+    } else {
+        shard.lruHead = entry->lruNext;
+    }
+    if (entry->lruNext) {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    } else {
+        shard.lruTail = entry->lruPrev;
+    }
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+void BlobCache::lruPushFrontLocked(Shard& shard, Entry* entry) {
+    entry->lruPrev = NULL;
+    entry->lruNext = shard.lruHead;
+    if (shard.lruHead) {
+        shard.lruHead->lruPrev = entry;
+    } else {
+        shard.lruTail = entry;
+    }
+    shard.lruHead = entry;
+}
+
+void BlobCache::removeLocked(Shard& shard, Entry* entry) {
+    ssize_t index = shard.index.find(-1, entry->hash,
+            BlobKey(entry->key(), entry->keySize));
+    LOG_ALWAYS_FATAL_IF(index < 0, "cache entry missing from index");
+    shard.index.removeAt(index);
+    lruUnlinkLocked(shard, entry);
+    shard.totalSize -= entry->size();
+    free(entry);
+}
+
+void BlobCache::clearLocked(Shard& shard) {
+    shard.index.clear();
+    Entry* entry = shard.lruHead;
+    while (entry) {
+        Entry* next = entry->lruNext;
+        free(entry);
+        entry = next;
+    }
+    shard.lruHead = shard.lruTail = NULL;
+    shard.totalSize = 0;
+}
+
+bool BlobCache::evictLocked(Shard& shard, size_t size, const Entry* keep) {
+    if (size > mShardMaxSize) {
+        return false;
+    }
+    Entry* victim = shard.lruTail;
+    while (victim && shard.totalSize + size > mShardMaxSize) {
+        Entry* prev = victim->lruPrev;
+        if (victim != keep) {
+            LOGV("evicting cache entry with %zu byte key and %zu byte value",
+                    victim->keySize, victim->valueSize);
+            removeLocked(shard, victim);
+            shard.evictions++;
+        }
+        victim = prev;
+    }
+    return shard.totalSize + size <= mShardMaxSize;
 }
 
 void BlobCache::set(const void* key, size_t keySize, const void* value,
@@ -80,57 +334,52 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
         return;
     }
 
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
-
-    while (true) {
-        ssize_t index = mCacheEntries.indexOf(dummyEntry);
-        if (index < 0) {
-            // Create a new cache entry.
-            sp<Blob> keyBlob(new Blob(key, keySize, true));
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
-            size_t newTotalSize = mTotalSize + keySize + valueSize;
-            if (mMaxTotalSize < newTotalSize) {
-                if (isCleanable()) {
-                    // Clean the cache and try again.
-                    clean();
-                    continue;
-                } else {
-                    LOGV("set: not caching new key/value pair because the "
-                            "total cache size limit would be exceeded: %zu "
-                            "(limit: %zu)",
-                            keySize + valueSize, mMaxTotalSize);
-                    break;
-                }
-            }
-            mCacheEntries.add(CacheEntry(keyBlob, valueBlob));
-            mTotalSize = newTotalSize;
-            LOGV("set: created new cache entry with %zu byte key and %zu byte value",
-                    keySize, valueSize);
-        } else {
-            // Update the existing cache entry.
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
-            sp<Blob> oldValueBlob(mCacheEntries[index].getValue());
-            size_t newTotalSize = mTotalSize + valueSize - oldValueBlob->getSize();
-            if (mMaxTotalSize < newTotalSize) {
-                if (isCleanable()) {
-                    // Clean the cache and try again.
-                    clean();
-                    continue;
-                } else {
-                    LOGV("set: not caching new value because the total cache "
-                            "size limit would be exceeded: %zu (limit: %zu)",
-                            keySize + valueSize, mMaxTotalSize);
-                    break;
-                }
-            }
-            mCacheEntries.editItemAt(index).setValue(valueBlob);
-            mTotalSize = newTotalSize;
-            LOGV("set: updated existing cache entry with %zu byte key and %zu byte "
-                    "value", keySize, valueSize);
-        }
-        break;
+    hash_t hash = hashKey(key, keySize);
+    Shard& shard(shardFor(hash));
+
+    // Build the replacement entry before taking the lock.
+    Entry* entry = static_cast<Entry*>(malloc(sizeof(Entry) + keySize + valueSize));
+    if (entry == NULL) {
+        LOGE("set: failed to allocate a %zu byte cache entry", keySize + valueSize);
+        return;
+    }
+    entry->lruPrev = entry->lruNext = NULL;
+    entry->hash = hash;
+    entry->keySize = keySize;
+    entry->valueSize = valueSize;
+    entry->fileOffset = 0;
+    entry->checked = true;
+    entry->bytes = entry->data;
+    memcpy(entry->data, key, keySize);
+    memcpy(entry->data + keySize, value, valueSize);
+
+    Mutex::Autolock _l(shard.lock);
+    insertLocked(shard, entry);
+}
+
+bool BlobCache::insertLocked(Shard& shard, Entry* entry) {
+    Entry* old = findLocked(shard, entry->hash, entry->key(), entry->keySize);
+    size_t oldSize = old ? old->size() : 0;
+    size_t growth = entry->size() > oldSize ? entry->size() - oldSize : 0;
+    if (!evictLocked(shard, growth, old)) {
+        LOGV("set: not caching new key/value pair because the total cache "
+                "size limit would be exceeded: %zu (limit: %zu)",
+                entry->size(), mShardMaxSize);
+        free(entry);
+        return false;
+    }
+    if (old) {
+        removeLocked(shard, old);
+        LOGV("set: updated existing cache entry with %zu byte key and %zu byte "
+                "value", entry->keySize, entry->valueSize);
+    } else {
+        LOGV("set: created new cache entry with %zu byte key and %zu byte value",
+                entry->keySize, entry->valueSize);
     }
+    shard.index.add(entry->hash, IndexEntry(entry));
+    lruPushFrontLocked(shard, entry);
+    shard.totalSize += entry->size();
+    return true;
 }
 
 size_t BlobCache::get(const void* key, size_t keySize, void* value,
@@ -140,40 +389,76 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
                 keySize, mMaxKeySize);
         return 0;
     }
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
-    ssize_t index = mCacheEntries.indexOf(dummyEntry);
-    if (index < 0) {
+    hash_t hash = hashKey(key, keySize);
+    Shard& shard(shardFor(hash));
+
+    Mutex::Autolock _l(shard.lock);
+    Entry* entry = findLocked(shard, hash, key, keySize);
+    if (entry != NULL && !entry->checked && !checkRecordLocked(shard, entry)) {
+        entry = NULL;
+    }
+    if (entry == NULL) {
         LOGV("get: no cache entry found for key of size %zu", keySize);
+        shard.misses++;
         return 0;
     }
+    shard.hits++;
+    if (entry != shard.lruHead) {
+        lruUnlinkLocked(shard, entry);
+        lruPushFrontLocked(shard, entry);
+    }
 
     // The key was found. Return the value if the caller's buffer is large
     // enough.
-    sp<Blob> valueBlob(mCacheEntries[index].getValue());
-    size_t valueBlobSize = valueBlob->getSize();
-    if (valueBlobSize <= valueSize) {
-        LOGV("get: copying %zu bytes to caller's buffer", valueBlobSize);
-        memcpy(value, valueBlob->getData(), valueBlobSize);
+    size_t entryValueSize = entry->valueSize;
+    if (entryValueSize <= valueSize) {
+        LOGV("get: copying %zu bytes to caller's buffer", entryValueSize);
+        memcpy(value, entry->value(), entryValueSize);
     } else {
         LOGV("get: caller's buffer is too small for value: %zu (needs %zu)",
-                valueSize, valueBlobSize);
+                valueSize, entryValueSize);
     }
-    return valueBlobSize;
+    return entryValueSize;
 }
 
-static inline size_t align4(size_t size) {
-    return (size + 3) & ~3;
+bool BlobCache::checkRecordLocked(Shard& shard, Entry* entry) {
+    // The index checksum doesn't cover the records, so make sure that this
+    // one still has the sizes the index gave it and that the stored hash is
+    // its key's, before trusting its bytes.
+    const BlobFileRecord* record = reinterpret_cast<const BlobFileRecord*>(
+            entry->bytes - offsetof(BlobFileRecord, mData));
+    if (record->mKeySize != entry->keySize || record->mValueSize != entry->valueSize ||
+            hashKey(entry->key(), entry->keySize) != entry->hash) {
+        LOGE("get: dropping the cache file record at %" PRIu32 " in %s, which does "
+                "not match the index", entry->fileOffset, mPath.string());
+        removeLocked(shard, entry);
+        return false;
+    }
+    entry->checked = true;
+    return true;
+}
+
+void BlobCache::getStats(Stats* outStats) const {
+    memset(outStats, 0, sizeof(*outStats));
+    for (size_t i = 0; i < mNumShards; i++) {
+        const Shard& shard(mShards[i]);
+        Mutex::Autolock _l(shard.lock);
+        outStats->numEntries += shard.index.size();
+        outStats->totalSize += shard.totalSize;
+        outStats->hits += shard.hits;
+        outStats->misses += shard.misses;
+        outStats->evictions += shard.evictions;
+    }
 }
 
 size_t BlobCache::getFlattenedSize() const {
     size_t size = align4(sizeof(Header) + PROPERTY_VALUE_MAX);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
-        size += align4(sizeof(EntryHeader) + keyBlob->getSize() +
-                       valueBlob->getSize());
+    for (size_t i = 0; i < mNumShards; i++) {
+        const Shard& shard(mShards[i]);
+        Mutex::Autolock _l(shard.lock);
+        for (const Entry* e = shard.lruHead; e; e = e->lruNext) {
+            size += align4(sizeof(EntryHeader) + e->size());
+        }
     }
     return size;
 }
@@ -184,55 +469,63 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
         LOGE("flatten: not enough room for cache header");
         return BAD_VALUE;
     }
+
+    // Hold every shard lock so the entry count matches the entries written.
+    lockAllShards();
+
+    size_t numEntries = 0;
+    for (size_t i = 0; i < mNumShards; i++) {
+        numEntries += mShards[i].index.size();
+    }
+
     Header* header = reinterpret_cast<Header*>(buffer);
     header->mMagicNumber = blobCacheMagic;
     header->mBlobCacheVersion = blobCacheVersion;
     header->mDeviceVersion = blobCacheDeviceVersion;
-    header->mNumEntries = mCacheEntries.size();
+    header->mNumEntries = numEntries;
     char buildId[PROPERTY_VALUE_MAX];
     header->mBuildIdLength = property_get("ro.build.id", buildId, "");
     memcpy(header->mBuildId, buildId, header->mBuildIdLength);
 
-    // Write cache entries
+    // Write cache entries, least recently used first, so that unflatten
+    // rebuilds the same recency order.
+    status_t result = OK;
     uint8_t* byteBuffer = reinterpret_cast<uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header) + header->mBuildIdLength);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
-        size_t keySize = keyBlob->getSize();
-        size_t valueSize = valueBlob->getSize();
+    for (size_t i = 0; i < mNumShards && result == OK; i++) {
+        for (const Entry* e = mShards[i].lruTail; e; e = e->lruPrev) {
+            size_t entrySize = sizeof(EntryHeader) + e->size();
+            size_t totalSize = align4(entrySize);
+            if (byteOffset + totalSize > size) {
+                LOGE("flatten: not enough room for cache entries");
+                result = BAD_VALUE;
+                break;
+            }
 
-        size_t entrySize = sizeof(EntryHeader) + keySize + valueSize;
-        size_t totalSize = align4(entrySize);
-        if (byteOffset + totalSize > size) {
-            LOGE("flatten: not enough room for cache entries");
-            return BAD_VALUE;
-        }
+            EntryHeader* eheader = reinterpret_cast<EntryHeader*>(
+                &byteBuffer[byteOffset]);
+            eheader->mKeySize = e->keySize;
+            eheader->mValueSize = e->valueSize;
 
-        EntryHeader* eheader = reinterpret_cast<EntryHeader*>(
-            &byteBuffer[byteOffset]);
-        eheader->mKeySize = keySize;
-        eheader->mValueSize = valueSize;
+            memcpy(eheader->mData, e->key(), e->size());
 
-        memcpy(eheader->mData, keyBlob->getData(), keySize);
-        memcpy(eheader->mData + keySize, valueBlob->getData(), valueSize);
+            if (totalSize > entrySize) {
+                // We have padding bytes. Those will get written to storage, and contribute to the CRC,
+                // so make sure we zero-them to have reproducible results.
+                memset(eheader->mData + e->size(), 0, totalSize - entrySize);
+            }
 
-        if (totalSize > entrySize) {
-            // We have padding bytes. Those will get written to storage, and contribute to the CRC,
-            // so make sure we zero-them to have reproducible results.
-            memset(eheader->mData + keySize + valueSize, 0, totalSize - entrySize);
+            byteOffset += totalSize;
         }
-
-        byteOffset += totalSize;
     }
 
-    return OK;
+    unlockAllShards();
+    return result;
 }
 
 status_t BlobCache::unflatten(void const* buffer, size_t size) {
     // All errors should result in the BlobCache being in an empty state.
-    mCacheEntries.clear();
+    clear();
 
     // Read the cache header
     if (size < sizeof(Header)) {
@@ -260,7 +553,7 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     size_t numEntries = header->mNumEntries;
     for (size_t i = 0; i < numEntries; i++) {
         if (byteOffset + sizeof(EntryHeader) > size) {
-            mCacheEntries.clear();
+            clear();
             LOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
@@ -273,7 +566,7 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
 
         size_t totalSize = align4(entrySize);
         if (byteOffset + totalSize > size) {
-            mCacheEntries.clear();
+            clear();
             LOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
@@ -287,93 +580,405 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     return OK;
 }
 
-long int BlobCache::blob_random() {
-#ifdef _WIN32
-    return rand();
-#else
-    return nrand48(mRandState);
-#endif
+void BlobCache::clear() {
+    for (size_t i = 0; i < mNumShards; i++) {
+        Mutex::Autolock _l(mShards[i].lock);
+        clearLocked(mShards[i]);
+    }
 }
 
-void BlobCache::clean() {
-    // Remove a random cache entry until the total cache size gets below half
-    // the maximum total cache size.
-    while (mTotalSize > mMaxTotalSize / 2) {
-        size_t i = size_t(blob_random() % (mCacheEntries.size()));
-        const CacheEntry& entry(mCacheEntries[i]);
-        mTotalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
-        mCacheEntries.removeAt(i);
+void BlobCache::lockAllShards() const {
+    for (size_t i = 0; i < mNumShards; i++) {
+        mShards[i].lock.lock();
     }
 }
 
-bool BlobCache::isCleanable() const {
-    return mTotalSize > mMaxTotalSize / 2;
+void BlobCache::unlockAllShards() const {
+    for (size_t i = mNumShards; i > 0; i--) {
+        mShards[i - 1].lock.unlock();
+    }
 }
 
-BlobCache::Blob::Blob(const void* data, size_t size, bool copyData):
-        mData(copyData ? malloc(size) : data),
-        mSize(size),
-        mOwnsData(copyData) {
-    if (data != NULL && copyData) {
-        memcpy(const_cast<void*>(mData), data, size);
+status_t BlobCache::attachFile(const char* path) {
+    Mutex::Autolock _f(mFileLock);
+    if (mFd >= 0) {
+        LOGE("attachFile: %s is already attached", mPath.string());
+        return INVALID_OPERATION;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        LOGE("attachFile: unable to open %s: %s", path, strerror(errno));
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        LOGE("attachFile: unable to stat %s: %s", path, strerror(errno));
+        close(fd);
+        return -errno;
     }
-}
 
-BlobCache::Blob::~Blob() {
-    if (mOwnsData) {
-        free(const_cast<void*>(mData));
+    clear();
+    mPath = path;
+    mFd = fd;
+    status_t err = loadFileLocked(st.st_size);
+    if (err != OK) {
+        LOGW_IF(st.st_size > 0, "attachFile: discarding cache file %s", path);
+        err = resetFileLocked();
+        if (err != OK) {
+            close(mFd);
+            mFd = -1;
+        }
     }
+    return err;
 }
 
-bool BlobCache::Blob::operator<(const Blob& rhs) const {
-    if (mSize == rhs.mSize) {
-        return memcmp(mData, rhs.mData, mSize) < 0;
-    } else {
-        return mSize < rhs.mSize;
+status_t BlobCache::loadFileLocked(size_t fileSize) {
+    if (fileSize < align4(sizeof(BlobFileHeader)) + sizeof(BlobFileTrailer) ||
+            fileSize > UINT32_MAX) {
+        return BAD_VALUE;
+    }
+    FileMap* map = new FileMap();
+    if (!map->create(mPath.string(), mFd, 0, fileSize, true)) {
+        delete map;
+        return NO_MEMORY;
+    }
+    const uint8_t* base = static_cast<const uint8_t*>(map->getDataPtr());
+
+    // Check the header and trailer, and validate the whole index before
+    // creating any entries so that failures leave the cache empty.
+    BlobFileHeader expected;
+    initFileHeader(&expected);
+    const BlobFileHeader* header = reinterpret_cast<const BlobFileHeader*>(base);
+    if (header->mMagicNumber != expected.mMagicNumber ||
+            header->mFileVersion != expected.mFileVersion ||
+            header->mDeviceVersion != expected.mDeviceVersion ||
+            header->mBuildIdLength != expected.mBuildIdLength ||
+            strncmp(header->mBuildId, expected.mBuildId, expected.mBuildIdLength)) {
+        delete map;
+        return BAD_VALUE;
+    }
+    const BlobFileTrailer* trailer = reinterpret_cast<const BlobFileTrailer*>(
+            base + fileSize - sizeof(BlobFileTrailer));
+    size_t numEntries = trailer->mNumEntries;
+    size_t indexOffset = trailer->mIndexOffset;
+    size_t indexSize = fileSize - sizeof(BlobFileTrailer) - indexOffset;
+    if (trailer->mMagicNumber != blobFileIndexMagic ||
+            indexOffset < align4(sizeof(BlobFileHeader)) ||
+            indexOffset > fileSize - sizeof(BlobFileTrailer) ||
+            indexSize != numEntries * sizeof(BlobFileIndexEntry) ||
+            trailer->mChecksum != JenkinsHashMixBytes(0, base + indexOffset, indexSize)) {
+        LOGE("loadFile: bad index in %s", mPath.string());
+        delete map;
+        return BAD_VALUE;
+    }
+    // Only the index is read here, so that attaching touches no record
+    // pages.  Each record is checked against its index entry the first time
+    // it is looked up instead; see checkRecordLocked.
+    const BlobFileIndexEntry* index = reinterpret_cast<const BlobFileIndexEntry*>(
+            base + indexOffset);
+    for (size_t i = 0; i < numEntries; i++) {
+        const BlobFileIndexEntry& ie(index[i]);
+        size_t offset = ie.mOffset;
+        if ((offset & 3) || offset < align4(sizeof(BlobFileHeader)) ||
+                ie.mKeySize == 0 ||
+                ie.mKeySize > indexOffset || ie.mValueSize > indexOffset ||
+                offset + recordSize(ie.mKeySize, ie.mValueSize) > indexOffset) {
+            LOGE("loadFile: bad index entry %zu in %s", i, mPath.string());
+            delete map;
+            return BAD_VALUE;
+        }
     }
-}
 
-const void* BlobCache::Blob::getData() const {
-    return mData;
-}
+    size_t liveSize = 0;
+    for (size_t i = 0; i < numEntries; i++) {
+        const BlobFileIndexEntry& ie(index[i]);
+        if (ie.mKeySize > mMaxKeySize || ie.mValueSize > mMaxValueSize) {
+            continue;
+        }
+        Entry* entry = static_cast<Entry*>(malloc(sizeof(Entry)));
+        if (entry == NULL) {
+            break;
+        }
+        const BlobFileRecord* record = reinterpret_cast<const BlobFileRecord*>(
+                base + ie.mOffset);
+        entry->lruPrev = entry->lruNext = NULL;
+        entry->hash = ie.mHash;
+        entry->keySize = ie.mKeySize;
+        entry->valueSize = ie.mValueSize;
+        entry->fileOffset = ie.mOffset;
+        entry->checked = false;
+        entry->bytes = record->mData;
+
+        Shard& shard(shardFor(entry->hash));
+        Mutex::Autolock _l(shard.lock);
+        if (insertLocked(shard, entry)) {
+            liveSize += recordSize(ie.mKeySize, ie.mValueSize);
+        }
+    }
+    LOGV("loadFile: mapped %zu entries from %s", numEntries, mPath.string());
 
-size_t BlobCache::Blob::getSize() const {
-    return mSize;
+    mFileMap = map;
+    mFileSize = fileSize;
+    mFileLiveSize = liveSize;
+    mFileIndexSize = numEntries;
+    mFileIndexChecksum = trailer->mChecksum;
+    return OK;
 }
 
-BlobCache::CacheEntry::CacheEntry() {
+status_t BlobCache::resetFileLocked() {
+    // Only called while the cache is empty, so nothing points into the map.
+    delete mFileMap;
+    mFileMap = NULL;
+    if (ftruncate(mFd, 0) < 0) {
+        LOGE("resetFile: unable to truncate %s: %s", mPath.string(), strerror(errno));
+        return -errno;
+    }
+    BlobFileHeader header;
+    initFileHeader(&header);
+    status_t err = writeFully(mFd, &header, sizeof(header), 0);
+    if (err != OK) {
+        return err;
+    }
+    mFileSize = align4(sizeof(header));
+    mFileLiveSize = 0;
+    mFileIndexSize = 0;
+    mFileIndexChecksum = indexChecksum(NULL, 0);
+    return writeIndex(mFd, &mFileSize, NULL, 0);
 }
 
-BlobCache::CacheEntry::CacheEntry(const sp<Blob>& key, const sp<Blob>& value):
-        mKey(key),
-        mValue(value) {
-}
+status_t BlobCache::sync() {
+    Mutex::Autolock _f(mFileLock);
+    if (mFd < 0) {
+        return INVALID_OPERATION;
+    }
 
-BlobCache::CacheEntry::CacheEntry(const CacheEntry& ce):
-        mKey(ce.mKey),
-        mValue(ce.mValue) {
-}
+    // Append each shard's dirty entries in one write, least recently used
+    // first so that loading the index restores the recency order.  The index
+    // covers every entry that has a record, dirty or not.
+    Vector<BlobFileIndexEntry> index;
+    size_t liveSize = 0;
+    bool appended = false;
+    status_t err = OK;
+    for (size_t i = 0; i < mNumShards && err == OK; i++) {
+        Shard& shard(mShards[i]);
+        Mutex::Autolock _l(shard.lock);
+
+        size_t dirtySize = 0;
+        for (const Entry* e = shard.lruTail; e; e = e->lruPrev) {
+            if (!e->fileOffset) {
+                dirtySize += recordSize(e->keySize, e->valueSize);
+            }
+        }
+        if (dirtySize) {
+            if (mFileSize + dirtySize > UINT32_MAX) {
+                LOGE("sync: cache file would exceed 4GB");
+                err = NO_MEMORY;
+                break;
+            }
+            uint8_t* buffer = static_cast<uint8_t*>(calloc(1, dirtySize));
+            if (buffer == NULL) {
+                err = NO_MEMORY;
+                break;
+            }
+            size_t pos = 0;
+            for (const Entry* e = shard.lruTail; e; e = e->lruPrev) {
+                if (!e->fileOffset) {
+                    BlobFileRecord* record = reinterpret_cast<BlobFileRecord*>(buffer + pos);
+                    record->mKeySize = e->keySize;
+                    record->mValueSize = e->valueSize;
+                    memcpy(record->mData, e->key(), e->size());
+                    pos += recordSize(e->keySize, e->valueSize);
+                }
+            }
+            err = writeFully(mFd, buffer, dirtySize, mFileSize);
+            free(buffer);
+            if (err != OK) {
+                break;
+            }
+            appended = true;
+        }
 
-bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
-    return *mKey < *rhs.mKey;
-}
+        size_t offset = mFileSize;
+        for (Entry* e = shard.lruTail; e; e = e->lruPrev) {
+            size_t size = recordSize(e->keySize, e->valueSize);
+            if (!e->fileOffset) {
+                e->fileOffset = offset;
+                offset += size;
+            }
+            BlobFileIndexEntry ie;
+            ie.mOffset = e->fileOffset;
+            ie.mKeySize = e->keySize;
+            ie.mValueSize = e->valueSize;
+            ie.mHash = e->hash;
+            index.add(ie);
+            liveSize += size;
+        }
+        mFileSize += dirtySize;
+    }
+    if (err != OK) {
+        // Records that made it to the file stay valid; the previous index
+        // is still the last complete one.
+        return err;
+    }
 
-const BlobCache::CacheEntry& BlobCache::CacheEntry::operator=(const CacheEntry& rhs) {
-    mKey = rhs.mKey;
-    mValue = rhs.mValue;
-    return *this;
+    // Don't grow the file with a copy of an index that has not changed.
+    uint32_t checksum = indexChecksum(index.array(), index.size());
+    if (!appended && index.size() == mFileIndexSize && checksum == mFileIndexChecksum) {
+        return OK;
+    }
+    err = writeIndex(mFd, &mFileSize, index.array(), index.size());
+    if (err != OK) {
+        return err;
+    }
+    mFileLiveSize = liveSize;
+    mFileIndexSize = index.size();
+    mFileIndexChecksum = checksum;
+
+    if (!mCompacting && mFileSize > blobFileMinCompactSize &&
+            mFileSize > 2 * mFileLiveSize) {
+        // A previous compactor is done with the file by now, since
+        // compact() clears mCompacting under mFileLock; let it finish
+        // exiting before it is replaced.
+        if (mCompactor != NULL) {
+            mCompactor->join();
+        }
+        mCompacting = true;
+        mCompactor = new Compactor(this);
+        if (mCompactor->run("BlobCacheCompactor", PRIORITY_BACKGROUND) != OK) {
+            mCompacting = false;
+        }
+    }
+    return OK;
 }
 
-sp<BlobCache::Blob> BlobCache::CacheEntry::getKey() const {
-    return mKey;
-}
+void BlobCache::compact() {
+    Mutex::Autolock _f(mFileLock);
+    mCompacting = false;
+    if (mFd < 0) {
+        return;
+    }
 
-sp<BlobCache::Blob> BlobCache::CacheEntry::getValue() const {
-    return mValue;
-}
+    // Collect every entry that has a record.  No entry can gain a record
+    // while mFileLock is held, but entries may be evicted meanwhile.
+    Vector<BlobFileIndexEntry> index;
+    for (size_t i = 0; i < mNumShards; i++) {
+        Shard& shard(mShards[i]);
+        Mutex::Autolock _l(shard.lock);
+        for (const Entry* e = shard.lruTail; e; e = e->lruPrev) {
+            if (e->fileOffset) {
+                BlobFileIndexEntry ie;
+                ie.mOffset = e->fileOffset;
+                ie.mKeySize = e->keySize;
+                ie.mValueSize = e->valueSize;
+                ie.mHash = e->hash;
+                index.add(ie);
+            }
+        }
+    }
+
+    String8 tmpPath(mPath);
+    tmpPath.append(".tmp");
+    int fd = open(tmpPath.string(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        LOGE("compact: unable to create %s: %s", tmpPath.string(), strerror(errno));
+        return;
+    }
 
-void BlobCache::CacheEntry::setValue(const sp<Blob>& value) {
-    mValue = value;
+    size_t numEntries = index.size();
+    BlobFileRelocation* relocations = static_cast<BlobFileRelocation*>(
+            malloc(numEntries * sizeof(BlobFileRelocation) + 1));
+    uint8_t* buffer = NULL;
+    size_t bufferSize = 0;
+    FileMap* map = NULL;
+
+    BlobFileHeader header;
+    initFileHeader(&header);
+    status_t err = relocations ? writeFully(fd, &header, sizeof(header), 0) : NO_MEMORY;
+    size_t fileSize = align4(sizeof(header));
+    for (size_t i = 0; i < numEntries && err == OK; i++) {
+        BlobFileIndexEntry& ie(index.editItemAt(i));
+        size_t size = recordSize(ie.mKeySize, ie.mValueSize);
+        if (size > bufferSize) {
+            free(buffer);
+            buffer = static_cast<uint8_t*>(malloc(size));
+            bufferSize = buffer ? size : 0;
+            if (buffer == NULL) {
+                err = NO_MEMORY;
+                break;
+            }
+        }
+        if (pread(mFd, buffer, size, ie.mOffset) != ssize_t(size)) {
+            LOGE("compact: short read from %s", mPath.string());
+            err = UNKNOWN_ERROR;
+            break;
+        }
+        err = writeFully(fd, buffer, size, fileSize);
+        relocations[i].mFrom = ie.mOffset;
+        relocations[i].mTo = fileSize;
+        ie.mOffset = fileSize;
+        fileSize += size;
+    }
+    free(buffer);
+    if (err == OK) {
+        err = writeIndex(fd, &fileSize, index.array(), numEntries);
+    }
+    if (err == OK && fsync(fd) < 0) {
+        err = -errno;
+    }
+    if (err == OK) {
+        map = new FileMap();
+        if (!map->create(mPath.string(), fd, 0, fileSize, true)) {
+            err = NO_MEMORY;
+        }
+    }
+    if (err == OK && rename(tmpPath.string(), mPath.string()) < 0) {
+        LOGE("compact: unable to rename %s: %s", tmpPath.string(), strerror(errno));
+        err = -errno;
+    }
+    if (err != OK) {
+        delete map;
+        free(relocations);
+        close(fd);
+        unlink(tmpPath.string());
+        return;
+    }
+
+    // Point every entry at its new record.  Mapped entries move into the new
+    // map, which lets the old one go.
+    qsort(relocations, numEntries, sizeof(BlobFileRelocation), compareRelocations);
+    const uint8_t* base = static_cast<const uint8_t*>(map->getDataPtr());
+    lockAllShards();
+    for (size_t i = 0; i < mNumShards; i++) {
+        for (Entry* e = mShards[i].lruHead; e; e = e->lruNext) {
+            if (!e->fileOffset) {
+                continue;
+            }
+            BlobFileRelocation key;
+            key.mFrom = e->fileOffset;
+            const BlobFileRelocation* r = static_cast<const BlobFileRelocation*>(
+                    bsearch(&key, relocations, numEntries, sizeof(BlobFileRelocation),
+                            compareRelocations));
+            LOG_ALWAYS_FATAL_IF(r == NULL, "cache entry record lost in compaction");
+            e->fileOffset = r->mTo;
+            if (e->isMapped()) {
+                e->bytes = reinterpret_cast<const BlobFileRecord*>(base + r->mTo)->mData;
+            }
+        }
+    }
+    unlockAllShards();
+    free(relocations);
+
+    LOGV("compact: rewrote %s from %zu to %zu bytes", mPath.string(), mFileSize,
+            fileSize);
+    delete mFileMap;
+    close(mFd);
+    mFileMap = map;
+    mFd = fd;
+    mFileSize = fileSize;
+    mFileIndexSize = numEntries;
+    mFileIndexChecksum = indexChecksum(index.array(), numEntries);
+    mFileLiveSize = fileSize - align4(sizeof(header)) -
+            numEntries * sizeof(BlobFileIndexEntry) - sizeof(BlobFileTrailer);
 }
 
 } // namespace android
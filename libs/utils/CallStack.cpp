@@ -22,8 +22,47 @@
 #include <utils/Log.h>
 #include <utils/UniquePtr.h>
 
+#include <inttypes.h>
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#include <unistd.h>
+#include <unwind.h>
+#include <sys/syscall.h>
+#endif
+
 namespace android {
 
+enum {
+    // Deepest stack that update() collects.
+    MAX_DEPTH = 31,
+};
+
+#if !defined(_WIN32)
+
+struct UnwindState {
+    uintptr_t* pcs;
+    size_t maxFrames;
+    size_t count;
+    int32_t ignoreDepth;
+};
+
+static _Unwind_Reason_Code unwindFrame(struct _Unwind_Context* context, void* arg) {
+    UnwindState* state = static_cast<UnwindState*>(arg);
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (pc == 0) {
+        return _URC_END_OF_STACK;
+    }
+    if (state->ignoreDepth > 0) {
+        state->ignoreDepth--;
+        return _URC_NO_REASON;
+    }
+    state->pcs[state->count++] = pc;
+    return state->count < state->maxFrames ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+#endif // !defined(_WIN32)
+
 CallStack::CallStack() {
 }
 
@@ -36,15 +75,57 @@ CallStack::~CallStack() {
 }
 
 void CallStack::update(int32_t ignoreDepth, pid_t tid) {
-    // mFrameLines.clear();
-
-    // UniquePtr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS, tid));
-    // if (!backtrace->Unwind(ignoreDepth)) {
-    //     LOGW("%s: Failed to unwind callstack.", __FUNCTION__);
-    // }
-    // for (size_t i = 0; i < backtrace->NumFrames(); i++) {
-    //   mFrameLines.push_back(String8(backtrace->FormatFrameData(i).c_str()));
-    // }
+    mFrameLines.clear();
+
+#if !defined(_WIN32)
+    // The unwinder walks the calling thread's own stack only.
+    if (tid != -1 && tid != pid_t(syscall(__NR_gettid))) {
+        return;
+    }
+
+    uintptr_t pcs[MAX_DEPTH];
+    size_t count = capture(pcs, MAX_DEPTH, ignoreDepth);
+    if (count == 0) {
+        LOGW("%s: Failed to unwind callstack.", __FUNCTION__);
+    }
+    for (size_t i = 0; i < count; i++) {
+        mFrameLines.push(formatFrame(i, pcs[i]));
+    }
+#endif
+}
+
+size_t CallStack::capture(uintptr_t* pcs, size_t maxFrames, int32_t ignoreDepth) {
+#if !defined(_WIN32)
+    if (maxFrames == 0) {
+        return 0;
+    }
+    UnwindState state;
+    state.pcs = pcs;
+    state.maxFrames = maxFrames;
+    state.count = 0;
+    // Skip our own frame too.
+    state.ignoreDepth = ignoreDepth + 1;
+    _Unwind_Backtrace(unwindFrame, &state);
+    return state.count;
+#else
+    return 0;
+#endif
+}
+
+String8 CallStack::formatFrame(size_t index, uintptr_t pc) {
+#if !defined(_WIN32)
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(pc), &info) && info.dli_fname) {
+        uintptr_t relPc = pc - uintptr_t(info.dli_fbase);
+        if (info.dli_sname) {
+            return String8::format("#%02zu pc %08" PRIxPTR "  %s (%s+%" PRIuPTR ")",
+                    index, relPc, info.dli_fname, info.dli_sname,
+                    pc - uintptr_t(info.dli_saddr));
+        }
+        return String8::format("#%02zu pc %08" PRIxPTR "  %s", index, relPc, info.dli_fname);
+    }
+#endif
+    return String8::format("#%02zu pc %08" PRIxPTR "  <unknown>", index, pc);
 }
 
 void CallStack::log(const char* logtag, android_LogPriority priority, const char* prefix) const {
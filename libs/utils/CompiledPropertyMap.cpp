@@ -0,0 +1,460 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CompiledPropertyMap"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/CompiledPropertyMap.h>
+#include <utils/JenkinsHash.h>
+#include <utils/Log.h>
+
+// Enables debug output for cache loading.
+#define DEBUG_CACHE 0
+
+
+namespace android {
+
+static const uint32_t MAGIC = 0x4d504f43; // "COPM"
+static const uint32_t VERSION = 1;
+
+// Property files are a few kilobytes; anything this large is not one of ours.
+static const size_t MAX_SIZE = 16 * 1024 * 1024;
+
+enum {
+    HAS_INT32 = 0x0001,
+    HAS_FLOAT = 0x0002,
+};
+
+// Cache file layout: a Header, then numEntries Entries, then numBuckets
+// bucket words, then stringsSize bytes of null terminated keys and values.
+struct CompiledPropertyMap::Header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t sourceMtime;
+    int64_t sourceSize;
+    uint32_t sourceMtimeNsec;
+    uint32_t numEntries;
+    uint32_t numBuckets;        // a power of two, at least twice numEntries
+    uint32_t stringsSize;
+};
+
+struct CompiledPropertyMap::Entry {
+    uint32_t hash;
+    uint32_t keyOffset;
+    uint32_t keyLength;
+    uint32_t valueOffset;
+    uint32_t valueLength;
+    uint32_t flags;
+    int32_t int32Value;         // valid if flags has HAS_INT32
+    float floatValue;           // valid if flags has HAS_FLOAT
+};
+
+// A bucket holds the index of an entry plus one, or 0 if it is empty.
+// Collisions are resolved by linear probing.
+
+static inline uint32_t hashKey(const char* key, size_t length) {
+    return JenkinsHashWhiten(JenkinsHashMixBytes(0,
+            reinterpret_cast<const uint8_t*>(key), length));
+}
+
+// This file is also built for the host, where struct stat differs.  Hosts
+// without sub-second mtimes rely on the size and seconds alone.
+static inline uint32_t mtimeNsec(const struct stat& st) {
+#if defined(HAVE_ANDROID_OS)
+    return st.st_mtime_nsec;
+#elif defined(__APPLE__)
+    return st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    return st.st_mtim.tv_nsec;
+#else
+    (void)st;
+    return 0;
+#endif
+}
+
+static inline bool sameSource(const struct stat& st, int64_t mtime, uint32_t nsec,
+        int64_t size) {
+    return int64_t(st.st_mtime) == mtime && mtimeNsec(st) == nsec
+            && int64_t(st.st_size) == size;
+}
+
+
+// --- CompiledPropertyMap ---
+
+CompiledPropertyMap::CompiledPropertyMap(void* data, size_t size) :
+        mData(data), mSize(size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    mHeader = reinterpret_cast<const Header*>(bytes);
+    mEntries = reinterpret_cast<const Entry*>(bytes + sizeof(Header));
+    mBuckets = reinterpret_cast<const uint32_t*>(mEntries + mHeader->numEntries);
+    mStrings = reinterpret_cast<const char*>(mBuckets + mHeader->numBuckets);
+}
+
+CompiledPropertyMap::~CompiledPropertyMap() {
+    free(mData);
+}
+
+size_t CompiledPropertyMap::size() const {
+    return mHeader->numEntries;
+}
+
+const CompiledPropertyMap::Entry* CompiledPropertyMap::findEntry(const String8& key) const {
+    const uint32_t hash = hashKey(key.string(), key.length());
+    const uint32_t mask = mHeader->numBuckets - 1;
+    for (uint32_t i = hash & mask; mBuckets[i]; i = (i + 1) & mask) {
+        const Entry* entry = &mEntries[mBuckets[i] - 1];
+        if (entry->hash == hash && entry->keyLength == key.length()
+                && !memcmp(mStrings + entry->keyOffset, key.string(), key.length())) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool CompiledPropertyMap::hasProperty(const String8& key) const {
+    return findEntry(key) != NULL;
+}
+
+bool CompiledPropertyMap::tryGetProperty(const String8& key, String8& outValue) const {
+    const Entry* entry = findEntry(key);
+    if (!entry) {
+        return false;
+    }
+
+    outValue.setTo(mStrings + entry->valueOffset, entry->valueLength);
+    return true;
+}
+
+bool CompiledPropertyMap::tryGetProperty(const String8& key, bool& outValue) const {
+    int32_t intValue;
+    if (!tryGetProperty(key, intValue)) {
+        return false;
+    }
+
+    outValue = intValue;
+    return true;
+}
+
+bool CompiledPropertyMap::tryGetProperty(const String8& key, int32_t& outValue) const {
+    const Entry* entry = findEntry(key);
+    if (!entry || entry->valueLength == 0) {
+        return false;
+    }
+
+    if (!(entry->flags & HAS_INT32)) {
+        LOGW("Property key '%s' has invalid value '%s'.  Expected an integer.",
+                key.string(), mStrings + entry->valueOffset);
+        return false;
+    }
+    outValue = entry->int32Value;
+    return true;
+}
+
+bool CompiledPropertyMap::tryGetProperty(const String8& key, float& outValue) const {
+    const Entry* entry = findEntry(key);
+    if (!entry || entry->valueLength == 0) {
+        return false;
+    }
+
+    if (!(entry->flags & HAS_FLOAT)) {
+        LOGW("Property key '%s' has invalid value '%s'.  Expected a float.",
+                key.string(), mStrings + entry->valueOffset);
+        return false;
+    }
+    outValue = entry->floatValue;
+    return true;
+}
+
+void CompiledPropertyMap::addTo(PropertyMap* map) const {
+    for (uint32_t i = 0; i < mHeader->numEntries; i++) {
+        const Entry& entry = mEntries[i];
+        map->addProperty(String8(mStrings + entry.keyOffset, entry.keyLength),
+                String8(mStrings + entry.valueOffset, entry.valueLength));
+    }
+}
+
+status_t CompiledPropertyMap::writeToFile(const String8& filename) const {
+    String8 tempFilename(filename);
+    tempFilename.appendFormat(".%d.tmp", getpid());
+
+    int fd = ::open(tempFilename.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        status_t result = -errno;
+        LOGE("Error creating property cache '%s', %s.", tempFilename.string(), strerror(errno));
+        return result;
+    }
+
+    status_t result = NO_ERROR;
+    const uint8_t* p = static_cast<const uint8_t*>(mData);
+    size_t remaining = mSize;
+    while (remaining) {
+        ssize_t nwr = write(fd, p, remaining);
+        if (nwr < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = -errno;
+            LOGE("Error writing property cache '%s', %s.", tempFilename.string(), strerror(errno));
+            break;
+        }
+        p += nwr;
+        remaining -= nwr;
+    }
+    if (close(fd) && !result) {
+        result = -errno;
+        LOGE("Error writing property cache '%s', %s.", tempFilename.string(), strerror(errno));
+    }
+
+    if (!result && rename(tempFilename.string(), filename.string())) {
+        result = -errno;
+        LOGE("Error renaming property cache to '%s', %s.", filename.string(), strerror(errno));
+    }
+    if (result) {
+        unlink(tempFilename.string());
+    }
+    return result;
+}
+
+status_t CompiledPropertyMap::compile(const PropertyMap* map, const struct stat* sourceStat,
+        CompiledPropertyMap** outMap) {
+    *outMap = NULL;
+
+    const KeyedVector<String8, String8>& properties = map->getProperties();
+    const size_t numEntries = properties.size();
+    size_t numBuckets = 4;
+    while (numBuckets < numEntries * 2) {
+        numBuckets <<= 1;
+    }
+    size_t stringsSize = 0;
+    for (size_t i = 0; i < numEntries; i++) {
+        stringsSize += properties.keyAt(i).length() + properties.valueAt(i).length() + 2;
+    }
+    const size_t stringsOffset = sizeof(Header) + numEntries * sizeof(Entry)
+            + numBuckets * sizeof(uint32_t);
+    const size_t size = stringsOffset + stringsSize;
+    if (size > MAX_SIZE) {
+        LOGE("Property map is too large to compile.");
+        return BAD_VALUE;
+    }
+
+    uint8_t* data = static_cast<uint8_t*>(calloc(1, size));
+    if (!data) {
+        LOGE("Error allocating compiled property map.");
+        return NO_MEMORY;
+    }
+
+    Header* header = reinterpret_cast<Header*>(data);
+    header->magic = MAGIC;
+    header->version = VERSION;
+    if (sourceStat) {
+        header->sourceMtime = sourceStat->st_mtime;
+        header->sourceMtimeNsec = mtimeNsec(*sourceStat);
+        header->sourceSize = sourceStat->st_size;
+    } else {
+        header->sourceSize = -1;
+    }
+    header->numEntries = numEntries;
+    header->numBuckets = numBuckets;
+    header->stringsSize = stringsSize;
+
+    Entry* entries = reinterpret_cast<Entry*>(data + sizeof(Header));
+    uint32_t* buckets = reinterpret_cast<uint32_t*>(entries + numEntries);
+    char* strings = reinterpret_cast<char*>(data + stringsOffset);
+    size_t stringsPos = 0;
+    const uint32_t mask = numBuckets - 1;
+    for (size_t i = 0; i < numEntries; i++) {
+        const String8& key = properties.keyAt(i);
+        const String8& value = properties.valueAt(i);
+        Entry& entry = entries[i];
+
+        entry.hash = hashKey(key.string(), key.length());
+        entry.keyOffset = stringsPos;
+        entry.keyLength = key.length();
+        memcpy(strings + stringsPos, key.string(), key.length() + 1);
+        stringsPos += key.length() + 1;
+        entry.valueOffset = stringsPos;
+        entry.valueLength = value.length();
+        memcpy(strings + stringsPos, value.string(), value.length() + 1);
+        stringsPos += value.length() + 1;
+
+        // Parse the value as PropertyMap::tryGetProperty() would.
+        if (value.length()) {
+            char* end;
+            int intValue = strtol(value.string(), &end, 10);
+            if (*end == '\0') {
+                entry.flags |= HAS_INT32;
+                entry.int32Value = intValue;
+            }
+            float floatValue = strtof(value.string(), &end);
+            if (*end == '\0') {
+                entry.flags |= HAS_FLOAT;
+                entry.floatValue = floatValue;
+            }
+        }
+
+        uint32_t bucket = entry.hash & mask;
+        while (buckets[bucket]) {
+            bucket = (bucket + 1) & mask;
+        }
+        buckets[bucket] = i + 1;
+    }
+
+    *outMap = new CompiledPropertyMap(data, size);
+    return NO_ERROR;
+}
+
+bool CompiledPropertyMap::validate(const void* data, size_t size) {
+    if (size < sizeof(Header)) {
+        return false;
+    }
+    const Header* header = static_cast<const Header*>(data);
+    if (header->magic != MAGIC || header->version != VERSION) {
+        return false;
+    }
+    const size_t numEntries = header->numEntries;
+    const size_t numBuckets = header->numBuckets;
+    if (numEntries > size / sizeof(Entry) || numBuckets > size / sizeof(uint32_t)
+            || numBuckets < 4 || (numBuckets & (numBuckets - 1)) || numBuckets < numEntries * 2) {
+        return false;
+    }
+    const size_t stringsOffset = sizeof(Header) + numEntries * sizeof(Entry)
+            + numBuckets * sizeof(uint32_t);
+    if (stringsOffset + header->stringsSize != size) {
+        return false;
+    }
+
+    const Entry* entries = reinterpret_cast<const Entry*>(header + 1);
+    const uint32_t* buckets = reinterpret_cast<const uint32_t*>(entries + numEntries);
+    const char* strings = static_cast<const char*>(data) + stringsOffset;
+    for (size_t i = 0; i < numEntries; i++) {
+        const Entry& entry = entries[i];
+        if (entry.keyOffset >= header->stringsSize
+                || entry.keyLength >= header->stringsSize - entry.keyOffset
+                || strings[entry.keyOffset + entry.keyLength] != '\0'
+                || entry.valueOffset >= header->stringsSize
+                || entry.valueLength >= header->stringsSize - entry.valueOffset
+                || strings[entry.valueOffset + entry.valueLength] != '\0') {
+            return false;
+        }
+    }
+    size_t usedBuckets = 0;
+    for (size_t i = 0; i < numBuckets; i++) {
+        if (buckets[i] > numEntries) {
+            return false;
+        }
+        usedBuckets += buckets[i] != 0;
+    }
+    // Also guarantees an empty bucket, so lookups terminate.
+    return usedBuckets == numEntries;
+}
+
+status_t CompiledPropertyMap::loadCache(const String8& cacheFilename,
+        const String8& sourceFilename, CompiledPropertyMap** outMap) {
+    *outMap = NULL;
+
+    struct stat sourceStat;
+    if (stat(sourceFilename.string(), &sourceStat)) {
+        return NAME_NOT_FOUND;
+    }
+
+    int fd = ::open(cacheFilename.string(), O_RDONLY);
+    if (fd < 0) {
+        return NAME_NOT_FOUND;
+    }
+
+    status_t result = NAME_NOT_FOUND;
+    void* data = NULL;
+    struct stat cacheStat;
+    if (!fstat(fd, &cacheStat) && cacheStat.st_size >= off_t(sizeof(Header))
+            && cacheStat.st_size <= off_t(MAX_SIZE)) {
+        const size_t size = cacheStat.st_size;
+        data = malloc(size);
+        if (!data) {
+            result = NO_MEMORY;
+        } else {
+            size_t offset = 0;
+            while (offset < size) {
+                ssize_t nrd = read(fd, static_cast<uint8_t*>(data) + offset, size - offset);
+                if (nrd <= 0) {
+                    if (nrd < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                offset += nrd;
+            }
+
+            const Header* header = static_cast<const Header*>(data);
+            if (offset != size || !validate(data, size)) {
+                LOGW("Ignoring invalid property cache '%s'.", cacheFilename.string());
+            } else if (!sameSource(sourceStat, header->sourceMtime,
+                    header->sourceMtimeNsec, header->sourceSize)) {
+#if DEBUG_CACHE
+                LOGD("Property cache '%s' is out of date.", cacheFilename.string());
+#endif
+            } else {
+                *outMap = new CompiledPropertyMap(data, size);
+                data = NULL;
+                result = NO_ERROR;
+            }
+        }
+    }
+    free(data);
+    close(fd);
+    return result;
+}
+
+status_t CompiledPropertyMap::load(const String8& filename, const String8& cacheFilename,
+        CompiledPropertyMap** outMap) {
+    status_t status = loadCache(cacheFilename, filename, outMap);
+    if (status != NAME_NOT_FOUND) {
+        return status;
+    }
+
+    // Stat before parsing so that a change made while parsing leaves the
+    // cache out of date rather than hiding the change.
+    struct stat sourceStat;
+    if (stat(filename.string(), &sourceStat)) {
+        status = -errno;
+        LOGE("Error opening property file %s, %s.", filename.string(), strerror(errno));
+        return status;
+    }
+
+    PropertyMap* map;
+    status = PropertyMap::load(filename, &map);
+    if (status) {
+        return status;
+    }
+    status = compile(map, &sourceStat, outMap);
+    delete map;
+    if (status) {
+        return status;
+    }
+
+#if DEBUG_CACHE
+    LOGD("Writing property cache '%s' for '%s'.", cacheFilename.string(), filename.string());
+#endif
+    // The cache is only an optimization.
+    (*outMap)->writeToFile(cacheFilename);
+    return NO_ERROR;
+}
+
+} // namespace android
@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LatencyProfiler"
+
+#include <utils/LatencyProfiler.h>
+
+#include <utils/Atomic.h>
+#include <utils/CallStack.h>
+#include <utils/FlatHashtable.h>
+#include <utils/JenkinsHash.h>
+#include <utils/Log.h>
+#include <utils/Printer.h>
+#include <utils/Vector.h>
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+namespace android {
+
+volatile int32_t LatencyProfiler::sEnabled = 0;
+
+#if !defined(_WIN32)
+
+enum {
+    MAX_FRAMES = LatencyProfiler::MAX_FRAMES,
+    SAMPLES_PER_THREAD = 128,
+};
+
+// Events at least this long are always recorded.
+static const nsecs_t kAlwaysRecordNs = 1000000;
+
+struct Sample {
+    // Index of the sample in its thread's stream plus one, or 0 while the
+    // sample is being written.
+    volatile int32_t seq;
+    const char* label;
+    nsecs_t duration;
+    uint32_t weight;        // number of events the sample stands for
+    uint32_t depth;
+    uintptr_t pcs[MAX_FRAMES];
+};
+
+// Written only by its thread; read by print() without locking.
+struct ThreadBuffer {
+    Sample samples[SAMPLES_PER_THREAD];
+    uint32_t next;                  // index of the next sample to write
+    uint32_t events;                // events seen, for sampling
+    volatile int32_t resetSeq;      // samples up to this one are forgotten
+    bool inUse;
+    ThreadBuffer* link;
+};
+
+static pthread_once_t gKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;
+static volatile int32_t gSampleInterval = LatencyProfiler::DEFAULT_SAMPLE_INTERVAL;
+
+// Protects the list of buffers, which only ever grows. Buffers of exited
+// threads are reused by new threads.
+static pthread_mutex_t gBuffersLock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadBuffer* gBuffers = NULL;
+
+static void releaseThreadBuffer(void* arg) {
+    ThreadBuffer* buffer = static_cast<ThreadBuffer*>(arg);
+    pthread_mutex_lock(&gBuffersLock);
+    buffer->inUse = false;
+    pthread_mutex_unlock(&gBuffersLock);
+}
+
+static void createKey() {
+    pthread_key_create(&gKey, releaseThreadBuffer);
+}
+
+static ThreadBuffer* getThreadBuffer() {
+    pthread_once(&gKeyOnce, createKey);
+    ThreadBuffer* buffer = static_cast<ThreadBuffer*>(pthread_getspecific(gKey));
+    if (buffer != NULL) {
+        return buffer;
+    }
+
+    pthread_mutex_lock(&gBuffersLock);
+    for (buffer = gBuffers; buffer != NULL; buffer = buffer->link) {
+        if (!buffer->inUse) {
+            break;
+        }
+    }
+    if (buffer == NULL) {
+        buffer = static_cast<ThreadBuffer*>(calloc(1, sizeof(ThreadBuffer)));
+        if (buffer != NULL) {
+            buffer->link = gBuffers;
+            gBuffers = buffer;
+        }
+    }
+    if (buffer != NULL) {
+        buffer->inUse = true;
+    }
+    pthread_mutex_unlock(&gBuffersLock);
+
+    if (buffer != NULL) {
+        pthread_setspecific(gKey, buffer);
+    }
+    return buffer;
+}
+
+void LatencyProfiler::setEnabled(bool enabled, uint32_t sampleInterval) {
+    android_atomic_release_store(sampleInterval ? sampleInterval : 1, &gSampleInterval);
+    android_atomic_release_store(enabled ? 1 : 0, &sEnabled);
+}
+
+// Returns the buffer to record an event in, or NULL if the event is not
+// sampled. Sets outWeight to the number of events the sample stands for.
+static ThreadBuffer* sampleEvent(nsecs_t duration, uint32_t* outWeight) {
+    ThreadBuffer* buffer = getThreadBuffer();
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    uint32_t weight = 1;
+    if (duration < kAlwaysRecordNs) {
+        weight = uint32_t(gSampleInterval);
+        if (++buffer->events % weight) {
+            return NULL;
+        }
+    }
+    *outWeight = weight;
+    return buffer;
+}
+
+// Starts writing the next sample of the buffer; finishSample() publishes it.
+static Sample& startSample(ThreadBuffer* buffer, const char* label, nsecs_t duration,
+        uint32_t weight) {
+    Sample& sample = buffer->samples[buffer->next % SAMPLES_PER_THREAD];
+    android_atomic_release_store(0, &sample.seq);
+    sample.label = label;
+    sample.duration = duration;
+    sample.weight = weight;
+    return sample;
+}
+
+static void finishSample(ThreadBuffer* buffer, Sample& sample) {
+    uint32_t index = buffer->next++;
+    android_atomic_release_store(int32_t(index + 1), &sample.seq);
+}
+
+void LatencyProfiler::record(const char* label, nsecs_t duration, int32_t ignoreDepth) {
+    if (!isEnabled()) {
+        return;
+    }
+    uint32_t weight;
+    ThreadBuffer* buffer = sampleEvent(duration, &weight);
+    if (buffer == NULL) {
+        return;
+    }
+
+    Sample& sample = startSample(buffer, label, duration, weight);
+    sample.depth = CallStack::capture(sample.pcs, MAX_FRAMES, ignoreDepth + 1);
+    finishSample(buffer, sample);
+}
+
+void LatencyProfiler::captureStack(Stack* outStack, int32_t ignoreDepth) {
+    outStack->depth = CallStack::capture(outStack->pcs, MAX_FRAMES, ignoreDepth + 1);
+}
+
+void LatencyProfiler::record(const char* label, nsecs_t duration, const Stack& stack) {
+    if (!isEnabled()) {
+        return;
+    }
+    uint32_t weight;
+    ThreadBuffer* buffer = sampleEvent(duration, &weight);
+    if (buffer == NULL) {
+        return;
+    }
+
+    Sample& sample = startSample(buffer, label, duration, weight);
+    sample.depth = stack.depth < uint32_t(MAX_FRAMES) ? stack.depth : uint32_t(MAX_FRAMES);
+    memcpy(sample.pcs, stack.pcs, sample.depth * sizeof(uintptr_t));
+    finishSample(buffer, sample);
+}
+
+struct StackKey {
+    const char* label;
+    uint32_t depth;
+    uintptr_t pcs[MAX_FRAMES];
+
+    inline bool operator==(const StackKey& other) const {
+        return label == other.label && depth == other.depth
+                && !memcmp(pcs, other.pcs, depth * sizeof(uintptr_t));
+    }
+};
+
+template<> inline hash_t hash_type(const StackKey& key) {
+    uint32_t hash = JenkinsHashMix(0, uint32_t(uintptr_t(key.label)));
+    hash = JenkinsHashMixBytes(hash, reinterpret_cast<const uint8_t*>(key.pcs),
+            key.depth * sizeof(uintptr_t));
+    return JenkinsHashWhiten(hash);
+}
+
+struct StackStats {
+    StackKey key;
+    uint64_t events;
+    nsecs_t totalTime;
+    nsecs_t maxTime;
+};
+
+static int compareStackStats(const StackStats* const* lhs, const StackStats* const* rhs) {
+    if ((*lhs)->totalTime != (*rhs)->totalTime) {
+        return (*lhs)->totalTime > (*rhs)->totalTime ? -1 : 1;
+    }
+    return 0;
+}
+
+void LatencyProfiler::print(Printer& printer, size_t maxEntries) {
+    FlatHashtable<StackKey, StackStats> stacks;
+
+    pthread_mutex_lock(&gBuffersLock);
+    for (ThreadBuffer* buffer = gBuffers; buffer != NULL; buffer = buffer->link) {
+        const int32_t resetSeq = android_atomic_acquire_load(&buffer->resetSeq);
+        for (size_t i = 0; i < SAMPLES_PER_THREAD; i++) {
+            Sample& sample = buffer->samples[i];
+            const int32_t seq = android_atomic_acquire_load(&sample.seq);
+            if (seq == 0 || seq <= resetSeq) {
+                continue;
+            }
+            StackKey key;
+            memset(&key, 0, sizeof(key));
+            key.label = sample.label;
+            key.depth = sample.depth < uint32_t(MAX_FRAMES) ? sample.depth : uint32_t(MAX_FRAMES);
+            memcpy(key.pcs, sample.pcs, key.depth * sizeof(uintptr_t));
+            const nsecs_t duration = sample.duration;
+            const uint32_t weight = sample.weight;
+            // Drop the sample if its thread rewrote it while we copied it.
+            android_memory_barrier();
+            if (android_atomic_acquire_load(&sample.seq) != seq) {
+                continue;
+            }
+
+            ssize_t index = stacks.find(key);
+            if (index < 0) {
+                StackStats stats;
+                memset(&stats, 0, sizeof(stats));
+                stats.key = key;
+                index = stacks.add(key, stats);
+                if (index < 0) {
+                    continue;
+                }
+            }
+            StackStats& stats = stacks.editValueAt(index);
+            stats.events += weight;
+            stats.totalTime += duration * weight;
+            if (duration > stats.maxTime) {
+                stats.maxTime = duration;
+            }
+        }
+    }
+    pthread_mutex_unlock(&gBuffersLock);
+
+    Vector<const StackStats*> sorted;
+    sorted.setCapacity(stacks.size());
+    for (ssize_t i = stacks.next(-1); i >= 0; i = stacks.next(i)) {
+        sorted.push(&stacks.valueAt(i));
+    }
+    sorted.sort(compareStackStats);
+
+    printer.printFormatLine("Latency profile (1 in %d short events sampled, "
+            "counts and totals estimated):", int(gSampleInterval));
+    if (sorted.isEmpty()) {
+        printer.printLine("  (no samples)");
+    }
+    for (size_t i = 0; i < sorted.size() && i < maxEntries; i++) {
+        const StackStats& stats = *sorted[i];
+        printer.printFormatLine("  %s: %" PRIu64 " events, %.3fms total, %.3fms max",
+                stats.key.label, stats.events,
+                stats.totalTime / 1000000.0, stats.maxTime / 1000000.0);
+        for (size_t j = 0; j < stats.key.depth; j++) {
+            printer.printFormatLine("    %s",
+                    CallStack::formatFrame(j, stats.key.pcs[j]).string());
+        }
+    }
+}
+
+void LatencyProfiler::reset() {
+    pthread_mutex_lock(&gBuffersLock);
+    for (ThreadBuffer* buffer = gBuffers; buffer != NULL; buffer = buffer->link) {
+        // Racy against the owning thread, at worst keeping a sample or two.
+        android_atomic_release_store(int32_t(buffer->next), &buffer->resetSeq);
+    }
+    pthread_mutex_unlock(&gBuffersLock);
+}
+
+#else
+
+void LatencyProfiler::setEnabled(bool, uint32_t) {
+}
+
+void LatencyProfiler::record(const char*, nsecs_t, int32_t) {
+}
+
+void LatencyProfiler::captureStack(Stack* outStack, int32_t) {
+    outStack->depth = 0;
+}
+
+void LatencyProfiler::record(const char*, nsecs_t, const Stack&) {
+}
+
+void LatencyProfiler::print(Printer& printer, size_t) {
+    printer.printLine("Latency profile: not supported on this platform");
+}
+
+void LatencyProfiler::reset() {
+}
+
+#endif // !defined(_WIN32)
+
+}; // namespace android
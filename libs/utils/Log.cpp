@@ -16,6 +16,7 @@
 
 #define LOG_TAG "Log"
 
+#include <utils/LatencyProfiler.h>
 #include <utils/Log.h>
 #include <utils/Timers.h>
 
@@ -28,7 +29,9 @@ LogIfSlow::LogIfSlow(const char* tag, android_LogPriority priority,
 }
 
 LogIfSlow::~LogIfSlow() {
-    int durationMillis = nanoseconds_to_milliseconds(systemTime(SYSTEM_TIME_BOOTTIME) - mStart);
+    nsecs_t duration = systemTime(SYSTEM_TIME_BOOTTIME) - mStart;
+    LatencyProfiler::record(mMessage, duration);
+    int durationMillis = nanoseconds_to_milliseconds(duration);
     if (durationMillis > mTimeoutMillis) {
         LOG_PRI(mPriority, mTag, "%s: %dms", mMessage, durationMillis);
     }
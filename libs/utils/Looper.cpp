@@ -69,7 +69,8 @@ static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks) :
-        mAllowNonCallbacks(allowNonCallbacks), mSendingMessage(false),
+        mAllowNonCallbacks(allowNonCallbacks), mLock(Mutex::ADAPTIVE, "Looper::mLock"),
+        mSendingMessage(false),
         mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
         mNextRequestSeq(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
     mWakeEventFd = eventfd(0, EFD_NONBLOCK);
@@ -159,7 +160,11 @@ void Looper::rebuildEpollLocked() {
             errno);
 
     for (size_t i = 0; i < mRequests.size(); i++) {
-        const Request& request = mRequests.valueAt(i);
+        const Request& request = mRequests.itemAt(i);
+        if (request.fd < 0) {
+            continue;
+        }
+
         struct epoll_event eventItem;
         request.initEventItem(&eventItem);
 
@@ -294,14 +299,14 @@ int Looper::pollInner(int timeoutMillis) {
                 LOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
         } else {
-            ssize_t requestIndex = mRequests.indexOfKey(fd);
-            if (requestIndex >= 0) {
+            const Request* request = findRequestLocked(fd);
+            if (request != NULL) {
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= EVENT_INPUT;
                 if (epollEvents & EPOLLOUT) events |= EVENT_OUTPUT;
                 if (epollEvents & EPOLLERR) events |= EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= EVENT_HANGUP;
-                pushResponse(events, mRequests.valueAt(requestIndex));
+                pushResponse(events, *request);
             } else {
                 LOGW("Ignoring unexpected epoll events 0x%x on fd %d that is "
                         "no longer registered.", epollEvents, fd);
@@ -431,6 +436,16 @@ void Looper::pushResponse(int events, const Request& request) {
     mResponses.push(response);
 }
 
+const Looper::Request* Looper::findRequestLocked(int fd) const {
+    if (fd >= 0 && size_t(fd) < mRequests.size()) {
+        const Request& request = mRequests.itemAt(fd);
+        if (request.fd == fd) {
+            return &request;
+        }
+    }
+    return NULL;
+}
+
 int Looper::addFd(int fd, int ident, int events, Looper_callbackFunc callback, void* data) {
     return addFd(fd, ident, events, callback ? new SimpleLooperCallback(callback) : NULL, data);
 }
@@ -455,6 +470,11 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
         ident = POLL_CALLBACK;
     }
 
+    if (fd < 0) {
+        LOGE("Invalid attempt to add fd %d.", fd);
+        return -1;
+    }
+
     { // acquire lock
         AutoMutex _l(mLock);
 
@@ -470,14 +490,21 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
         struct epoll_event eventItem;
         request.initEventItem(&eventItem);
 
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
+        if (findRequestLocked(fd) == NULL) {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
             if (epollResult < 0) {
                 LOGE("Error adding epoll events for fd %d, errno=%d", fd, errno);
                 return -1;
             }
-            mRequests.add(fd, request);
+            if (size_t(fd) >= mRequests.size()) {
+                // Grow the table geometrically with empty slots.
+                size_t newSize = mRequests.size() * 2;
+                if (newSize <= size_t(fd)) {
+                    newSize = fd + 1;
+                }
+                mRequests.insertAt(Request(), mRequests.size(), newSize - mRequests.size());
+            }
+            mRequests.editItemAt(fd) = request;
         } else {
             int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, & eventItem);
             if (epollResult < 0) {
@@ -512,7 +539,7 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                     return -1;
                 }
             }
-            mRequests.replaceValueAt(requestIndex, request);
+            mRequests.editItemAt(fd) = request;
         }
     } // release lock
     return 1;
@@ -529,23 +556,23 @@ int Looper::removeFd(int fd, int seq) {
 
     { // acquire lock
         AutoMutex _l(mLock);
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
+        const Request* request = findRequestLocked(fd);
+        if (request == NULL) {
             return 0;
         }
 
         // Check the sequence number if one was given.
-        if (seq != -1 && mRequests.valueAt(requestIndex).seq != seq) {
+        if (seq != -1 && request->seq != seq) {
 #if DEBUG_CALLBACKS
             LOGD("%p ~ removeFd - sequence number mismatch, oldSeq=%d",
-                    this, mRequests.valueAt(requestIndex).seq);
+                    this, request->seq);
 #endif
             return 0;
         }
 
         // Always remove the FD from the request map even if an error occurs while
         // updating the epoll set so that we avoid accidentally leaking callbacks.
-        mRequests.removeItemsAt(requestIndex);
+        mRequests.editItemAt(fd) = Request();
 
         int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
         if (epollResult < 0) {
@@ -668,6 +695,7 @@ void Looper::Request::initEventItem(struct epoll_event* eventItem) const {
     int epollEvents = 0;
     if (events & EVENT_INPUT) epollEvents |= EPOLLIN;
     if (events & EVENT_OUTPUT) epollEvents |= EPOLLOUT;
+    if (events & EVENT_OPTION_EDGE_TRIGGERED) epollEvents |= EPOLLET;
 
     memset(eventItem, 0, sizeof(epoll_event)); // zero out unused members of data field union
     eventItem->events = epollEvents;
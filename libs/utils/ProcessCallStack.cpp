@@ -23,6 +23,7 @@
 
 #include <utils/Log.h>
 #include <utils/Errors.h>
+#include <utils/LatencyProfiler.h>
 #include <utils/ProcessCallStack.h>
 #include <utils/Printer.h>
 
@@ -233,6 +234,11 @@ void ProcessCallStack::printInternal(Printer& printer, Printer& csPrinter) const
         threadInfo.callStack.print(csPrinter);
     }
 
+    if (LatencyProfiler::isEnabled()) {
+        printer.printLine("");
+        LatencyProfiler::print(printer);
+    }
+
     dumpProcessFooter(printer, getpid());
 }
 
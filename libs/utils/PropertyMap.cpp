@@ -154,7 +154,9 @@ status_t PropertyMap::load(const String8& filename, PropertyMap** outMap) {
 // --- PropertyMap::Parser ---
 
 PropertyMap::Parser::Parser(PropertyMap* map, Tokenizer* tokenizer) :
-        mMap(map), mTokenizer(tokenizer) {
+        mMap(map), mTokenizer(tokenizer),
+        mWhitespace(WHITESPACE),
+        mWhitespaceOrPropertyDelimiter(WHITESPACE_OR_PROPERTY_DELIMITER) {
 }
 
 PropertyMap::Parser::~Parser() {
@@ -163,20 +165,21 @@ PropertyMap::Parser::~Parser() {
 status_t PropertyMap::Parser::parse() {
     while (!mTokenizer->isEof()) {
 #if DEBUG_PARSER
-        LOGD("Parsing %s: '%s'.", mTokenizer->getLocation().string(),
-                mTokenizer->peekRemainderOfLine().string());
+        Tokenizer::Token line = mTokenizer->peekRemainderOfLineToken();
+        LOGD("Parsing %s: '%.*s'.", mTokenizer->getLocation().string(),
+                int(line.length), line.data);
 #endif
 
-        mTokenizer->skipDelimiters(WHITESPACE);
+        mTokenizer->skipDelimiters(mWhitespace);
 
         if (!mTokenizer->isEol() && mTokenizer->peekChar() != '#') {
-            String8 keyToken = mTokenizer->nextToken(WHITESPACE_OR_PROPERTY_DELIMITER);
+            Tokenizer::Token keyToken = mTokenizer->nextToken(mWhitespaceOrPropertyDelimiter);
             if (keyToken.isEmpty()) {
                 LOGE("%s: Expected non-empty property key.", mTokenizer->getLocation().string());
                 return BAD_VALUE;
             }
 
-            mTokenizer->skipDelimiters(WHITESPACE);
+            mTokenizer->skipDelimiters(mWhitespace);
 
             if (mTokenizer->nextChar() != '=') {
                 LOGE("%s: Expected '=' between property key and value.",
@@ -184,30 +187,31 @@ status_t PropertyMap::Parser::parse() {
                 return BAD_VALUE;
             }
 
-            mTokenizer->skipDelimiters(WHITESPACE);
+            mTokenizer->skipDelimiters(mWhitespace);
 
-            String8 valueToken = mTokenizer->nextToken(WHITESPACE);
-            if (valueToken.find("\\", 0) >= 0 || valueToken.find("\"", 0) >= 0) {
+            Tokenizer::Token valueToken = mTokenizer->nextToken(mWhitespace);
+            if (valueToken.contains('\\') || valueToken.contains('"')) {
                 LOGE("%s: Found reserved character '\\' or '\"' in property value.",
                         mTokenizer->getLocation().string());
                 return BAD_VALUE;
             }
 
-            mTokenizer->skipDelimiters(WHITESPACE);
+            mTokenizer->skipDelimiters(mWhitespace);
             if (!mTokenizer->isEol()) {
-                LOGE("%s: Expected end of line, got '%s'.",
-                        mTokenizer->getLocation().string(),
-                        mTokenizer->peekRemainderOfLine().string());
+                Tokenizer::Token rest = mTokenizer->peekRemainderOfLineToken();
+                LOGE("%s: Expected end of line, got '%.*s'.",
+                        mTokenizer->getLocation().string(), int(rest.length), rest.data);
                 return BAD_VALUE;
             }
 
-            if (mMap->hasProperty(keyToken)) {
+            String8 key(keyToken.data, keyToken.length);
+            if (mMap->hasProperty(key)) {
                 LOGE("%s: Duplicate property value for key '%s'.",
-                        mTokenizer->getLocation().string(), keyToken.string());
+                        mTokenizer->getLocation().string(), key.string());
                 return BAD_VALUE;
             }
 
-            mMap->addProperty(keyToken, valueToken);
+            mMap->addProperty(key, String8(valueToken.data, valueToken.length));
         }
 
         mTokenizer->nextLine();
@@ -1775,7 +1775,7 @@ void ResTable::Theme::dumpToLog() const
 }
 
 ResTable::ResTable()
-    : mError(NO_INIT)
+    : mLock(Mutex::ADAPTIVE, "ResTable::mLock"), mError(NO_INIT)
 {
     memset(&mParams, 0, sizeof(mParams));
     memset(mPackageMap, 0, sizeof(mPackageMap));
@@ -1783,7 +1783,7 @@ ResTable::ResTable()
 }
 
 ResTable::ResTable(const void* data, size_t size, void* cookie, bool copyData)
-    : mError(NO_INIT)
+    : mLock(Mutex::ADAPTIVE, "ResTable::mLock"), mError(NO_INIT)
 {
     memset(&mParams, 0, sizeof(mParams));
     memset(mPackageMap, 0, sizeof(mPackageMap));
@@ -22,11 +22,293 @@
 #include <cutils/log.h>
 #include <utils/SharedBuffer.h>
 #include <utils/Atomic.h>
+#include <utils/Printer.h>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+// Set to 0 to allocate every buffer with malloc().
+#define USE_SIZE_CLASSES 1
+#else
+#define USE_SIZE_CLASSES 0
+#endif
 
 // ---------------------------------------------------------------------------
 
 namespace android {
 
+#if USE_SIZE_CLASSES
+
+// Small buffers come from blocks of a few fixed payload sizes. Freed blocks
+// are kept on per-thread lists, so the common alloc/free pair touches no
+// lock and no shared cache line. A thread whose list overflows hands half
+// of it to a global depot, which refills threads whose list runs dry.
+enum {
+    NUM_CLASSES = 8,
+    MAX_CACHED_PER_THREAD = 32,
+    MAX_CACHED_GLOBAL = 256,
+};
+
+static const size_t kClassSizes[NUM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256
+};
+
+// Size class for each payload size, indexed by the size in 16-byte units
+// rounded up.
+static const uint8_t kClassForUnits[] = {
+    0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7
+};
+
+static inline ssize_t classForSize(size_t size) {
+    return size <= kClassSizes[NUM_CLASSES - 1] ? kClassForUnits[(size + 15) >> 4] : -1;
+}
+
+static inline size_t blockSize(size_t sc) {
+    return sizeof(SharedBuffer) + kClassSizes[sc];
+}
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct Counters {
+    size_t smallAllocs;
+    size_t cacheHits;
+    size_t largeAllocs;
+    size_t inPlaceResizes;
+
+    void add(const Counters& other) {
+        smallAllocs += other.smallAllocs;
+        cacheHits += other.cacheHits;
+        largeAllocs += other.largeAllocs;
+        inPlaceResizes += other.inPlaceResizes;
+    }
+};
+
+struct ThreadCache {
+    FreeBlock* lists[NUM_CLASSES];
+    size_t counts[NUM_CLASSES];
+    Counters counters;
+    ThreadCache* prev;
+    ThreadCache* next;
+};
+
+// Stored as the thread's cache once it has been torn down, so buffers freed
+// by later thread-exit destructors go straight to the depot.
+static ThreadCache* const kNoCache = reinterpret_cast<ThreadCache*>(1);
+
+static pthread_once_t gKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;
+
+// Protects everything below. gDepotCounts is also read without the lock as
+// a hint, so it is only written with release stores.
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static FreeBlock* gDepot[NUM_CLASSES];
+static volatile int32_t gDepotCounts[NUM_CLASSES];
+static ThreadCache* gCaches;
+static Counters gRetiredCounters;   // from threads that have exited
+
+static inline void pushDepotLocked(size_t sc, FreeBlock* block) {
+    block->next = gDepot[sc];
+    gDepot[sc] = block;
+    android_atomic_release_store(gDepotCounts[sc] + 1, &gDepotCounts[sc]);
+}
+
+static inline FreeBlock* popDepotLocked(size_t sc) {
+    FreeBlock* block = gDepot[sc];
+    if (block) {
+        gDepot[sc] = block->next;
+        android_atomic_release_store(gDepotCounts[sc] - 1, &gDepotCounts[sc]);
+    }
+    return block;
+}
+
+// Moves up to 'count' blocks from the thread's list to the depot, and frees
+// those the depot has no room for.
+static void flushLocked(ThreadCache* tc, size_t sc, size_t count, FreeBlock** toFree) {
+    while (count-- && tc->lists[sc]) {
+        FreeBlock* block = tc->lists[sc];
+        tc->lists[sc] = block->next;
+        tc->counts[sc]--;
+        if (gDepotCounts[sc] < MAX_CACHED_GLOBAL) {
+            pushDepotLocked(sc, block);
+        } else {
+            block->next = *toFree;
+            *toFree = block;
+        }
+    }
+}
+
+static void freeBlocks(FreeBlock* block) {
+    while (block) {
+        FreeBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+static void destroyThreadCache(void* arg) {
+    ThreadCache* tc = static_cast<ThreadCache*>(arg);
+    if (tc == kNoCache) {
+        return;
+    }
+    FreeBlock* toFree = NULL;
+    pthread_mutex_lock(&gLock);
+    for (size_t sc = 0; sc < NUM_CLASSES; sc++) {
+        flushLocked(tc, sc, tc->counts[sc], &toFree);
+    }
+    gRetiredCounters.add(tc->counters);
+    if (tc->prev) {
+        tc->prev->next = tc->next;
+    } else {
+        gCaches = tc->next;
+    }
+    if (tc->next) {
+        tc->next->prev = tc->prev;
+    }
+    pthread_mutex_unlock(&gLock);
+    freeBlocks(toFree);
+    free(tc);
+    pthread_setspecific(gKey, kNoCache);
+}
+
+// The depot and the cache list are only touched with gLock held, so holding
+// it across fork() leaves them consistent in the child. The caches of the
+// threads that did not survive the fork are dropped; their blocks are leaked
+// rather than walked, since those threads may have been changing them.
+static void prepareFork() {
+    pthread_mutex_lock(&gLock);
+}
+
+static void parentAfterFork() {
+    pthread_mutex_unlock(&gLock);
+}
+
+static void childAfterFork() {
+    ThreadCache* self = static_cast<ThreadCache*>(pthread_getspecific(gKey));
+    ThreadCache* tc = gCaches;
+    while (tc) {
+        ThreadCache* next = tc->next;
+        if (tc != self) {
+            gRetiredCounters.add(tc->counters);
+            free(tc);
+        }
+        tc = next;
+    }
+    gCaches = NULL;
+    if (self && self != kNoCache) {
+        self->prev = self->next = NULL;
+        gCaches = self;
+    }
+    pthread_mutex_unlock(&gLock);
+}
+
+static void createKey() {
+    pthread_key_create(&gKey, destroyThreadCache);
+    pthread_atfork(prepareFork, parentAfterFork, childAfterFork);
+}
+
+static ThreadCache* getThreadCache() {
+    pthread_once(&gKeyOnce, createKey);
+    ThreadCache* tc = static_cast<ThreadCache*>(pthread_getspecific(gKey));
+    if (tc == kNoCache) {
+        return NULL;
+    }
+    if (tc == NULL) {
+        tc = static_cast<ThreadCache*>(calloc(1, sizeof(ThreadCache)));
+        if (tc == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&gLock);
+        tc->next = gCaches;
+        if (gCaches) {
+            gCaches->prev = tc;
+        }
+        gCaches = tc;
+        pthread_mutex_unlock(&gLock);
+        pthread_setspecific(gKey, tc);
+    }
+    return tc;
+}
+
+static void* allocBlock(size_t sc) {
+    ThreadCache* tc = getThreadCache();
+    FreeBlock* block;
+    if (tc) {
+        tc->counters.smallAllocs++;
+        if (tc->lists[sc] == NULL && android_atomic_acquire_load(&gDepotCounts[sc])) {
+            // Refill half a list's worth from the depot. gDepotCounts is
+            // only a hint outside the lock.
+            pthread_mutex_lock(&gLock);
+            for (size_t n = MAX_CACHED_PER_THREAD / 2; n && gDepot[sc]; n--) {
+                block = popDepotLocked(sc);
+                block->next = tc->lists[sc];
+                tc->lists[sc] = block;
+                tc->counts[sc]++;
+            }
+            pthread_mutex_unlock(&gLock);
+        }
+        block = tc->lists[sc];
+        if (block) {
+            tc->lists[sc] = block->next;
+            tc->counts[sc]--;
+            tc->counters.cacheHits++;
+            return block;
+        }
+    } else {
+        pthread_mutex_lock(&gLock);
+        gRetiredCounters.smallAllocs++;
+        block = popDepotLocked(sc);
+        if (block) {
+            gRetiredCounters.cacheHits++;
+        }
+        pthread_mutex_unlock(&gLock);
+        if (block) {
+            return block;
+        }
+    }
+    return malloc(blockSize(sc));
+}
+
+static void freeBlock(void* ptr, size_t sc) {
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    ThreadCache* tc = getThreadCache();
+    if (tc) {
+        block->next = tc->lists[sc];
+        tc->lists[sc] = block;
+        if (++tc->counts[sc] > MAX_CACHED_PER_THREAD) {
+            FreeBlock* toFree = NULL;
+            pthread_mutex_lock(&gLock);
+            flushLocked(tc, sc, MAX_CACHED_PER_THREAD / 2, &toFree);
+            pthread_mutex_unlock(&gLock);
+            freeBlocks(toFree);
+        }
+        return;
+    }
+    pthread_mutex_lock(&gLock);
+    if (gDepotCounts[sc] < MAX_CACHED_GLOBAL) {
+        pushDepotLocked(sc, block);
+        block = NULL;
+    }
+    pthread_mutex_unlock(&gLock);
+    free(block);
+}
+
+static inline void countLargeAlloc() {
+    ThreadCache* tc = getThreadCache();
+    if (tc) {
+        tc->counters.largeAllocs++;
+    }
+}
+
+static inline void countInPlaceResize() {
+    ThreadCache* tc = getThreadCache();
+    if (tc) {
+        tc->counters.inPlaceResizes++;
+    }
+}
+
+#endif // USE_SIZE_CLASSES
+
 SharedBuffer* SharedBuffer::alloc(size_t size)
 {
     // Don't overflow if the combined size of the buffer / header is larger than
@@ -34,7 +316,25 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
     LOG_ALWAYS_FATAL_IF((size >= (SIZE_MAX - sizeof(SharedBuffer))),
                         "Invalid buffer size %zu", size);
 
-    SharedBuffer* sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
+    SharedBuffer* sb;
+#if USE_SIZE_CLASSES
+    ssize_t sc = classForSize(size);
+    if (sc >= 0) {
+        sb = static_cast<SharedBuffer *>(allocBlock(sc));
+        if (sb) {
+            sb->mClass = sc + 1;
+        }
+    } else
+#endif
+    {
+        sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
+        if (sb) {
+            sb->mClass = 0;
+        }
+#if USE_SIZE_CLASSES
+        countLargeAlloc();
+#endif
+    }
     if (sb) {
         sb->mRefs = 1;
         sb->mSize = size;
@@ -42,11 +342,21 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
     return sb;
 }
 
+void SharedBuffer::freeStorage(const SharedBuffer* buf)
+{
+#if USE_SIZE_CLASSES
+    if (buf->mClass) {
+        freeBlock(const_cast<SharedBuffer*>(buf), buf->mClass - 1);
+        return;
+    }
+#endif
+    free(const_cast<SharedBuffer*>(buf));
+}
 
 ssize_t SharedBuffer::dealloc(const SharedBuffer* released)
 {
     if (released->mRefs != 0) return -1; // XXX: invalid operation
-    free(const_cast<SharedBuffer*>(released));
+    freeStorage(released);
     return 0;
 }
 
@@ -73,10 +383,23 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
         LOG_ALWAYS_FATAL_IF((newSize >= (SIZE_MAX - sizeof(SharedBuffer))),
                             "Invalid buffer size %zu", newSize);
 
-        buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
-        if (buf != NULL) {
-            buf->mSize = newSize;
-            return buf;
+#if USE_SIZE_CLASSES
+        if (buf->mClass) {
+            // Stay in the block while the new size maps to the same class;
+            // otherwise fall through to allocating a new buffer.
+            if (classForSize(newSize) == ssize_t(buf->mClass - 1)) {
+                buf->mSize = newSize;
+                countInPlaceResize();
+                return buf;
+            }
+        } else
+#endif
+        {
+            buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
+            if (buf != NULL) {
+                buf->mSize = newSize;
+                return buf;
+            }
         }
     }
     SharedBuffer* sb = alloc(newSize);
@@ -116,11 +439,51 @@ int32_t SharedBuffer::release(uint32_t flags) const
     if (onlyOwner() || ((prev = android_atomic_dec(&mRefs)) == 1)) {
         mRefs = 0;
         if ((flags & eKeepStorage) == 0) {
-            free(const_cast<SharedBuffer*>(this));
+            freeStorage(this);
         }
     }
     return prev;
 }
 
+void SharedBuffer::getStats(Stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#if USE_SIZE_CLASSES
+    pthread_mutex_lock(&gLock);
+    Counters counters = gRetiredCounters;
+    for (size_t sc = 0; sc < NUM_CLASSES; sc++) {
+        stats->numCachedBlocks += gDepotCounts[sc];
+        stats->cachedBytes += gDepotCounts[sc] * blockSize(sc);
+    }
+    for (ThreadCache* tc = gCaches; tc != NULL; tc = tc->next) {
+        // Read without the owning thread's cooperation, hence approximate.
+        counters.add(tc->counters);
+        for (size_t sc = 0; sc < NUM_CLASSES; sc++) {
+            stats->numCachedBlocks += tc->counts[sc];
+            stats->cachedBytes += tc->counts[sc] * blockSize(sc);
+        }
+    }
+    pthread_mutex_unlock(&gLock);
+    stats->numSmallAllocs = counters.smallAllocs;
+    stats->numCacheHits = counters.cacheHits;
+    stats->numLargeAllocs = counters.largeAllocs;
+    stats->numInPlaceResizes = counters.inPlaceResizes;
+#endif
+}
+
+void SharedBuffer::dumpStats(int fd, int indent)
+{
+    Stats stats;
+    getStats(&stats);
+
+    FdPrinter printer(fd, indent);
+    printer.printFormatLine("SharedBuffer allocations:");
+    printer.printFormatLine("  small: %zu (%zu from cache)",
+            stats.numSmallAllocs, stats.numCacheHits);
+    printer.printFormatLine("  large: %zu", stats.numLargeAllocs);
+    printer.printFormatLine("  resized in place: %zu", stats.numInPlaceResizes);
+    printer.printFormatLine("  cached: %zu blocks, %zu bytes",
+            stats.numCachedBlocks, stats.cachedBytes);
+}
 
 }; // namespace android
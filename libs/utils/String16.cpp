@@ -16,6 +16,8 @@
 
 #include <utils/String16.h>
 
+#include <utils/FlatHashtable.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 #include <utils/Unicode.h>
 #include <utils/String8.h>
@@ -31,6 +33,27 @@ namespace android {
 static SharedBuffer* gEmptyStringBuf = NULL;
 static char16_t* gEmptyString = NULL;
 
+// The intern table's keys point at the storage of the String16 they map to,
+// which never moves, or at the caller's string during lookups.
+struct InternKey {
+    const char16_t* str;
+    size_t len;
+
+    inline bool operator==(const InternKey& other) const {
+        return len == other.len && !memcmp(str, other.str, len * sizeof(char16_t));
+    }
+};
+
+template<> inline hash_t hash_type(const InternKey& key) {
+    return JenkinsHashWhiten(JenkinsHashMixShorts(0,
+            reinterpret_cast<const uint16_t*>(key.str), key.len));
+}
+
+typedef FlatHashtable<InternKey, String16> InternTable;
+
+static Mutex* gInternLock = NULL;
+static InternTable* gInternTable = NULL;
+
 static inline char16_t* getEmptyString()
 {
     gEmptyStringBuf->acquire();
@@ -44,10 +67,17 @@ void initialize_string16()
     *str = 0;
     gEmptyStringBuf = buf;
     gEmptyString = str;
+    gInternLock = new Mutex();
+    gInternTable = new InternTable();
 }
 
 void terminate_string16()
 {
+    delete gInternTable;
+    delete gInternLock;
+    gInternTable = NULL;
+    gInternLock = NULL;
+
     SharedBuffer::bufferFromData(gEmptyString)->release();
     gEmptyStringBuf = NULL;
     gEmptyString = NULL;
@@ -382,6 +412,41 @@ status_t String16::replaceAll(char16_t replaceThis, char16_t withThis)
     return NO_ERROR;
 }
 
+String16 String16::intern() const
+{
+    InternKey key;
+    key.str = mString;
+    key.len = size();
+    const hash_t hash = hash_type(key);
+
+    Mutex::Autolock _l(*gInternLock);
+    ssize_t index = gInternTable->find(hash, key);
+    if (index >= 0) {
+        return gInternTable->valueAt(index);
+    }
+
+    // The table keeps its own reference, so the interned storage is never
+    // edited in place: edits through any String16 copy it first. If the
+    // table can't grow, the string is simply not interned.
+    gInternTable->add(hash, key, *this);
+    return *this;
+}
+
+String16 String16::findInterned() const
+{
+    InternKey key;
+    key.str = mString;
+    key.len = size();
+    const hash_t hash = hash_type(key);
+
+    Mutex::Autolock _l(*gInternLock);
+    ssize_t index = gInternTable->find(hash, key);
+    if (index >= 0) {
+        return gInternTable->valueAt(index);
+    }
+    return *this;
+}
+
 status_t String16::remove(size_t len, size_t begin)
 {
     const size_t N = size();
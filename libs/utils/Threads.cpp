@@ -19,9 +19,11 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <memory.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #if !defined(_WIN32)
@@ -41,6 +43,8 @@
 
 #include <utils/threads.h>
 #include <utils/Log.h>
+#include <utils/Atomic.h>
+#include <utils/Printer.h>
 
 #include <cutils/sched_policy.h>
 
@@ -351,7 +355,200 @@ namespace android {
  */
 
 #if !defined(_WIN32)
-// implemented as inlines in threads.h
+// Mostly implemented as inlines in threads.h. What is here only runs for
+// ADAPTIVE and PROFILE mutexes, and while the LatencyProfiler is enabled.
+
+// Upper bound on the spins of an ADAPTIVE mutex before it sleeps.
+static const int kMaxMutexSpins = 100;
+
+static inline void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+struct MutexProfile {
+    enum { NAME_MAX_LEN = 47, NUM_SITES = 4 };
+
+    // The call sites that held the mutex while others waited, with the
+    // number of waits and the time waited.
+    struct Site {
+        const void* pc;
+        uint32_t waits;
+        nsecs_t waitTime;
+    };
+
+    char name[NAME_MAX_LEN + 1];
+    // Everything below is only written with the mutex held.
+    uint32_t acquisitions;
+    uint32_t contentions;
+    nsecs_t totalWaitTime;
+    nsecs_t maxWaitTime;
+    const void* holderPc;
+    Site sites[NUM_SITES];
+
+    MutexProfile* prev;
+    MutexProfile* next;
+};
+
+// All live profiles, for dumpContention().
+static pthread_mutex_t gMutexProfilesLock = PTHREAD_MUTEX_INITIALIZER;
+static MutexProfile* gMutexProfiles = NULL;
+
+void Mutex::initFlags(int type, const char* name)
+{
+    mFlags = type & (ADAPTIVE | PROFILE);
+    if (type & PROFILE) {
+        MutexProfile* profile = static_cast<MutexProfile*>(calloc(1, sizeof(MutexProfile)));
+        if (profile == NULL) {
+            return;
+        }
+        strncpy(profile->name, name ? name : "(unnamed)", MutexProfile::NAME_MAX_LEN);
+        pthread_mutex_lock(&gMutexProfilesLock);
+        profile->next = gMutexProfiles;
+        if (gMutexProfiles) {
+            gMutexProfiles->prev = profile;
+        }
+        gMutexProfiles = profile;
+        pthread_mutex_unlock(&gMutexProfilesLock);
+        mProfile = profile;
+    }
+}
+
+void Mutex::destroyProfile()
+{
+    pthread_mutex_lock(&gMutexProfilesLock);
+    if (mProfile->prev) {
+        mProfile->prev->next = mProfile->next;
+    } else {
+        gMutexProfiles = mProfile->next;
+    }
+    if (mProfile->next) {
+        mProfile->next->prev = mProfile->prev;
+    }
+    pthread_mutex_unlock(&gMutexProfilesLock);
+    free(mProfile);
+    mProfile = NULL;
+}
+
+status_t Mutex::lockSlow()
+{
+    // lock() is inlined, so this is the call site of lock().
+    const void* const caller = __builtin_return_address(0);
+    MutexProfile* const profile = mProfile;
+
+    if (pthread_mutex_trylock(&mMutex) == 0) {
+        if (profile) {
+            profile->acquisitions++;
+            profile->holderPc = caller;
+        }
+        return NO_ERROR;
+    }
+
+    // Racy, but only used to attribute the wait.
+    const void* const holder = profile ? profile->holderPc : NULL;
+    const bool timed = profile || LatencyProfiler::isEnabled();
+
+    // Unwind now rather than once the lock is held, so that the unwinder,
+    // which may take the loader's lock, doesn't lengthen the critical
+    // section. Attributed to the caller of lock(), not to this function.
+    LatencyProfiler::Stack stack;
+    const bool profiled = LatencyProfiler::isEnabled();
+    if (profiled) {
+        LatencyProfiler::captureStack(&stack, 1);
+    }
+    const nsecs_t start = timed ? systemTime() : 0;
+
+    int err = EBUSY;
+    int spins = 0;
+    if (mFlags & ADAPTIVE) {
+        // Spin for up to about twice as long as it recently took the lock to
+        // come free.
+        const int recent = mSpinCount >> 3;
+        const int maxSpins = recent * 2 + 10 < kMaxMutexSpins ?
+                recent * 2 + 10 : kMaxMutexSpins;
+        while (spins < maxSpins) {
+            spins++;
+            cpuRelax();
+            if (pthread_mutex_trylock(&mMutex) == 0) {
+                err = 0;
+                break;
+            }
+        }
+    }
+    if (err) {
+        err = pthread_mutex_lock(&mMutex);
+        if (err) {
+            return -err;
+        }
+    }
+    if (mFlags & ADAPTIVE) {
+        // Keep a running average of the spins, now that the lock protects it.
+        // It is kept in fixed point so that it decays all the way to 0;
+        // integer division would leave it stuck up to 7 spins too high.
+        mSpinCount += spins - (mSpinCount >> 3);
+    }
+
+    const nsecs_t waited = timed ? systemTime() - start : 0;
+    if (profiled) {
+        LatencyProfiler::record("Mutex::lock", waited, stack);
+    }
+    if (profile) {
+        profile->acquisitions++;
+        profile->contentions++;
+        profile->totalWaitTime += waited;
+        if (waited > profile->maxWaitTime) {
+            profile->maxWaitTime = waited;
+        }
+        // Charge the wait to the holder's site, replacing the site that has
+        // cost the least if all slots are taken.
+        MutexProfile::Site* site = &profile->sites[0];
+        for (size_t i = 0; i < MutexProfile::NUM_SITES; i++) {
+            MutexProfile::Site* s = &profile->sites[i];
+            if (s->pc == holder) {
+                site = s;
+                break;
+            }
+            if (s->waitTime < site->waitTime) {
+                site = s;
+            }
+        }
+        if (site->pc != holder) {
+            site->pc = holder;
+            site->waits = 0;
+            site->waitTime = 0;
+        }
+        site->waits++;
+        site->waitTime += waited;
+        profile->holderPc = caller;
+    }
+    return NO_ERROR;
+}
+
+void Mutex::dumpContention(int fd)
+{
+    FdPrinter printer(fd);
+    pthread_mutex_lock(&gMutexProfilesLock);
+    for (const MutexProfile* p = gMutexProfiles; p != NULL; p = p->next) {
+        printer.printFormatLine("%s: %u acquisitions, %u contended, "
+                "wait total %" PRId64 "us max %" PRId64 "us",
+                p->name, p->acquisitions, p->contentions,
+                p->totalWaitTime / 1000, p->maxWaitTime / 1000);
+        for (size_t i = 0; i < MutexProfile::NUM_SITES; i++) {
+            const MutexProfile::Site& site = p->sites[i];
+            if (site.waits) {
+                printer.printFormatLine("  held at %p: %u waits, %" PRId64 "us",
+                        site.pc, site.waits, site.waitTime / 1000);
+            }
+        }
+    }
+    pthread_mutex_unlock(&gMutexProfilesLock);
+}
+
 #else
 
 Mutex::Mutex()
@@ -414,6 +611,11 @@ status_t Mutex::tryLock()
     return (dwWaitResult == WAIT_OBJECT_0) ? 0 : -1;
 }
 
+void Mutex::dumpContention(int fd)
+{
+    // ADAPTIVE and PROFILE are ignored on Windows.
+}
+
 #endif // !defined(_WIN32)
 
 
@@ -648,6 +850,149 @@ void Condition::broadcast()
 
 #endif // !defined(_WIN32)
 
+/*
+ * ===========================================================================
+ *      ShardedRWLock class
+ * ===========================================================================
+ */
+
+#if !defined(_WIN32)
+
+ShardedRWLock::ShardedRWLock()
+    : mWriterPending(0), mWriterOwned(0)
+{
+    memset(mShards, 0, sizeof(mShards));
+    pthread_mutex_init(&mWriterLock, NULL);
+    pthread_mutex_init(&mReadersGoneLock, NULL);
+    pthread_cond_init(&mReadersGone, NULL);
+}
+
+ShardedRWLock::ShardedRWLock(__attribute__((unused)) const char* name)
+    : mWriterPending(0), mWriterOwned(0)
+{
+    memset(mShards, 0, sizeof(mShards));
+    pthread_mutex_init(&mWriterLock, NULL);
+    pthread_mutex_init(&mReadersGoneLock, NULL);
+    pthread_cond_init(&mReadersGone, NULL);
+}
+
+ShardedRWLock::~ShardedRWLock()
+{
+    pthread_cond_destroy(&mReadersGone);
+    pthread_mutex_destroy(&mReadersGoneLock);
+    pthread_mutex_destroy(&mWriterLock);
+}
+
+size_t ShardedRWLock::shardForThread()
+{
+    // Spread threads over the shards; a thread always uses the same one.
+    uint32_t id = uint32_t(uintptr_t(pthread_self()) >> 4);
+    return ((id * 2654435761U) >> 16) % NUM_SHARDS;
+}
+
+bool ShardedRWLock::hasReaders() const
+{
+    int32_t readers = 0;
+    for (size_t i = 0; i < NUM_SHARDS; i++) {
+        readers += android_atomic_acquire_load(&mShards[i].readers);
+    }
+    return readers != 0;
+}
+
+void ShardedRWLock::leaveShard(Shard& shard)
+{
+    // The decrement is a full barrier, so a writer that raised its flag
+    // before we left is seen here. It checks for readers with
+    // mReadersGoneLock held, so taking that lock to signal can't slip in
+    // between its check and its wait.
+    android_atomic_dec(&shard.readers);
+    if (android_atomic_acquire_load(&mWriterPending) != 0) {
+        pthread_mutex_lock(&mReadersGoneLock);
+        pthread_cond_signal(&mReadersGone);
+        pthread_mutex_unlock(&mReadersGoneLock);
+    }
+}
+
+status_t ShardedRWLock::readLock()
+{
+    Shard& shard = mShards[shardForThread()];
+    for (;;) {
+        // Both the increment and the writer's flag update are full
+        // barriers, so either we see the writer or it sees us.
+        android_atomic_inc(&shard.readers);
+        if (android_atomic_acquire_load(&mWriterPending) == 0) {
+            return NO_ERROR;
+        }
+        leaveShard(shard);
+
+        // Sleep until the writer is done.
+        pthread_mutex_lock(&mWriterLock);
+        pthread_mutex_unlock(&mWriterLock);
+    }
+}
+
+status_t ShardedRWLock::tryReadLock()
+{
+    Shard& shard = mShards[shardForThread()];
+    android_atomic_inc(&shard.readers);
+    if (android_atomic_acquire_load(&mWriterPending) == 0) {
+        return NO_ERROR;
+    }
+    leaveShard(shard);
+    return -EBUSY;
+}
+
+status_t ShardedRWLock::writeLock()
+{
+    int err = pthread_mutex_lock(&mWriterLock);
+    if (err) {
+        return -err;
+    }
+    android_atomic_or(1, &mWriterPending);
+    // Sleep rather than spin, so that readers preempted by a writer of
+    // higher priority get to run and leave.
+    pthread_mutex_lock(&mReadersGoneLock);
+    while (hasReaders()) {
+        pthread_cond_wait(&mReadersGone, &mReadersGoneLock);
+    }
+    pthread_mutex_unlock(&mReadersGoneLock);
+    mWriter = pthread_self();
+    mWriterOwned = 1;
+    return NO_ERROR;
+}
+
+status_t ShardedRWLock::tryWriteLock()
+{
+    int err = pthread_mutex_trylock(&mWriterLock);
+    if (err) {
+        return -err;
+    }
+    android_atomic_or(1, &mWriterPending);
+    if (hasReaders()) {
+        android_atomic_release_store(0, &mWriterPending);
+        pthread_mutex_unlock(&mWriterLock);
+        return -EBUSY;
+    }
+    mWriter = pthread_self();
+    mWriterOwned = 1;
+    return NO_ERROR;
+}
+
+void ShardedRWLock::unlock()
+{
+    // Readers can't hold the lock while a writer owns it, so this is only
+    // true for the writer itself.
+    if (mWriterOwned && pthread_equal(mWriter, pthread_self())) {
+        mWriterOwned = 0;
+        android_atomic_release_store(0, &mWriterPending);
+        pthread_mutex_unlock(&mWriterLock);
+    } else {
+        leaveShard(mShards[shardForThread()]);
+    }
+}
+
+#endif // !defined(_WIN32)
+
 // ----------------------------------------------------------------------------
 
 /*
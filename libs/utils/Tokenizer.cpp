@@ -31,8 +31,13 @@
 
 namespace android {
 
-static inline bool isDelimiter(char ch, const char* delimiters) {
-    return strchr(delimiters, ch) != NULL;
+Tokenizer::DelimiterSet::DelimiterSet(const char* delimiters) {
+    memset(mBits, 0, sizeof(mBits));
+    mBits[0] = 1; // '\0'
+    for (const char* p = delimiters; *p; p++) {
+        uint8_t index = uint8_t(*p);
+        mBits[index >> 5] |= 1u << (index & 31);
+    }
 }
 
 Tokenizer::Tokenizer(const String8& filename, FileMap* fileMap, char* buffer,
@@ -114,32 +119,39 @@ String8 Tokenizer::getLocation() const {
 }
 
 String8 Tokenizer::peekRemainderOfLine() const {
-    const char* end = getEnd();
-    const char* eol = mCurrent;
-    while (eol != end) {
-        char ch = *eol;
-        if (ch == '\n') {
-            break;
-        }
-        eol += 1;
-    }
-    return String8(mCurrent, eol - mCurrent);
+    Token line = peekRemainderOfLineToken();
+    return String8(line.data, line.length);
+}
+
+Tokenizer::Token Tokenizer::peekRemainderOfLineToken() const {
+    const char* eol = static_cast<const char*>(memchr(mCurrent, '\n', getEnd() - mCurrent));
+    Token line;
+    line.data = mCurrent;
+    line.length = (eol ? eol : getEnd()) - mCurrent;
+    return line;
 }
 
 String8 Tokenizer::nextToken(const char* delimiters) {
+    Token token = nextToken(DelimiterSet(delimiters));
+    return String8(token.data, token.length);
+}
+
+Tokenizer::Token Tokenizer::nextToken(const DelimiterSet& delimiters) {
 #if DEBUG_TOKENIZER
     LOGD("nextToken");
 #endif
     const char* end = getEnd();
-    const char* tokenStart = mCurrent;
+    Token token;
+    token.data = mCurrent;
     while (mCurrent != end) {
         char ch = *mCurrent;
-        if (ch == '\n' || isDelimiter(ch, delimiters)) {
+        if (ch == '\n' || delimiters.contains(ch)) {
             break;
         }
         mCurrent += 1;
     }
-    return String8(tokenStart, mCurrent - tokenStart);
+    token.length = mCurrent - token.data;
+    return token;
 }
 
 void Tokenizer::nextLine() {
@@ -147,23 +159,27 @@ void Tokenizer::nextLine() {
     LOGD("nextLine");
 #endif
     const char* end = getEnd();
-    while (mCurrent != end) {
-        char ch = *(mCurrent++);
-        if (ch == '\n') {
-            mLineNumber += 1;
-            break;
-        }
+    const char* eol = static_cast<const char*>(memchr(mCurrent, '\n', end - mCurrent));
+    if (eol) {
+        mCurrent = eol + 1;
+        mLineNumber += 1;
+    } else {
+        mCurrent = end;
     }
 }
 
 void Tokenizer::skipDelimiters(const char* delimiters) {
+    skipDelimiters(DelimiterSet(delimiters));
+}
+
+void Tokenizer::skipDelimiters(const DelimiterSet& delimiters) {
 #if DEBUG_TOKENIZER
     LOGD("skipDelimiters");
 #endif
     const char* end = getEnd();
     while (mCurrent != end) {
         char ch = *mCurrent;
-        if (ch == '\n' || !isDelimiter(ch, delimiters)) {
+        if (ch == '\n' || !delimiters.contains(ch)) {
             break;
         }
         mCurrent += 1;
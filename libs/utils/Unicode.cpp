@@ -17,6 +17,7 @@
 #include <utils/Unicode.h>
 
 #include <stddef.h>
+#include <string.h>
 
 #ifdef HAVE_WINSOCK
 # undef  nhtol
@@ -62,6 +63,53 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// Masks with the bits set in every byte (or char16_t) of a machine word that
+// are only set for non-ASCII characters.
+static const unsigned long kUtf8NonAsciiMask = ~0UL / 0xFF * 0x80;
+static const unsigned long kUtf16NonAsciiMask = ~0UL / 0xFFFF * 0xFF80;
+
+/**
+ * Return the number of ASCII characters at the start of the string. Most of
+ * the strings we convert are mostly or entirely ASCII, so the converters
+ * below use these to skip through ASCII runs a word at a time and only
+ * decode the other characters one by one.
+ */
+static inline size_t utf8_ascii_run(const uint8_t* src, size_t len)
+{
+    const uint8_t* cur = src;
+    const uint8_t* const end = src + len;
+    unsigned long word;
+    while ((size_t)(end - cur) >= sizeof(word)) {
+        memcpy(&word, cur, sizeof(word));
+        if (word & kUtf8NonAsciiMask) {
+            break;
+        }
+        cur += sizeof(word);
+    }
+    while (cur < end && *cur < 0x80) {
+        cur++;
+    }
+    return cur - src;
+}
+
+static inline size_t utf16_ascii_run(const char16_t* src, size_t len)
+{
+    const char16_t* cur = src;
+    const char16_t* const end = src + len;
+    unsigned long word;
+    while ((size_t)(end - cur) >= sizeof(word) / sizeof(char16_t)) {
+        memcpy(&word, cur, sizeof(word));
+        if (word & kUtf16NonAsciiMask) {
+            break;
+        }
+        cur += sizeof(word) / sizeof(char16_t);
+    }
+    while (cur < end && *cur < 0x80) {
+        cur++;
+    }
+    return cur - src;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -334,6 +382,16 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst)
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        const size_t ascii = utf16_ascii_run(cur_utf16, end_utf16 - cur_utf16);
+        for (size_t i = 0; i < ascii; i++) {
+            cur[i] = (char) cur_utf16[i];
+        }
+        cur += ascii;
+        cur_utf16 += ascii;
+        if (cur_utf16 == end_utf16) {
+            break;
+        }
+
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -407,6 +465,13 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        const size_t ascii = utf16_ascii_run(src, end - src);
+        ret += ascii;
+        src += ascii;
+        if (src == end) {
+            break;
+        }
+
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*++src & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
@@ -519,6 +584,13 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        const size_t ascii = utf8_ascii_run(u8cur, u8end - u8cur);
+        u16measuredLen += ascii;
+        u8cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
+
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
@@ -537,6 +609,60 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     return u16measuredLen;
 }
 
+ssize_t utf8_to_utf16_length_validated(const uint8_t* u8str, size_t u8len)
+{
+    const uint8_t* const u8end = u8str + u8len;
+    const uint8_t* u8cur = u8str;
+
+    size_t u16len = 0;
+    while (u8cur < u8end) {
+        const size_t ascii = utf8_ascii_run(u8cur, u8end - u8cur);
+        u16len += ascii;
+        u8cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
+
+        // The smallest code point each sequence length may encode, so that
+        // overlong forms are rejected.
+        const uint8_t first = *u8cur;
+        size_t u8charLen;
+        uint32_t codepoint, minimum;
+        if ((first & 0xE0) == 0xC0) {
+            u8charLen = 2;
+            codepoint = first & 0x1F;
+            minimum = 0x80;
+        } else if ((first & 0xF0) == 0xE0) {
+            u8charLen = 3;
+            codepoint = first & 0x0F;
+            minimum = 0x800;
+        } else if ((first & 0xF8) == 0xF0) {
+            u8charLen = 4;
+            codepoint = first & 0x07;
+            minimum = 0x10000;
+        } else {
+            return -1;
+        }
+        if ((size_t)(u8end - u8cur) < u8charLen) {
+            return -1;
+        }
+        for (size_t i = 1; i < u8charLen; i++) {
+            if ((u8cur[i] & 0xC0) != 0x80) {
+                return -1;
+            }
+            utf8_shift_and_mask(&codepoint, u8cur[i]);
+        }
+        if (codepoint < minimum || codepoint > kUnicodeMaxCodepoint
+                || (codepoint >= kUnicodeSurrogateStart
+                        && codepoint <= kUnicodeSurrogateEnd)) {
+            return -1;
+        }
+        u16len += codepoint > 0xFFFF ? 2 : 1;
+        u8cur += u8charLen;
+    }
+    return u16len;
+}
+
 char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, char16_t* u16str)
 {
     const uint8_t* const u8end = u8str + u8len;
@@ -544,6 +670,16 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     char16_t* u16cur = u16str;
 
     while (u8cur < u8end) {
+        const size_t ascii = utf8_ascii_run(u8cur, u8end - u8cur);
+        for (size_t i = 0; i < ascii; i++) {
+            u16cur[i] = u8cur[i];
+        }
+        u16cur += ascii;
+        u8cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -575,6 +711,19 @@ char16_t* utf8_to_utf16_n(const uint8_t* src, size_t srcLen, char16_t* dst, size
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        size_t ascii = utf8_ascii_run(u8cur, u8end - u8cur);
+        if (ascii > (size_t)(u16end - u16cur)) {
+            ascii = u16end - u16cur;
+        }
+        for (size_t i = 0; i < ascii; i++) {
+            u16cur[i] = u8cur[i];
+        }
+        u16cur += ascii;
+        u8cur += ascii;
+        if (u8cur == u8end || u16cur == u16end) {
+            break;
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
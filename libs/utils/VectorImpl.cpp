@@ -162,60 +162,121 @@ status_t VectorImpl::sort(VectorImpl::compar_t cmp)
     return sort(sortProxy, (void*)cmp);
 }
 
+/*
+ * Stable merge sort of an array of item pointers. Only the pointers move
+ * while sorting; sort() then moves every item to its place exactly once.
+ */
+static void mergeSortPointers(const void** ptrs, const void** temp, size_t count,
+        VectorImpl::compar_r_t cmp, void* state)
+{
+    // short runs are insertion sorted first, that's cheap on pointers
+    const size_t RUN = 8;
+    for (size_t lo=0 ; lo<count ; lo+=RUN) {
+        const size_t hi = (lo + RUN < count) ? lo + RUN : count;
+        for (size_t i=lo+1 ; i<hi ; i++) {
+            const void* item = ptrs[i];
+            size_t j = i;
+            while (j > lo && cmp(ptrs[j-1], item, state) > 0) {
+                ptrs[j] = ptrs[j-1];
+                j--;
+            }
+            ptrs[j] = item;
+        }
+    }
+
+    // then the runs are merged bottom-up, ping-ponging between both arrays
+    const void** src = ptrs;
+    const void** dst = temp;
+    for (size_t width=RUN ; width<count ; width*=2) {
+        for (size_t lo=0 ; lo<count ; lo+=2*width) {
+            const size_t mid = (lo + width < count) ? lo + width : count;
+            const size_t hi = (lo + 2*width < count) ? lo + 2*width : count;
+            if (mid == hi || cmp(src[mid-1], src[mid], state) <= 0) {
+                // already in order (or nothing to merge with)
+                memcpy(dst + lo, src + lo, (hi - lo) * sizeof(void*));
+                continue;
+            }
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                // take from the left run on ties, that's what keeps it stable
+                dst[k++] = (cmp(src[i], src[j], state) <= 0) ? src[i++] : src[j++];
+            }
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi)  dst[k++] = src[j++];
+        }
+        const void** t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != ptrs) {
+        memcpy(ptrs, src, count * sizeof(void*));
+    }
+}
+
 status_t VectorImpl::sort(VectorImpl::compar_r_t cmp, void* state)
 {
-    // the sort must be stable. we're using insertion sort which
-    // is well suited for small and already sorted arrays
-    // for big arrays, it could be better to use mergesort
-    const ssize_t count = size();
-    if (count > 1) {
-        void* array = const_cast<void*>(arrayImpl());
-        void* temp = 0;
-        ssize_t i = 1;
-        while (i < count) {
-            void* item = reinterpret_cast<char*>(array) + mItemSize*(i);
-            void* curr = reinterpret_cast<char*>(array) + mItemSize*(i-1);
-            if (cmp(curr, item, state) > 0) {
-
-                if (!temp) {
-                    // we're going to have to modify the array...
-                    array = editArrayImpl();
-                    if (!array) return NO_MEMORY;
-                    temp = malloc(mItemSize);
-                    if (!temp) return NO_MEMORY;
-                    item = reinterpret_cast<char*>(array) + mItemSize*(i);
-                    curr = reinterpret_cast<char*>(array) + mItemSize*(i-1);
-                } else {
-                    _do_destroy(temp, 1);
-                }
-
-                _do_copy(temp, item, 1);
-
-                ssize_t j = i-1;
-                void* next = reinterpret_cast<char*>(array) + mItemSize*(i);                    
-                do {
-                    _do_destroy(next, 1);
-                    _do_copy(next, curr, 1);
-                    next = curr;
-                    --j;
-                    curr = NULL;
-                    if (j >= 0) {
-                        curr = reinterpret_cast<char*>(array) + mItemSize*(j);
-                    }
-                } while (j>=0 && (cmp(curr, temp, state) > 0));
+    // the sort must be stable. we're using a merge sort on pointers to
+    // the items, so non-trivial items are copied only once, no matter
+    // how big the array is.
+    const size_t count = size();
+    const size_t s = mItemSize;
+    const char* array = reinterpret_cast<const char*>(arrayImpl());
+
+    // already sorted arrays are common, and we don't want to modify
+    // (and possibly un-share) the storage for them
+    size_t i = 1;
+    while (i < count && cmp(array + s*(i-1), array + s*i, state) <= 0) {
+        i++;
+    }
+    if (i >= count) {
+        return NO_ERROR;
+    }
 
-                _do_destroy(next, 1);
-                _do_copy(next, temp, 1);
+    const void** ptrs = (const void**)malloc(2 * count * sizeof(void*));
+    if (!ptrs) return NO_MEMORY;
+    for (i=0 ; i<count ; i++) {
+        ptrs[i] = array + s*i;
+    }
+    mergeSortPointers(ptrs, ptrs + count, count, cmp, state);
+
+    status_t err = NO_ERROR;
+    if (mFlags & HAS_TRIVIAL_COPY) {
+        // gather the items in order, then copy them back in one go
+        char* temp = (char*)malloc(count * s);
+        char* dest = temp ? (char*)editArrayImpl() : NULL;
+        if (dest) {
+            for (i=0 ; i<count ; i++) {
+                memcpy(temp + s*i, ptrs[i], s);
             }
-            i++;
+            memcpy(dest, temp, count * s);
+        } else {
+            err = NO_MEMORY;
         }
-        
-        if (temp) {
-            _do_destroy(temp, 1);
-            free(temp);
+        free(temp);
+    } else {
+        // move (or copy, if the storage is shared) the items in order
+        // to a new storage and drop the old one
+        SharedBuffer* sb = SharedBuffer::alloc(capacity() * s);
+        if (sb) {
+            char* dest = (char*)sb->data();
+            if (SharedBuffer::bufferFromData(mStorage)->onlyOwner()) {
+                for (i=0 ; i<count ; i++) {
+                    _do_move_backward(dest + s*i, ptrs[i], 1);
+                }
+                release_moved_storage();
+            } else {
+                for (i=0 ; i<count ; i++) {
+                    _do_copy(dest + s*i, ptrs[i], 1);
+                }
+                release_storage();
+            }
+            mStorage = sb->data();
+        } else {
+            err = NO_MEMORY;
         }
     }
-    return NO_ERROR;
+    free(ptrs);
+    return err;
 }
 
 void VectorImpl::pop()
@@ -334,11 +395,27 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
         // we can't reduce the capacity
         return current_capacity;
     } 
+    const SharedBuffer* cur_sb = mStorage ? SharedBuffer::bufferFromData(mStorage) : 0;
+    const bool owned = cur_sb && cur_sb->onlyOwner();
+    if (owned && _can_relocate()) {
+        SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
+        if (sb) {
+            mStorage = sb->data();
+        } else {
+            return NO_MEMORY;
+        }
+        return new_capacity;
+    }
     SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
     if (sb) {
         void* array = sb->data();
-        _do_copy(array, mStorage, size());
-        release_storage();
+        if (owned) {
+            _do_move_backward(array, mStorage, size());
+            release_moved_storage();
+        } else {
+            _do_copy(array, mStorage, size());
+            release_storage();
+        }
         mStorage = const_cast<void*>(array);
     } else {
         return NO_MEMORY;
@@ -356,6 +433,14 @@ ssize_t VectorImpl::resize(size_t size) {
     return result < 0 ? result : size;
 }
 
+void VectorImpl::release_moved_storage()
+{
+    // the items have been moved out already, only free the memory
+    const SharedBuffer* sb = SharedBuffer::bufferFromData(mStorage);
+    sb->release(SharedBuffer::eKeepStorage);
+    SharedBuffer::dealloc(sb);
+}
+
 void VectorImpl::release_storage()
 {
     if (mStorage) {
@@ -380,12 +465,26 @@ void* VectorImpl::_grow(size_t where, size_t amount)
     if (capacity() < new_size) {
         const size_t new_capacity = max(kMinVectorCapacity, ((new_size*3)+1)/2);
 //        LOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((mStorage) &&
+        const SharedBuffer* cur_sb = mStorage ? SharedBuffer::bufferFromData(mStorage) : 0;
+        const bool owned = cur_sb && cur_sb->onlyOwner();
+        if (owned && _can_relocate()) {
+            // the items can follow the storage wherever realloc() puts it
+            SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
+            if (sb) {
+                mStorage = sb->data();
+                if (where != mCount) {
+                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                    void* dest = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                    memmove(dest, from, (mCount-where)*mItemSize);
+                }
+            } else {
+                return NULL;
+            }
+        } else if ((cur_sb) &&
             (mCount==where) &&
             (mFlags & HAS_TRIVIAL_COPY) &&
             (mFlags & HAS_TRIVIAL_DTOR))
         {
-            const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
             if (sb) {
                 mStorage = sb->data();
@@ -396,15 +495,27 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != mCount) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
-                    _do_copy(dest, from, mCount-where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
+                if (owned) {
+                    // nobody else can see the old items, so move them
+                    // rather than copy them and destroy the originals.
+                    if (where != 0) {
+                        _do_move_backward(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_move_backward(dest, from, mCount-where);
+                    }
+                    release_moved_storage();
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_copy(dest, from, mCount-where);
+                    }
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else {
                 return NULL;
@@ -439,11 +550,25 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     if (new_size*3 < capacity()) {
         const size_t new_capacity = max(kMinVectorCapacity, new_size*2);
 //        LOGV("shrink vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((where == new_size) &&
+        const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+        const bool owned = cur_sb->onlyOwner();
+        if (owned && _can_relocate()) {
+            // close the gap in place, then let the storage shrink around
+            // the items. if it can't shrink, we just keep it as it is.
+            void* to = reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize;
+            _do_destroy(to, amount);
+            if (where != new_size) {
+                const void* from = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                memmove(to, from, (new_size - where)*mItemSize);
+            }
+            SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
+            if (sb) {
+                mStorage = sb->data();
+            }
+        } else if ((where == new_size) &&
             (mFlags & HAS_TRIVIAL_COPY) &&
             (mFlags & HAS_TRIVIAL_DTOR))
         {
-            const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
             if (sb) {
                 mStorage = sb->data();
@@ -454,15 +579,27 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != new_size) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
-                    _do_copy(dest, from, new_size - where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
+                if (owned) {
+                    // see _grow()
+                    _do_destroy(reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize, amount);
+                    if (where != 0) {
+                        _do_move_backward(array, mStorage, where);
+                    }
+                    if (where != new_size) {
+                        _do_move_backward(dest, from, new_size - where);
+                    }
+                    release_moved_storage();
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != new_size) {
+                        _do_copy(dest, from, new_size - where);
+                    }
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else{
                 return;
@@ -480,6 +617,13 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     mCount = new_size;
 }
 
+bool VectorImpl::_can_relocate() const {
+    // items can be moved to a new address with memcpy() if their type says
+    // so, or if copying them is a memcpy() and destroying them a no-op.
+    return (mFlags & HAS_TRIVIAL_MOVE) ||
+            ((mFlags & HAS_TRIVIAL_COPY) && (mFlags & HAS_TRIVIAL_DTOR));
+}
+
 size_t VectorImpl::itemSize() const {
     return mItemSize;
 }
@@ -594,23 +738,69 @@ ssize_t SortedVectorImpl::add(const void* item)
     return index;
 }
 
-ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
+int SortedVectorImpl::compareProxy(const void* lhs, const void* rhs, void* self)
 {
-    // naive merge...
-    if (!vector.isEmpty()) {
-        const void* buffer = vector.arrayImpl();
-        const size_t is = itemSize();
-        size_t s = vector.size();
-        for (size_t i=0 ; i<s ; i++) {
-            ssize_t err = add( reinterpret_cast<const char*>(buffer) + i*is );
+    return static_cast<const SortedVectorImpl*>(self)->do_compare(lhs, rhs);
+}
+
+ssize_t SortedVectorImpl::addArray(const void* array, size_t length)
+{
+    const size_t is = itemSize();
+    if (length < 8) {
+        // a handful of items are cheaper to insert one by one
+        for (size_t i=0 ; i<length ; i++) {
+            ssize_t err = add( reinterpret_cast<const char*>(array) + i*is );
             if (err<0) {
                 return err;
             }
         }
+        return NO_ERROR;
+    }
+
+    // append everything, then sort and drop duplicates. the sort is
+    // stable, so the last of several equal items is the most recently
+    // added one, which is the one add() would have kept.
+    ssize_t err = VectorImpl::appendArray(array, length);
+    if (err<0) {
+        return err;
+    }
+    err = VectorImpl::sort(compareProxy, this);
+    if (err<0) {
+        return err;
+    }
+
+    const size_t count = size();
+    const char* a = reinterpret_cast<const char*>(arrayImpl());
+    size_t i = 1;
+    while (i < count && do_compare(a + (i-1)*is, a + i*is) != 0) {
+        i++;
+    }
+    if (i < count) {
+        // item i-1 is the first one to go, compact the survivors over it
+        size_t w = i-1;
+        for ( ; i<count ; i++) {
+            a = reinterpret_cast<const char*>(arrayImpl());
+            if (i+1 < count && do_compare(a + i*is, a + (i+1)*is) == 0) {
+                continue;
+            }
+            err = VectorImpl::replaceAt(a + i*is, w++);
+            if (err<0) {
+                return err;
+            }
+        }
+        err = VectorImpl::removeItemsAt(w, count - w);
+        if (err<0) {
+            return err;
+        }
     }
     return NO_ERROR;
 }
 
+ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
+{
+    return addArray(vector.arrayImpl(), vector.size());
+}
+
 ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
 {
     // we've merging a sorted vector... nice!
@@ -622,7 +812,6 @@ ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
         } else if (do_compare(vector.arrayImpl(), itemLocation(size()-1)) >= 0) {
             err = VectorImpl::appendVector(static_cast<const VectorImpl&>(vector));
         } else {
-            // this could be made a little better
             err = merge(static_cast<const VectorImpl&>(vector));
         }
     }
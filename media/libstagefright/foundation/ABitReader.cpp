@@ -16,6 +16,9 @@
 
 #include "ABitReader.h"
 
+#include <netinet/in.h>
+#include <string.h>
+
 #include <media/stagefright/foundation/ADebug.h>
 
 namespace android {
@@ -30,9 +33,23 @@ ABitReader::ABitReader(const uint8_t *data, size_t size)
 void ABitReader::fillReservoir() {
     CHECK_GT(mSize, 0u);
 
+    if (mSize >= 8) {
+        // Two unaligned big-endian word loads instead of eight byte loads.
+        uint32_t hi, lo;
+        memcpy(&hi, mData, 4);
+        memcpy(&lo, mData + 4, 4);
+
+        mReservoir = ((uint64_t)ntohl(hi) << 32) | ntohl(lo);
+        mNumBitsLeft = 64;
+
+        mData += 8;
+        mSize -= 8;
+        return;
+    }
+
     mReservoir = 0;
     size_t i;
-    for (i = 0; mSize > 0 && i < 4; ++i) {
+    for (i = 0; mSize > 0; ++i) {
         mReservoir = (mReservoir << 8) | *mData;
 
         ++mData;
@@ -40,48 +57,99 @@ void ABitReader::fillReservoir() {
     }
 
     mNumBitsLeft = 8 * i;
-    mReservoir <<= 32 - mNumBitsLeft;
+    mReservoir <<= 64 - mNumBitsLeft;
 }
 
 uint32_t ABitReader::getBits(size_t n) {
     CHECK_LE(n, 32u);
 
     uint32_t result = 0;
-    while (n > 0) {
-        if (mNumBitsLeft == 0) {
-            fillReservoir();
+    while (n > mNumBitsLeft) {
+        // Drain what's left, at most once for a full 64-bit reservoir.
+        if (mNumBitsLeft > 0) {
+            result = (result << mNumBitsLeft)
+                | (uint32_t)(mReservoir >> (64 - mNumBitsLeft));
+            n -= mNumBitsLeft;
         }
 
-        size_t m = n;
-        if (m > mNumBitsLeft) {
-            m = mNumBitsLeft;
-        }
-
-        result = (result << m) | (mReservoir >> (32 - m));
-        mReservoir <<= m;
-        mNumBitsLeft -= m;
+        fillReservoir();
+    }
 
-        n -= m;
+    if (n > 0) {
+        result = (uint32_t)(((uint64_t)result << n) | (mReservoir >> (64 - n)));
+        mReservoir <<= n;
+        mNumBitsLeft -= n;
     }
 
     return result;
 }
 
 void ABitReader::skipBits(size_t n) {
-    while (n > 32) {
-        getBits(32);
-        n -= 32;
+    if (n <= mNumBitsLeft) {
+        mReservoir = (n < 64) ? mReservoir << n : 0;
+        mNumBitsLeft -= n;
+        return;
     }
 
+    n -= mNumBitsLeft;
+    mReservoir = 0;
+    mNumBitsLeft = 0;
+
+    size_t numBytes = n / 8;
+    CHECK_LE(numBytes, mSize);
+    mData += numBytes;
+    mSize -= numBytes;
+
+    n %= 8;
     if (n > 0) {
-        getBits(n);
+        fillReservoir();
+        mReservoir <<= n;
+        mNumBitsLeft -= n;
+    }
+}
+
+uint32_t ABitReader::getUE() {
+    size_t numZeroes = 0;
+    for (;;) {
+        if (mNumBitsLeft == 0) {
+            fillReservoir();
+        }
+
+        if (mReservoir == 0) {
+            numZeroes += mNumBitsLeft;
+            mNumBitsLeft = 0;
+        } else {
+            // The unused low bits of the reservoir are always zero, so the
+            // leading one is guaranteed to lie within the valid bits.
+            size_t lz = __builtin_clzll(mReservoir);
+            numZeroes += lz;
+            mReservoir = (mReservoir << lz) << 1;
+            mNumBitsLeft -= lz + 1;
+            break;
+        }
     }
+
+    CHECK_LT(numZeroes, 32u);
+
+    return ((1u << numZeroes) - 1) + getBits(numZeroes);
+}
+
+int32_t ABitReader::getSE() {
+    uint32_t codeNum = getUE();
+
+    return (codeNum & 1)
+        ? (int32_t)((codeNum + 1) >> 1) : -(int32_t)(codeNum >> 1);
 }
 
 void ABitReader::putBits(uint32_t x, size_t n) {
-    CHECK_LE(mNumBitsLeft + n, 32u);
+    CHECK_LE(n, 32u);
+    CHECK_LE(mNumBitsLeft + n, 64u);
+
+    if (n == 0) {
+        return;
+    }
 
-    mReservoir = (mReservoir >> n) | (x << (32 - n));
+    mReservoir = (mReservoir >> n) | ((uint64_t)x << (64 - n));
     mNumBitsLeft += n;
 }
 
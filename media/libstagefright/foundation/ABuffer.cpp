@@ -16,6 +16,7 @@
 
 #include "ABuffer.h"
 
+#include "ABufferPool.h"
 #include "ADebug.h"
 #include "ALooper.h"
 #include "AMessage.h"
@@ -40,12 +41,25 @@ ABuffer::ABuffer(void *data, size_t capacity)
       mOwnsData(false) {
 }
 
+ABuffer::ABuffer(const sp<ABufferPool> &pool, void *data, size_t capacity)
+    : mPool(pool),
+      mData(data),
+      mCapacity(capacity),
+      mRangeOffset(0),
+      mRangeLength(capacity),
+      mInt32Data(0),
+      mOwnsData(false) {
+}
+
 ABuffer::~ABuffer() {
     if (mOwnsData) {
         if (mData != NULL) {
             free(mData);
             mData = NULL;
         }
+    } else if (mPool != NULL) {
+        mPool->releasePayload(mData, mCapacity);
+        mData = NULL;
     }
 
     if (mFarewell != NULL) {
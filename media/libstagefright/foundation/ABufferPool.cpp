@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ABufferPool"
+#include <utils/Log.h>
+
+#include "ABufferPool.h"
+
+#include "ABuffer.h"
+#include "ADebug.h"
+
+namespace android {
+
+ABufferPool::ABufferPool(size_t maxCachedPerClass)
+    : mMaxCachedPerClass(maxCachedPerClass) {
+    for (size_t i = 0; i < kNumClasses; ++i) {
+        mFreeLists[i] = NULL;
+        mNumFree[i] = 0;
+    }
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+ABufferPool::~ABufferPool() {
+    trim();
+}
+
+// static
+ssize_t ABufferPool::ClassForCapacity(size_t capacity) {
+    size_t index = 0;
+    size_t classSize = 1u << kMinClassShift;
+    while (classSize < capacity) {
+        if (++index == kNumClasses) {
+            return -1;
+        }
+        classSize <<= 1;
+    }
+    return index;
+}
+
+sp<ABuffer> ABufferPool::acquire(size_t capacity) {
+    void *data = allocPayload(capacity);
+    if (data == NULL) {
+        return NULL;
+    }
+    return new ABuffer(this, data, capacity);
+}
+
+void *ABufferPool::allocPayload(size_t capacity) {
+    ssize_t index = ClassForCapacity(capacity);
+
+    Mutex::Autolock autoLock(mLock);
+    ++mStats.mNumAcquired;
+
+    if (index < 0) {
+        ++mStats.mNumMallocs;
+        return malloc(capacity);
+    }
+
+    FreeBlock *block = mFreeLists[index];
+    if (block != NULL) {
+        mFreeLists[index] = block->mNext;
+        --mNumFree[index];
+
+        ++mStats.mNumRecycled;
+        --mStats.mNumCached;
+        mStats.mBytesCached -= 1u << (kMinClassShift + index);
+
+        return block;
+    }
+
+    ++mStats.mNumMallocs;
+    return malloc(1u << (kMinClassShift + index));
+}
+
+void ABufferPool::releasePayload(void *data, size_t capacity) {
+    ssize_t index = ClassForCapacity(capacity);
+
+    Mutex::Autolock autoLock(mLock);
+
+    if (index < 0 || mNumFree[index] >= mMaxCachedPerClass) {
+        ++mStats.mNumFreed;
+        free(data);
+        return;
+    }
+
+    FreeBlock *block = static_cast<FreeBlock *>(data);
+    block->mNext = mFreeLists[index];
+    mFreeLists[index] = block;
+    ++mNumFree[index];
+
+    ++mStats.mNumCached;
+    mStats.mBytesCached += 1u << (kMinClassShift + index);
+}
+
+void ABufferPool::trim() {
+    Mutex::Autolock autoLock(mLock);
+
+    for (size_t i = 0; i < kNumClasses; ++i) {
+        FreeBlock *block = mFreeLists[i];
+        while (block != NULL) {
+            FreeBlock *next = block->mNext;
+            free(block);
+            block = next;
+        }
+        mFreeLists[i] = NULL;
+        mNumFree[i] = 0;
+    }
+
+    mStats.mNumCached = 0;
+    mStats.mBytesCached = 0;
+}
+
+void ABufferPool::getStats(Stats *stats) const {
+    Mutex::Autolock autoLock(mLock);
+    *stats = mStats;
+}
+
+}  // namespace android
@@ -22,6 +22,7 @@
 
 #include "ALooper.h"
 
+#include "ABufferPool.h"
 #include "AHandler.h"
 #include "ALooperRoster.h"
 #include "AMessage.h"
@@ -89,6 +90,16 @@ void ALooper::unregisterHandler(handler_id handlerID) {
     gLooperRoster.unregisterHandler(handlerID);
 }
 
+sp<ABufferPool> ALooper::bufferPool() {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mBufferPool == NULL) {
+        mBufferPool = new ABufferPool;
+    }
+
+    return mBufferPool;
+}
+
 status_t ALooper::start(
         bool runOnCallingThread, bool canCallJava, int32_t priority) {
     if (runOnCallingThread) {
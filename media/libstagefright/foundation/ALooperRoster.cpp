@@ -27,7 +27,8 @@
 namespace android {
 
 ALooperRoster::ALooperRoster()
-    : mNextHandlerID(1),
+    : mLock(Mutex::ADAPTIVE, "ALooperRoster::mLock"),
+      mNextHandlerID(1),
       mNextReplyID(1) {
 }
 
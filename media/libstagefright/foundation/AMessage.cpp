@@ -29,6 +29,69 @@ namespace android {
 
 extern ALooperRoster gLooperRoster;
 
+namespace {
+
+enum {
+    kMaxCachedMessages = 64,
+};
+
+struct FreeMessage {
+    FreeMessage *mNext;
+};
+
+Mutex gMessagePoolLock;
+FreeMessage *gFreeMessages = NULL;
+AMessage::PoolStats gMessagePoolStats;
+
+}  // namespace
+
+// static
+void *AMessage::operator new(size_t size) {
+    if (size == sizeof(AMessage)) {
+        Mutex::Autolock autoLock(gMessagePoolLock);
+        ++gMessagePoolStats.mNumAllocated;
+
+        FreeMessage *msg = gFreeMessages;
+        if (msg != NULL) {
+            gFreeMessages = msg->mNext;
+            ++gMessagePoolStats.mNumRecycled;
+            --gMessagePoolStats.mNumCached;
+            return msg;
+        }
+
+        ++gMessagePoolStats.mNumMallocs;
+    }
+
+    return ::operator new(size);
+}
+
+// static
+void AMessage::operator delete(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    if (size == sizeof(AMessage)) {
+        Mutex::Autolock autoLock(gMessagePoolLock);
+
+        if (gMessagePoolStats.mNumCached < kMaxCachedMessages) {
+            FreeMessage *msg = static_cast<FreeMessage *>(ptr);
+            msg->mNext = gFreeMessages;
+            gFreeMessages = msg;
+            ++gMessagePoolStats.mNumCached;
+            return;
+        }
+    }
+
+    ::operator delete(ptr);
+}
+
+// static
+void AMessage::GetPoolStats(PoolStats *stats) {
+    Mutex::Autolock autoLock(gMessagePoolLock);
+    *stats = gMessagePoolStats;
+}
+
 AMessage::AMessage(uint32_t what, ALooper::handler_id target)
     : mWhat(what),
       mTarget(target),
@@ -319,6 +382,7 @@ static bool isFourcc(uint32_t what) {
 
 AString AMessage::debugString(int32_t indent) const {
     AString s = "AMessage(what = ";
+    s.reserve(64 + 48 * mNumItems);
 
     AString tmp;
     if (isFourcc(mWhat)) {
@@ -344,12 +408,16 @@ AString AMessage::debugString(int32_t indent) const {
 
         switch (item.mType) {
             case kTypeInt32:
-                tmp = StringPrintf(
-                        "int32_t %s = %d", item.mName, item.u.int32Value);
+                tmp = "int32_t ";
+                tmp.append(item.mName);
+                tmp.append(" = ");
+                tmp.append(item.u.int32Value);
                 break;
             case kTypeInt64:
-                tmp = StringPrintf(
-                        "int64_t %s = %lld", item.mName, item.u.int64Value);
+                tmp = "int64_t ";
+                tmp.append(item.mName);
+                tmp.append(" = ");
+                tmp.append((long long)item.u.int64Value);
                 break;
             case kTypeSize:
                 tmp = StringPrintf(
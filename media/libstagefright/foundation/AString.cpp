@@ -25,40 +25,42 @@
 
 namespace android {
 
-// static
-const char *AString::kEmptyString = "";
-
 AString::AString()
-    : mData((char *)kEmptyString),
+    : mData(mInlineData),
       mSize(0),
-      mAllocSize(1) {
+      mAllocSize(kInlineSize) {
+    mInlineData[0] = '\0';
 }
 
 AString::AString(const char *s)
-    : mData(NULL),
+    : mData(mInlineData),
       mSize(0),
-      mAllocSize(1) {
+      mAllocSize(kInlineSize) {
+    mInlineData[0] = '\0';
     setTo(s);
 }
 
 AString::AString(const char *s, size_t size)
-    : mData(NULL),
+    : mData(mInlineData),
       mSize(0),
-      mAllocSize(1) {
+      mAllocSize(kInlineSize) {
+    mInlineData[0] = '\0';
     setTo(s, size);
 }
 
 AString::AString(const AString &from)
-    : mData(NULL),
+    : mData(mInlineData),
       mSize(0),
-      mAllocSize(1) {
+      mAllocSize(kInlineSize) {
+    mInlineData[0] = '\0';
     setTo(from, 0, from.size());
 }
 
 AString::AString(const AString &from, size_t offset, size_t n)
-    : mData(NULL),
+    : mData(mInlineData),
       mSize(0),
-      mAllocSize(1) {
+      mAllocSize(kInlineSize) {
+    mInlineData[0] = '\0';
     setTo(from, offset, n);
 }
 
@@ -103,14 +105,41 @@ void AString::setTo(const AString &from, size_t offset, size_t n) {
 }
 
 void AString::clear() {
-    if (mData && mData != kEmptyString) {
+    if (!isInline()) {
         free(mData);
-        mData = NULL;
     }
 
-    mData = (char *)kEmptyString;
+    mData = mInlineData;
+    mInlineData[0] = '\0';
     mSize = 0;
-    mAllocSize = 1;
+    mAllocSize = kInlineSize;
+}
+
+void AString::growTo(size_t allocSize) {
+    // Grow geometrically so that a sequence of appends is amortized O(1).
+    size_t newAllocSize = mAllocSize * 2;
+    if (newAllocSize < allocSize) {
+        newAllocSize = allocSize;
+    }
+    newAllocSize = (newAllocSize + 31) & -32;
+
+    if (isInline()) {
+        char *data = (char *)malloc(newAllocSize);
+        CHECK(data != NULL);
+        memcpy(data, mInlineData, mSize + 1);
+        mData = data;
+    } else {
+        mData = (char *)realloc(mData, newAllocSize);
+        CHECK(mData != NULL);
+    }
+
+    mAllocSize = newAllocSize;
+}
+
+void AString::reserve(size_t capacity) {
+    if (capacity + 1 > mAllocSize) {
+        growTo(capacity + 1);
+    }
 }
 
 size_t AString::hash() const {
@@ -127,8 +156,6 @@ bool AString::operator==(const AString &other) const {
 }
 
 void AString::trim() {
-    makeMutable();
-
     size_t i = 0;
     while (i < mSize && isspace(mData[i])) {
         ++i;
@@ -148,30 +175,18 @@ void AString::erase(size_t start, size_t n) {
     CHECK_LT(start, mSize);
     CHECK_LE(start + n, mSize);
 
-    makeMutable();
-
     memmove(&mData[start], &mData[start + n], mSize - start - n);
     mSize -= n;
     mData[mSize] = '\0';
 }
 
-void AString::makeMutable() {
-    if (mData == kEmptyString) {
-        mData = strdup(kEmptyString);
-    }
-}
-
 void AString::append(const char *s) {
     append(s, strlen(s));
 }
 
 void AString::append(const char *s, size_t size) {
-    makeMutable();
-
     if (mSize + size + 1 > mAllocSize) {
-        mAllocSize = (mAllocSize + size + 31) & -32;
-        mData = (char *)realloc(mData, mAllocSize);
-        CHECK(mData != NULL);
+        growTo(mSize + size + 1);
     }
 
     memcpy(&mData[mSize], s, size);
@@ -187,67 +202,121 @@ void AString::append(const AString &from, size_t offset, size_t n) {
     append(from.c_str() + offset, n);
 }
 
+// Formats "x" right-to-left ending at "end", two digits at a time.
+// Returns a pointer to the first digit.
+template<typename T>
+static char *formatDecimal(T x, char *end) {
+    static const char kDigitPairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+    char *p = end;
+    while (x >= 100) {
+        unsigned pair = (unsigned)(x % 100) * 2;
+        x /= 100;
+        *--p = kDigitPairs[pair + 1];
+        *--p = kDigitPairs[pair];
+    }
+
+    if (x >= 10) {
+        unsigned pair = (unsigned)x * 2;
+        *--p = kDigitPairs[pair + 1];
+        *--p = kDigitPairs[pair];
+    } else {
+        *--p = '0' + (char)x;
+    }
+
+    return p;
+}
+
+template<typename U, typename S>
+static char *formatSignedDecimal(S x, char *end) {
+    // Negate in the unsigned domain so the most negative value works.
+    U magnitude = (x < 0) ? (U)0 - (U)x : (U)x;
+
+    char *p = formatDecimal(magnitude, end);
+    if (x < 0) {
+        *--p = '-';
+    }
+
+    return p;
+}
+
 void AString::append(int x) {
     char s[16];
-    sprintf(s, "%d", x);
+    char *end = s + sizeof(s);
+    char *p = formatSignedDecimal<unsigned>(x, end);
 
-    append(s);
+    append(p, end - p);
 }
 
 void AString::append(unsigned x) {
     char s[16];
-    sprintf(s, "%u", x);
+    char *end = s + sizeof(s);
+    char *p = formatDecimal(x, end);
 
-    append(s);
+    append(p, end - p);
 }
 
 void AString::append(long x) {
-    char s[16];
-    sprintf(s, "%ld", x);
+    char s[32];
+    char *end = s + sizeof(s);
+    char *p = formatSignedDecimal<unsigned long>(x, end);
 
-    append(s);
+    append(p, end - p);
 }
 
 void AString::append(unsigned long x) {
-    char s[16];
-    sprintf(s, "%lu", x);
+    char s[32];
+    char *end = s + sizeof(s);
+    char *p = formatDecimal(x, end);
 
-    append(s);
+    append(p, end - p);
 }
 
 void AString::append(long long x) {
     char s[32];
-    sprintf(s, "%lld", x);
+    char *end = s + sizeof(s);
+    char *p = formatSignedDecimal<unsigned long long>(x, end);
 
-    append(s);
+    append(p, end - p);
 }
 
 void AString::append(unsigned long long x) {
     char s[32];
-    sprintf(s, "%llu", x);
+    char *end = s + sizeof(s);
+    char *p = formatDecimal(x, end);
 
-    append(s);
+    append(p, end - p);
 }
 
 void AString::append(float x) {
-    char s[16];
-    sprintf(s, "%f", x);
+    char s[64];
+    int n = snprintf(s, sizeof(s), "%f", x);
 
-    append(s);
+    append(s, (n < (int)sizeof(s)) ? n : sizeof(s) - 1);
 }
 
 void AString::append(double x) {
-    char s[16];
-    sprintf(s, "%f", x);
+    char s[64];
+    int n = snprintf(s, sizeof(s), "%f", x);
 
-    append(s);
+    append(s, (n < (int)sizeof(s)) ? n : sizeof(s) - 1);
 }
 
 void AString::append(void *x) {
-    char s[16];
-    sprintf(s, "%p", x);
+    char s[32];
+    int n = snprintf(s, sizeof(s), "%p", x);
 
-    append(s);
+    append(s, n);
 }
 
 ssize_t AString::find(const char *substring, size_t start) const {
@@ -270,12 +339,8 @@ void AString::insert(const char *from, size_t size, size_t insertionPos) {
     CHECK_GE(insertionPos, 0u);
     CHECK_LE(insertionPos, mSize);
 
-    makeMutable();
-
     if (mSize + size + 1 > mAllocSize) {
-        mAllocSize = (mAllocSize + size + 31) & -32;
-        mData = (char *)realloc(mData, mAllocSize);
-        CHECK(mData != NULL);
+        growTo(mSize + size + 1);
     }
 
     memmove(&mData[insertionPos + size],
@@ -299,8 +364,6 @@ int AString::compare(const AString &other) const {
 }
 
 void AString::tolower() {
-    makeMutable();
-
     for (size_t i = 0; i < mSize; ++i) {
         mData[i] = ::tolower(mData[i]);
     }
@@ -322,6 +322,7 @@ static bool isFourcc(uint32_t what) {
 
 AString XMessage::debugString(int32_t indent) const {
     AString s = "XMessage(what = ";
+    s.reserve(64 + 48 * mNumItems);
 
     AString tmp;
     if (isFourcc(mWhat)) {
@@ -342,12 +343,16 @@ AString XMessage::debugString(int32_t indent) const {
 
         switch (item.mType) {
             case kTypeInt32:
-                tmp = StringPrintf(
-                        "int32_t %s = %d", item.mName, item.u.int32Value);
+                tmp = "int32_t ";
+                tmp.append(item.mName);
+                tmp.append(" = ");
+                tmp.append(item.u.int32Value);
                 break;
             case kTypeInt64:
-                tmp = StringPrintf(
-                        "int64_t %s = %lld", item.mName, item.u.int64Value);
+                tmp = "int64_t ";
+                tmp.append(item.mName);
+                tmp.append(" = ");
+                tmp.append((long long)item.u.int64Value);
                 break;
             case kTypeSize:
                 tmp = StringPrintf(
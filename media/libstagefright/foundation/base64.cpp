@@ -21,78 +21,113 @@
 
 namespace android {
 
-sp<ABuffer> decodeBase64(const AString &s) {
-    if ((s.size() % 4) != 0) {
-        return NULL;
+static const char kEncodeTable[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Maps a base64 character to its 6-bit value, anything else to 0xff.
+static const uint8_t kDecodeTable[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static size_t countPadding(const char *s, size_t size) {
+    if (size >= 1 && s[size - 1] == '=') {
+        if (size >= 2 && s[size - 2] == '=') {
+            return 2;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+ssize_t decodedBase64Size(const char *s, size_t size) {
+    if ((size % 4) != 0) {
+        return -1;
     }
 
-    size_t n = s.size();
-    size_t padding = 0;
-    if (n >= 1 && s.c_str()[n - 1] == '=') {
-        padding = 1;
+    return 3 * size / 4 - countPadding(s, size);
+}
 
-        if (n >= 2 && s.c_str()[n - 2] == '=') {
-            padding = 2;
-        }
+ssize_t decodeBase64(
+        const char *s, size_t size, uint8_t *out, size_t outCapacity) {
+    ssize_t outLen = decodedBase64Size(s, size);
+    if (outLen < 0 || (size_t)outLen > outCapacity) {
+        return -1;
     }
 
-    size_t outLen = 3 * s.size() / 4 - padding;
+    if (size == 0) {
+        return 0;
+    }
 
-    sp<ABuffer> buffer = new ABuffer(outLen);
+    const uint8_t *in = (const uint8_t *)s;
+    size_t padding = countPadding(s, size);
 
-    uint8_t *out = buffer->data();
-    size_t j = 0;
-    uint32_t accum = 0;
-    for (size_t i = 0; i < n; ++i) {
-        char c = s.c_str()[i];
-        unsigned value;
-        if (c >= 'A' && c <= 'Z') {
-            value = c - 'A';
-        } else if (c >= 'a' && c <= 'z') {
-            value = 26 + c - 'a';
-        } else if (c >= '0' && c <= '9') {
-            value = 52 + c - '0';
-        } else if (c == '+') {
-            value = 62;
-        } else if (c == '/') {
-            value = 63;
-        } else if (c != '=') {
-            return NULL;
-        } else {
-            if (i < n - padding) {
-                return NULL;
-            }
-
-            value = 0;
+    // All groups but the last are free of padding. A single table lookup
+    // per character with the error check folded into one test per group.
+    size_t numFullGroups = size / 4 - 1;
+    for (size_t i = 0; i < numFullGroups; ++i) {
+        uint32_t a = kDecodeTable[in[0]];
+        uint32_t b = kDecodeTable[in[1]];
+        uint32_t c = kDecodeTable[in[2]];
+        uint32_t d = kDecodeTable[in[3]];
+
+        if ((a | b | c | d) & 0x80) {
+            return -1;
         }
 
-        accum = (accum << 6) | value;
+        uint32_t accum = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = accum >> 16;
+        out[1] = (accum >> 8) & 0xff;
+        out[2] = accum & 0xff;
 
-        if (((i + 1) % 4) == 0) {
-            out[j++] = (accum >> 16);
+        in += 4;
+        out += 3;
+    }
 
-            if (j < outLen) { out[j++] = (accum >> 8) & 0xff; } 
-            if (j < outLen) { out[j++] = accum & 0xff; }
+    uint32_t a = kDecodeTable[in[0]];
+    uint32_t b = kDecodeTable[in[1]];
+    uint32_t c = (padding == 2) ? 0 : kDecodeTable[in[2]];
+    uint32_t d = (padding >= 1) ? 0 : kDecodeTable[in[3]];
 
-            accum = 0;
-        }
+    if ((a | b | c | d) & 0x80) {
+        return -1;
     }
 
-    return buffer;
+    uint32_t accum = (a << 18) | (b << 12) | (c << 6) | d;
+    out[0] = accum >> 16;
+    if (padding < 2) { out[1] = (accum >> 8) & 0xff; }
+    if (padding < 1) { out[2] = accum & 0xff; }
+
+    return outLen;
 }
 
-static char encode6Bit(unsigned x) {
-    if (x <= 25) {
-        return 'A' + x;
-    } else if (x <= 51) {
-        return 'a' + x - 26;
-    } else if (x <= 61) {
-        return '0' + x - 52;
-    } else if (x == 62) {
-        return '+';
-    } else {
-        return '/';
+sp<ABuffer> decodeBase64(const AString &s) {
+    ssize_t outLen = decodedBase64Size(s.c_str(), s.size());
+    if (outLen < 0) {
+        return NULL;
+    }
+
+    sp<ABuffer> buffer = new ABuffer(outLen);
+
+    if (decodeBase64(s.c_str(), s.size(), buffer->data(), outLen) < 0) {
+        return NULL;
     }
+
+    return buffer;
 }
 
 void encodeBase64(
@@ -101,17 +136,26 @@ void encodeBase64(
 
     const uint8_t *data = (const uint8_t *)_data;
 
+    // Encode into a stack chunk and append in bulk rather than appending
+    // one character at a time.
+    char chunk[256];
+    size_t n = 0;
+
     size_t i;
     for (i = 0; i < (size / 3) * 3; i += 3) {
-        uint8_t x1 = data[i];
-        uint8_t x2 = data[i + 1];
-        uint8_t x3 = data[i + 2];
-
-        out->append(encode6Bit(x1 >> 2));
-        out->append(encode6Bit((x1 << 4 | x2 >> 4) & 0x3f));
-        out->append(encode6Bit((x2 << 2 | x3 >> 6) & 0x3f));
-        out->append(encode6Bit(x3 & 0x3f));
+        uint32_t accum = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+
+        chunk[n++] = kEncodeTable[accum >> 18];
+        chunk[n++] = kEncodeTable[(accum >> 12) & 0x3f];
+        chunk[n++] = kEncodeTable[(accum >> 6) & 0x3f];
+        chunk[n++] = kEncodeTable[accum & 0x3f];
+
+        if (n == sizeof(chunk)) {
+            out->append(chunk, n);
+            n = 0;
+        }
     }
+
     switch (size % 3) {
         case 0:
             break;
@@ -119,21 +163,24 @@ void encodeBase64(
         {
             uint8_t x1 = data[i];
             uint8_t x2 = data[i + 1];
-            out->append(encode6Bit(x1 >> 2));
-            out->append(encode6Bit((x1 << 4 | x2 >> 4) & 0x3f));
-            out->append(encode6Bit((x2 << 2) & 0x3f));
-            out->append('=');
+            chunk[n++] = kEncodeTable[x1 >> 2];
+            chunk[n++] = kEncodeTable[(x1 << 4 | x2 >> 4) & 0x3f];
+            chunk[n++] = kEncodeTable[(x2 << 2) & 0x3f];
+            chunk[n++] = '=';
             break;
         }
         default:
         {
             uint8_t x1 = data[i];
-            out->append(encode6Bit(x1 >> 2));
-            out->append(encode6Bit((x1 << 4) & 0x3f));
-            out->append("==");
+            chunk[n++] = kEncodeTable[x1 >> 2];
+            chunk[n++] = kEncodeTable[(x1 << 4) & 0x3f];
+            chunk[n++] = '=';
+            chunk[n++] = '=';
             break;
         }
     }
+
+    out->append(chunk, n);
 }
 
 }  // namespace android
@@ -30,11 +30,14 @@
 namespace android {
 
 void hexdump(const void *_data, size_t size) {
+    static const char kHexDigits[] = "0123456789abcdef";
+
     const uint8_t *data = (const uint8_t *)_data;
 
     size_t offset = 0;
     while (offset < size) {
         AString line;
+        line.reserve(80);
 
         char tmp[32];
         sprintf(tmp, "%08lx:  ", (unsigned long)offset);
@@ -48,8 +51,9 @@ void hexdump(const void *_data, size_t size) {
             if (offset + i >= size) {
                 line.append("   ");
             } else {
-                sprintf(tmp, "%02x ", data[offset + i]);
-                line.append(tmp);
+                uint8_t x = data[offset + i];
+                char hex[3] = { kHexDigits[x >> 4], kHexDigits[x & 0x0f], ' ' };
+                line.append(hex, sizeof(hex));
             }
         }
 